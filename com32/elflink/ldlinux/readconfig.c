@@ -19,6 +19,7 @@
 #include <string.h>
 #include <minmax.h>
 #include <alloca.h>
+#include <arena.h>
 #include <inttypes.h>
 #include <colortbl.h>
 #include <com32.h>
@@ -109,6 +110,21 @@ static bool menusave = false;	/* True if there is any "menu save" */
 static struct menu_entry *all_entries;
 static struct menu_entry **all_entries_end = &all_entries;
 
+/*
+ * Menus, entries and the strings hanging off them all live as long as
+ * the configuration, so they are allocated from one arena.
+ */
+static struct arena config_arena = ARENA_INIT(0);
+
+/*
+ * Nothing else frees it: when a CONFIG command reloads ldlinux.c32, a
+ * fresh copy of this module parses the new files from scratch.
+ */
+static void __destructor config_exit(void)
+{
+    arena_free_all(&config_arena);
+}
+
 static const struct messages messages[MSG_COUNT] = {
     [MSG_AUTOBOOT] = {"autoboot", "Automatic boot in # second{,s}..."},
     [MSG_TAB] = {"tabmsg", "Press [Tab] to edit options"},
@@ -122,6 +138,114 @@ static const struct messages messages[MSG_COUNT] = {
                       if ( __p ) memcpy(__p, __x, __n); \
                       __p; })
 
+/*
+ * Hash indexes of entry labels and menu names, built once parsing is
+ * done.  A name maps to whatever a walk of all_entries or menu_list
+ * would have found first.  Until an index is built (or if building it
+ * ran out of memory) lookups fall back to walking the list.
+ */
+struct name_node {
+    struct name_node *next;
+    const char *name;
+    void *ptr;			/* struct menu_entry or struct menu */
+};
+
+struct name_index {
+    struct name_node **table;	/* NULL if not built */
+    unsigned int mask;
+};
+
+static struct name_index label_index, menu_index;
+
+static unsigned int name_hash(const char *str, int len)
+{
+    unsigned int h = 0;
+
+    while (len--)
+	h = h * 31 + (unsigned char)*str++;
+
+    return h;
+}
+
+static bool index_init(struct name_index *ix, int count)
+{
+    unsigned int size = 16;
+
+    while (size < 2 * count)
+	size <<= 1;
+
+    ix->table = arena_zalloc(&config_arena, size * sizeof(*ix->table));
+    ix->mask = size - 1;
+
+    return ix->table != NULL;
+}
+
+static bool index_add(struct name_index *ix, const char *name, void *ptr)
+{
+    struct name_node **np, *n;
+
+    np = &ix->table[name_hash(name, strlen(name)) & ix->mask];
+    for (; *np; np = &(*np)->next) {
+	if (!strcmp((*np)->name, name))
+	    return true;	/* Only the first one counts */
+    }
+
+    n = arena_alloc(&config_arena, sizeof *n);
+    if (!n) {
+	ix->table = NULL;
+	return false;
+    }
+
+    n->next = NULL;
+    n->name = name;
+    n->ptr = ptr;
+    *np = n;
+
+    return true;
+}
+
+/* Returns the match for the first LEN bytes of STR */
+static void *index_find(const struct name_index *ix, const char *str, int len)
+{
+    struct name_node *n;
+
+    for (n = ix->table[name_hash(str, len) & ix->mask]; n; n = n->next) {
+	if (!strncmp(str, n->name, len) && !n->name[len])
+	    return n->ptr;
+    }
+
+    return NULL;
+}
+
+static void build_indexes(void)
+{
+    struct menu_entry *me;
+    struct menu *m;
+    int count;
+
+    count = 0;
+    for (me = all_entries; me; me = me->next)
+	count++;
+
+    if (index_init(&label_index, count)) {
+	for (me = all_entries; me; me = me->next) {
+	    if (me->label && !index_add(&label_index, me->label, me))
+		break;
+	}
+    }
+
+    count = 0;
+    for (m = menu_list; m; m = m->next)
+	count++;
+
+    if (index_init(&menu_index, count)) {
+	for (m = menu_list; m; m = m->next) {
+	    if (m->label && !index_add(&menu_index, m->label, m))
+		break;
+	}
+    }
+}
+
 /*
  * Search the list of all menus for a specific label
  */
@@ -129,6 +253,9 @@ static struct menu *find_menu(const char *label)
 {
     struct menu *m;
 
+    if (menu_index.table)
+	return index_find(&menu_index, label, strlen(label));
+
     for (m = menu_list; m; m = m->next) {
 	if (!strcmp(label, m->label))
 	    return m;
@@ -137,6 +264,24 @@ static struct menu *find_menu(const char *label)
     return NULL;
 }
 
+/*
+ * Find the entry labelled with the first LEN bytes of STR
+ */
+static struct menu_entry *lookup_label(const char *str, int len)
+{
+    struct menu_entry *me;
+
+    if (label_index.table)
+	return index_find(&label_index, str, len);
+
+    for (me = all_entries; me; me = me->next) {
+	if (!strncmp(str, me->label, len) && !me->label[len])
+	    return me;
+    }
+
+    return NULL;
+}
+
 #define MAX_LINE 4096
 
 /* Strip ^ from a string, returning a new reference to the same refstring
@@ -190,7 +335,7 @@ static char *looking_at(char *line, const char *kwd)
 static struct menu *new_menu(struct menu *parent,
 			     struct menu_entry *parent_entry, const char *label)
 {
-    struct menu *m = calloc(1, sizeof(struct menu));
+    struct menu *m = arena_zalloc(&config_arena, sizeof(struct menu));
     int i;
 	
 	//dprintf("enter: menu_label = %s", label);
@@ -294,7 +439,7 @@ static struct menu_entry *new_entry(struct menu *m)
 				  sizeof(struct menu_entry *));
     }
 
-    me = calloc(1, sizeof(struct menu_entry));
+    me = arena_zalloc(&config_arena, sizeof(struct menu_entry));
     me->menu = m;
     me->entry = m->nentries;
     m->menu_entries[m->nentries++] = me;
@@ -485,7 +630,6 @@ void print_labels(const char *prefix, size_t len)
 struct menu_entry *find_label(const char *str)
 {
     const char *p;
-    struct menu_entry *me;
     int pos;
 
     p = str;
@@ -495,12 +639,7 @@ struct menu_entry *find_label(const char *str)
     /* p now points to the first byte beyond the kernel name */
     pos = p - str;
 
-    for (me = all_entries; me; me = me->next) {
-	if (!strncmp(str, me->label, pos) && !me->label[pos])
-	    return me;
-    }
-
-    return NULL;
+    return lookup_label(str, pos);
 }
 
 static const char *unlabel(const char *str)
@@ -518,13 +657,12 @@ static const char *unlabel(const char *str)
     /* p now points to the first byte beyond the kernel name */
     pos = p - str;
 
-    for (me = all_entries; me; me = me->next) {
-	if (!strncmp(str, me->label, pos) && !me->label[pos]) {
-	    /* Found matching label */
-	    rsprintf(&q, "%s%s", me->cmdline, p);
-	    refstr_put(str);
-	    return q;
-	}
+    me = lookup_label(str, pos);
+    if (me) {
+	/* Found matching label */
+	rsprintf(&q, "%s%s", me->cmdline, p);
+	refstr_put(str);
+	return q;
     }
 
     return str;
@@ -1429,6 +1567,32 @@ static void parse_config_file(FILE * f)
 			SendCookies = strtoul(skipspace(p), NULL, 10);
 			http_bake_cookies();
 		}
+	} else if ((ep = looking_at(p, "tftpblksize"))) {
+		const union syslinux_derivative_info *sdi;
+
+		sdi = syslinux_derivative_info();
+		if (sdi->c.filesystem == SYSLINUX_FS_PXELINUX)
+			TftpBlkSize = strtoul(skipspace(ep), NULL, 10);
+	} else if ((ep = looking_at(p, "tftpwindowsize"))) {
+		const union syslinux_derivative_info *sdi;
+
+		sdi = syslinux_derivative_info();
+		if (sdi->c.filesystem == SYSLINUX_FS_PXELINUX)
+			TftpWindowSize = strtoul(skipspace(ep), NULL, 10);
+	} else if ((ep = looking_at(p, "httpconnections"))) {
+		const union syslinux_derivative_info *sdi;
+
+		sdi = syslinux_derivative_info();
+		if (sdi->c.filesystem == SYSLINUX_FS_PXELINUX)
+			HttpConnections = strtoul(skipspace(ep), NULL, 10);
+	} else if ((ep = looking_at(p, "netcachesize"))) {
+		const union syslinux_derivative_info *sdi;
+		unsigned long kb = strtoul(skipspace(ep), NULL, 10);
+
+		sdi = syslinux_derivative_info();
+		if (sdi->c.filesystem == SYSLINUX_FS_PXELINUX)
+			NetCacheSize = kb > (UINT32_MAX >> 10) ?
+				UINT32_MAX : kb << 10;
 	}
     }
 }
@@ -1495,11 +1659,13 @@ void parse_configs(char **argv)
     struct menu_entry *me;
     dprintf("enter");
 
+    refstr_set_arena(&config_arena);
     empty_string = refstrdup("");
 
     /* feng: reset current menu_list and entry list */
     menu_list = NULL;
     all_entries = NULL;
+    label_index.table = menu_index.table = NULL;
 
     /* Initialize defaults for the root and hidden menus */
     hide_menu = new_menu(NULL, NULL, refstrdup(".hidden"));
@@ -1515,6 +1681,7 @@ void parse_configs(char **argv)
     if (!argv || !*argv) {
 	if (parse_main_config(NULL) < 0) {
 	    printf("WARNING: No configuration file found\n");
+	    refstr_set_arena(NULL);
 	    return;
 	}
     } else {
@@ -1528,6 +1695,7 @@ void parse_configs(char **argv)
     record(current_menu, &ld, append);
 
     /* Common postprocessing */
+    build_indexes();
     resolve_gotos();
 
     /* Handle global default */
@@ -1568,4 +1736,6 @@ void parse_configs(char **argv)
 	if (m->onerror)
 	    m->onerror = unlabel(m->onerror);
     }
+
+    refstr_set_arena(NULL);
 }
@@ -0,0 +1,149 @@
+#include "unittest/unittest.h"
+#include </usr/include/string.h>
+#include </usr/include/sys/times.h>
+#include <stdbool.h>
+
+/* com32's clock_t is 32 bits, and readconfig.c relies on that */
+#define clock_t uint32_t
+
+/*
+ * Fake dependencies of readconfig.c.  Nothing here parses a file: the
+ * test builds the entry and menu lists directly, the way the parser
+ * would, and then exercises the label and menu indexes.
+ */
+char config_cwd[FILENAME_MAX];
+char KernelName[FILENAME_MAX];
+uint16_t DisplayCon;
+uint32_t SysAppends;
+
+char *skipspace(const char *p);
+
+struct color_table *default_color_table(void)
+{
+    return NULL;
+}
+
+struct color_table *copy_color_table(const struct color_table *master)
+{
+    return NULL;
+}
+
+#include "../readconfig.c"
+#include "../../../lib/arena.c"
+#include "../../../lib/refstr.c"
+
+enum { NLABELS = 10000, NMENUS = 100 };
+
+static void make_config(void)
+{
+    struct menu_entry *me;
+    struct menu *m;
+    int i;
+
+    refstr_set_arena(&config_arena);
+    empty_string = refstrdup("");
+
+    root_menu = new_menu(NULL, NULL, refstrdup(".top"));
+    for (i = 0; i < NMENUS; i++) {
+	m = new_menu(NULL, NULL, NULL);
+	rsprintf(&m->label, "menu%03d", i);
+    }
+
+    for (i = 0; i < NLABELS; i++) {
+	me = new_entry(root_menu);
+	rsprintf(&me->label, "label%05d", i);
+	rsprintf(&me->cmdline, "kernel%05d", i);
+    }
+
+    /* A duplicate label: the first one must still win */
+    me = new_entry(root_menu);
+    me->label = refstrdup("label00042");
+    me->cmdline = refstrdup("duplicate");
+}
+
+static void test_lookups(void)
+{
+    char name[16];
+    struct menu_entry *me;
+    int i;
+
+    for (i = 0; i < NLABELS; i++) {
+	sprintf(name, "label%05d", i);
+	me = find_label(name);
+	syslinux_assert_str(me && !strcmp(me->label, name),
+			    "label %s not found", name);
+    }
+
+    me = find_label("label00042 quiet");
+    syslinux_assert_str(me && !strcmp(me->cmdline, "kernel00042"),
+			"label00042 with arguments found the wrong entry");
+
+    syslinux_assert_str(!find_label("label"),
+			"a prefix of a label matched it");
+    syslinux_assert_str(!find_label("label100000"),
+			"an unknown label matched");
+
+    for (i = 0; i < NMENUS; i++) {
+	sprintf(name, "menu%03d", i);
+	syslinux_assert_str(find_menu(name) != NULL,
+			    "menu %s not found", name);
+    }
+    syslinux_assert_str(!find_menu("menu"), "an unknown menu matched");
+}
+
+static double bench_lookups(void)
+{
+    enum { ROUNDS = 20000, RUNS = 5 };
+    char name[16];
+    double t, best = 0;
+    int i, run;
+
+    for (run = 0; run < RUNS; run++) {
+	rnd_state = 1;
+
+	t = now();
+	for (i = 0; i < ROUNDS; i++) {
+	    sprintf(name, "label%05u", rnd() % NLABELS);
+	    if (!find_label(name))
+		abort();
+	}
+	t = now() - t;
+	if (!run || t < best)
+	    best = t;
+    }
+
+    return best * 1e9 / ROUNDS;
+}
+
+int main(int argc, char **argv)
+{
+    struct name_index saved;
+    double t, walk, hashed;
+
+    make_config();
+
+    /* Without an index: the list walk */
+    test_lookups();
+    walk = bench_lookups();
+
+    t = now();
+    build_indexes();
+    t = now() - t;
+    syslinux_assert_str(label_index.table && menu_index.table,
+			"build_indexes() ran out of memory");
+
+    test_lookups();
+    hashed = bench_lookups();
+
+    printf("\tlist walk    %8.0f ns/lookup of %d labels\n", walk, NLABELS);
+    printf("\tindex        %8.0f ns/lookup, built in %.0f us\n",
+	   hashed, t * 1e6);
+
+    /* An index that failed to build falls back to the walk */
+    saved = label_index;
+    label_index.table = NULL;
+    test_lookups();
+    label_index = saved;
+
+    return 0;
+}
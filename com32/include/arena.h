@@ -0,0 +1,49 @@
+/*
+ * arena.h
+ *
+ * Arena (bump) allocator, for lots of small objects which are all
+ * freed together, such as a parsed configuration.
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_CHUNK	16384	/* Default chunk size */
+#define ARENA_ALIGN	8
+
+struct arena_chunk;
+
+struct arena {
+    struct arena_chunk *chunks;	/* All chunks, current one first */
+    char *ptr;			/* Next free byte in the current chunk */
+    char *end;			/* End of the current chunk */
+    size_t chunk_size;		/* 0 for ARENA_CHUNK */
+};
+
+#define ARENA_INIT(size)	{ NULL, NULL, NULL, (size) }
+
+void *__arena_alloc(struct arena *, size_t);
+void *arena_zalloc(struct arena *, size_t);
+char *arena_strdup(struct arena *, const char *);
+char *arena_strndup(struct arena *, const char *, size_t);
+void arena_free_all(struct arena *);
+
+/*
+ * Allocate SIZE bytes, aligned to ARENA_ALIGN.  The memory can't be
+ * freed other than with arena_free_all().
+ */
+static inline void *arena_alloc(struct arena *a, size_t size)
+{
+    char *p = a->ptr;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (!p || size > (size_t)(a->end - p))
+	return __arena_alloc(a, size);
+
+    a->ptr = p + size;
+    return p;
+}
+
+#endif /* _ARENA_H */
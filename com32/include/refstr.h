@@ -30,7 +30,10 @@ const char *refstr_get(const char *r)
     return r;
 }
 
+struct arena;
+
 void refstr_put(const char *);
+void refstr_set_arena(struct arena *);
 char *refstr_alloc(size_t);
 const char *refstrdup(const char *);
 const char *refstrndup(const char *, size_t);
@@ -8,6 +8,7 @@
 #include <klibc/extern.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <sys/types.h>
 
 /* This structure doesn't really exist, but it gives us something
    to define FILE * with */
@@ -65,7 +66,16 @@ __extern int fputc(int, FILE *);
 
 __extern int fgetc(FILE *);
 __extern char *fgets(char *, int, FILE *);
-#define getc(f) fgetc(f)
+__extern ssize_t getdelim(char **, size_t *, int, FILE *);
+
+/* getc() takes from the input buffer inline when it can */
+#include <sys/stdiobuf.h>
+#define getc(f) __getc(f)
+
+static __inline__ ssize_t getline(char **__l, size_t *__n, FILE * __f)
+{
+    return getdelim(__l, __n, '\n', __f);
+}
 
 __extern size_t _fread(void *, size_t, FILE *);
 __extern size_t _fwrite(const void *, size_t, FILE *);
@@ -105,7 +115,7 @@ __extern int vasprintf(char **, const char *, va_list);
 #define mpi()	mp("enter")
 #define mpo()	mp("exit")
 
-/* No buffering, so no flushing needed */
+/* Output isn't buffered, so no flushing needed */
 static __inline__ int fflush(FILE * __f)
 {
     (void)__f;
@@ -0,0 +1,36 @@
+/*
+ * sys/stdiobuf.h
+ *
+ * Input buffering, for <stdio.h>.  Ordinary files are read BUFSIZ
+ * bytes at a time into a buffer per file descriptor, which getc() and
+ * friends consume without going through the device layer.  Consoles
+ * and other devices are never read ahead of what was asked for, so
+ * their buffer stays empty.
+ *
+ * FILE and fileno() have to be defined before this is included.
+ */
+
+#ifndef _SYS_STDIOBUF_H
+#define _SYS_STDIOBUF_H
+
+#include <klibc/extern.h>
+#include <sys/types.h>
+
+struct _IO_buf {
+    unsigned char *pos;		/* Next unread character */
+    unsigned char *end;		/* End of buffered data */
+    unsigned char *base;	/* Buffer, allocated on first use */
+};
+
+__extern struct _IO_buf __stdio_bufs[];
+__extern ssize_t __stdio_fill(FILE *);
+__extern int fgetc(FILE *);
+
+static __inline__ int __getc(FILE * __f)
+{
+    struct _IO_buf *__b = &__stdio_bufs[fileno(__f)];
+
+    return (__b->pos < __b->end) ? *__b->pos++ : fgetc(__f);
+}
+
+#endif /* _SYS_STDIOBUF_H */
@@ -44,6 +44,7 @@ struct mem_ops {
 	void *(*malloc)(size_t, enum heap, size_t);
 	void *(*realloc)(void *, size_t);
 	void (*free)(void *);
+	void *(*malloc_at)(void *, size_t, enum heap, size_t);
 };
 
 struct initramfs;
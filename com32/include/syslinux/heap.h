@@ -0,0 +1,56 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * syslinux/heap.h
+ *
+ * The core's heaps and allocation tags, and usage statistics for them.
+ */
+
+#ifndef _SYSLINUX_HEAP_H
+#define _SYSLINUX_HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * This is a temporary hack.  In Syslinux 5 this will be a pointer to
+ * the owner module.
+ */
+typedef size_t malloc_tag_t;
+enum malloc_owner {
+    MALLOC_FREE,
+    MALLOC_HEAD,
+    MALLOC_CORE,
+    MALLOC_MODULE,
+};
+
+enum heap {
+    HEAP_MAIN,
+    HEAP_LOWMEM,
+    NHEAP
+};
+
+/*
+ * Heap statistics, as returned by get_heap_stats()
+ */
+struct heap_stats {
+    size_t tag_bytes, tag_blocks;	/* In use with the requested tag */
+    size_t used_bytes, used_blocks;	/* In use, any tag */
+    size_t free_bytes, free_blocks;	/* On the general free list */
+    size_t largest_free;		/* Largest block on the free list */
+    size_t cached_bytes, cached_blocks;	/* On the size-class lists */
+    uint32_t fast_allocs;		/* Served from a size-class list */
+    uint32_t slow_allocs;		/* Needed a walk of the free list */
+};
+
+void get_heap_stats(enum heap heap, malloc_tag_t tag, struct heap_stats *st);
+
+#endif /* _SYSLINUX_HEAP_H */
@@ -161,6 +161,8 @@ int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
 			struct initramfs *initramfs,
 			struct setup_data *setup_data,
 			char *cmdline);
+uint32_t syslinux_initramfs_addr(const void *kernel_buf, size_t kernel_size,
+				 const char *cmdline, uint32_t irf_size);
 
 /* Initramfs manipulation functions */
 
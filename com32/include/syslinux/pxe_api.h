@@ -592,4 +592,9 @@ uint32_t __weak pxe_dns(const char *);
 extern uint32_t __weak SendCookies;
 void __weak http_bake_cookies(void);
 
+extern uint16_t __weak TftpBlkSize;
+extern uint16_t __weak TftpWindowSize;
+extern unsigned int __weak HttpConnections;
+extern uint32_t __weak NetCacheSize;
+
 #endif /* _SYSLINUX_PXE_API_H */
@@ -0,0 +1,101 @@
+/*
+ * arena.c
+ *
+ * Arena (bump) allocator.  Memory is taken from malloc() a chunk at a
+ * time and handed out in order; nothing is freed until the whole arena
+ * goes away.  Allocations too big to share a chunk get one of their
+ * own, so they don't waste the rest of the current chunk.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <arena.h>
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    char data[] __attribute__ ((aligned(ARENA_ALIGN)));
+};
+
+static inline struct arena_chunk *arena_new_chunk(size_t size)
+{
+    return malloc(sizeof(struct arena_chunk) + size);
+}
+
+/* Slow path of arena_alloc(): SIZE is already rounded up */
+void *__arena_alloc(struct arena *a, size_t size)
+{
+    size_t chunk_size = a->chunk_size ? a->chunk_size : ARENA_CHUNK;
+    struct arena_chunk *c;
+
+    if (size > chunk_size / 4) {
+	c = arena_new_chunk(size);
+	if (!c)
+	    return NULL;
+
+	/* Link it in behind the current chunk, which keeps its space */
+	if (a->chunks) {
+	    c->next = a->chunks->next;
+	    a->chunks->next = c;
+	} else {
+	    c->next = NULL;
+	    a->chunks = c;
+	}
+	return c->data;
+    }
+
+    c = arena_new_chunk(chunk_size);
+    if (!c)
+	return NULL;
+
+    c->next = a->chunks;
+    a->chunks = c;
+    a->ptr = c->data + size;
+    a->end = c->data + chunk_size;
+
+    return c->data;
+}
+
+void *arena_zalloc(struct arena *a, size_t size)
+{
+    void *p = arena_alloc(a, size);
+
+    if (p)
+	memset(p, 0, size);
+
+    return p;
+}
+
+char *arena_strndup(struct arena *a, const char *s, size_t n)
+{
+    size_t l = strnlen(s, n);
+    char *d = arena_alloc(a, l + 1);
+
+    if (d) {
+	memcpy(d, s, l);
+	d[l] = '\0';
+    }
+
+    return d;
+}
+
+char *arena_strdup(struct arena *a, const char *s)
+{
+    return arena_strndup(a, s, (size_t)-1);
+}
+
+/*
+ * Free everything allocated from the arena; it can be used again
+ * afterwards.
+ */
+void arena_free_all(struct arena *a)
+{
+    struct arena_chunk *c, *next;
+
+    for (c = a->chunks; c; c = next) {
+	next = c->next;
+	free(c);
+    }
+
+    a->chunks = NULL;
+    a->ptr = a->end = NULL;
+}
@@ -1,9 +1,8 @@
 /*
  * fgetc.c
  *
- * Extremely slow fgetc implementation, using _fread().  If people
- * actually need character-oriented input to be fast, we may actually
- * have to implement buffering.  Sigh.
+ * getc() only calls us when the buffer is empty.  Devices which aren't
+ * buffered still get read one character at a time, using _fread().
  */
 
 #include <stdio.h>
@@ -13,7 +12,18 @@
 
 int fgetc(FILE * f)
 {
+    struct _IO_buf *b = &__stdio_bufs[fileno(f)];
     unsigned char ch;
+    ssize_t rv;
+
+    if (b->pos < b->end)
+	return *b->pos++;
+
+    rv = __stdio_fill(f);
+    if (rv > 0)
+	return *b->pos++;
+    else if (!rv)
+	return EOF;
 
     return (_fread(&ch, 1, f) == 1) ? (int)ch : EOF;
 }
@@ -1,20 +1,46 @@
 /*
  * fgets.c
  *
- * This will be very slow due to the implementation of getc(),
- * but we can't afford to drain characters we don't need from
- * the input.
+ * Copy whole lines out of the input buffer; devices which aren't
+ * buffered are read a character at a time, since we can't afford to
+ * drain characters we don't need from the input.
  */
 
 #include <stdio.h>
+#include <string.h>
 
 char *fgets(char *s, int n, FILE * f)
 {
-    int ch;
+    struct _IO_buf *b = &__stdio_bufs[fileno(f)];
+    const unsigned char *nl;
     char *p = s;
+    size_t len;
+    ssize_t rv;
+    int ch;
 
     while (n > 1) {
-	ch = getc(f);
+	if (b->pos < b->end) {
+	    len = b->end - b->pos;
+	    if (len > (size_t)(n - 1))
+		len = n - 1;
+	    nl = memchr(b->pos, '\n', len);
+	    if (nl)
+		len = nl - b->pos + 1;
+
+	    memcpy(p, b->pos, len);
+	    b->pos += len;
+	    p += len;
+	    n -= len;
+	    if (nl)
+		break;
+	    continue;
+	}
+
+	rv = __stdio_fill(f);
+	if (rv > 0)
+	    continue;
+
+	ch = rv ? fgetc(f) : EOF;
 	if (ch == EOF) {
 	    *p = '\0';
 	    return (p == s) ? NULL : s;
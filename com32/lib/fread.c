@@ -5,13 +5,26 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 
 size_t _fread(void *buf, size_t count, FILE * f)
 {
+    struct _IO_buf *b = &__stdio_bufs[fileno(f)];
     size_t bytes = 0;
     ssize_t rv;
     char *p = buf;
 
+    /* Anything getc() and friends have read ahead goes first */
+    if (b->pos < b->end) {
+	bytes = b->end - b->pos;
+	if (bytes > count)
+	    bytes = count;
+	memcpy(p, b->pos, bytes);
+	b->pos += bytes;
+	p += bytes;
+	count -= bytes;
+    }
+
     while (count) {
 	rv = read(fileno(f), p, count);
 	if (rv == -1) {
@@ -0,0 +1,85 @@
+/*
+ * getdelim.c
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Make room for at least need bytes in *lineptr
+ */
+static int grow_line(char **lineptr, size_t *n, size_t need)
+{
+    size_t size = *n ? *n : 128;
+    char *p;
+
+    if (*lineptr && *n >= need)
+	return 0;
+
+    while (size < need)
+	size <<= 1;
+
+    p = realloc(*lineptr, size);
+    if (!p) {
+	errno = ENOMEM;
+	return -1;
+    }
+
+    *lineptr = p;
+    *n = size;
+    return 0;
+}
+
+ssize_t getdelim(char **lineptr, size_t *n, int delim, FILE * f)
+{
+    struct _IO_buf *b = &__stdio_bufs[fileno(f)];
+    const unsigned char *end;
+    size_t len, used = 0;
+    ssize_t rv;
+    int ch;
+
+    if (!lineptr || !n) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    for (;;) {
+	if (b->pos < b->end) {
+	    len = b->end - b->pos;
+	    end = memchr(b->pos, delim, len);
+	    if (end)
+		len = end - b->pos + 1;
+
+	    if (grow_line(lineptr, n, used + len + 1))
+		return -1;
+	    memcpy(*lineptr + used, b->pos, len);
+	    b->pos += len;
+	    used += len;
+	    if (end)
+		break;
+	    continue;
+	}
+
+	rv = __stdio_fill(f);
+	if (rv > 0)
+	    continue;
+
+	ch = rv ? fgetc(f) : EOF;
+	if (ch == EOF)
+	    break;
+
+	if (grow_line(lineptr, n, used + 2))
+	    return -1;
+	(*lineptr)[used++] = ch;
+	if (ch == delim)
+	    break;
+    }
+
+    if (!used)
+	return -1;
+
+    (*lineptr)[used] = '\0';
+    return used;
+}
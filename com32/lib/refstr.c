@@ -19,17 +19,41 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <sys/module.h>
-#include "refstr.h"
+#include <arena.h>
+#include <refstr.h>
+
+/*
+ * While an arena is set, new refstrings come out of it.  Their count
+ * starts at REFSTR_ARENA, so refstr_put() never frees them; they go
+ * away with the arena.
+ */
+#define REFSTR_ARENA	0x80000000U
+
+static struct arena *refstr_arena;
+
+void refstr_set_arena(struct arena *arena)
+{
+    refstr_arena = arena;
+}
 
 /* Allocate space for a refstring of len bytes, plus final null */
 /* The final null is inserted in the string; the rest is uninitialized. */
 char *refstr_alloc(size_t len)
 {
-    char *r = malloc(sizeof(unsigned int) + len + 1);
-    if (!r)
-	return NULL;
-    *(unsigned int *)r = 1;
+    size_t size = sizeof(unsigned int) + len + 1;
+    char *r;
+
+    if (refstr_arena) {
+	r = arena_alloc(refstr_arena, size);
+	if (!r)
+	    return NULL;
+	*(unsigned int *)r = REFSTR_ARENA | 1;
+    } else {
+	r = malloc(size);
+	if (!r)
+	    return NULL;
+	*(unsigned int *)r = 1;
+    }
     r += sizeof(unsigned int);
     r[len] = '\0';
     return r;
@@ -31,6 +31,7 @@
 
 #include <errno.h>
 #include <com32.h>
+#include <stdio.h>
 #include <string.h>
 #include "file.h"
 
@@ -58,5 +59,8 @@ int close(int fd)
     }
 
     memset(fp, 0, sizeof *fp);	/* File structure unused */
+
+    free(__stdio_bufs[fd].base);
+    memset(&__stdio_bufs[fd], 0, sizeof __stdio_bufs[fd]);
     return 0;
 }
@@ -11,6 +11,8 @@ long ftell(FILE * stream)
 {
     int fd = fileno(stream);
     struct file_info *fp = &__file_info[fd];
+    struct _IO_buf *b = &__stdio_bufs[fd];
 
-    return fp->i.offset;
+    /* Don't count what has been read ahead but not consumed */
+    return fp->i.offset - (b->end - b->pos);
 }
@@ -0,0 +1,45 @@
+/*
+ * sys/stdiobuf.c
+ *
+ * Input buffers for the stdio functions.  Only ordinary files are
+ * buffered: reading ahead on a console would swallow keystrokes meant
+ * for someone else.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "sys/file.h"
+
+struct _IO_buf __stdio_bufs[NFILES];
+
+/*
+ * Refill the buffer of an empty stream.  Returns the number of bytes
+ * now buffered, 0 at end of file or on error, or -1 if the stream
+ * isn't one we buffer.
+ */
+ssize_t __stdio_fill(FILE * f)
+{
+    int fd = fileno(f);
+    struct file_info *fp = &__file_info[fd];
+    struct _IO_buf *b = &__stdio_bufs[fd];
+    ssize_t rv;
+
+    if (fd < 0 || fd >= NFILES || !fp->iop || !(fp->iop->flags & __DEV_FILE))
+	return -1;
+
+    if (!b->base) {
+	b->base = malloc(BUFSIZ);
+	if (!b->base)
+	    return -1;
+    }
+
+    do {
+	rv = read(fd, b->base, BUFSIZ);
+    } while (rv == -1 && (errno == EINTR || errno == EAGAIN));
+
+    b->pos = b->base;
+    b->end = b->base + (rv > 0 ? rv : 0);
+
+    return b->end - b->pos;
+}
@@ -42,14 +42,27 @@
 
 #define INCREMENTAL_CHUNK 1024*1024
 
+/*
+ * A file of unknown length is read into a chain of fixed-size segments
+ * and copied out once at the end.  Growing a single buffer with
+ * realloc() instead can copy the data over and over again, which gets
+ * very slow for a large file in a fragmented heap.
+ */
+struct segment {
+    struct segment *next;
+    size_t len;
+    char data[INCREMENTAL_CHUNK];
+};
+
 int floadfile(FILE * f, void **ptr, size_t * len, const void *prefix,
 	      size_t prefix_len)
 {
     struct stat st;
-    void *data, *dp;
-    size_t alen, clen, rlen, xlen;
+    void *data;
+    char *dp;
+    size_t clen, xlen;
+    struct segment *seg, *segs, **segp;
 
-    clen = alen = 0;
     data = NULL;
 
     if (fstat(fileno(f), &st))
@@ -57,31 +70,36 @@ int floadfile(FILE * f, void **ptr, size_t * len, const void *prefix,
 
     if (!S_ISREG(st.st_mode)) {
 	/* Not a regular file, we can't assume we know the file size */
-	if (prefix_len) {
-	    clen = alen = prefix_len;
-	    data = malloc(prefix_len);
-	    if (!data)
-		goto err;
-
-	    memcpy(data, prefix, prefix_len);
-	}
+	segs = NULL;
+	segp = &segs;
+	clen = prefix_len;
 
 	do {
-	    alen += INCREMENTAL_CHUNK;
-	    dp = realloc(data, alen);
-	    if (!dp)
-		goto err;
-	    data = dp;
+	    seg = malloc(sizeof *seg);
+	    if (!seg)
+		goto err_segs;
+	    seg->next = NULL;
+	    *segp = seg;
+	    segp = &seg->next;
 
-	    rlen = fread((char *)data + clen, 1, alen - clen, f);
-	    clen += rlen;
-	} while (clen == alen);
+	    seg->len = fread(seg->data, 1, INCREMENTAL_CHUNK, f);
+	    clen += seg->len;
+	} while (seg->len == INCREMENTAL_CHUNK);
 
 	*len = clen;
 	xlen = (clen + LOADFILE_ZERO_PAD - 1) & ~(LOADFILE_ZERO_PAD - 1);
-	dp = realloc(data, xlen);
-	if (dp)
-	    data = dp;
+	data = malloc(xlen);
+	if (!data && xlen)
+	    goto err_segs;
+
+	memcpy(data, prefix, prefix_len);
+	dp = (char *)data + prefix_len;
+	while ((seg = segs)) {
+	    memcpy(dp, seg->data, seg->len);
+	    dp += seg->len;
+	    segs = seg->next;
+	    free(seg);
+	}
 	*ptr = data;
     } else {
 	*len = clen = st.st_size + prefix_len - ftell(f);
@@ -101,6 +119,11 @@ int floadfile(FILE * f, void **ptr, size_t * len, const void *prefix,
     memset((char *)data + clen, 0, xlen - clen);
     return 0;
 
+err_segs:
+    while ((seg = segs)) {
+	segs = seg->next;
+	free(seg);
+    }
 err:
     if (data)
 	free(data);
@@ -32,16 +32,74 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <syslinux/loadfile.h>
 #include <syslinux/linux.h>
 
+#define ARCHIVE_SEGMENT	(1024*1024)
+
+/*
+ * An archive of unknown length (e.g. generated on the fly by a web
+ * server) is read in fixed-size segments which are added as
+ * consecutive chunks, and so go straight into the movelist when the
+ * kernel is booted instead of first being gathered into one buffer.
+ */
+static int initramfs_load_segments(struct initramfs *ihead, FILE *f)
+{
+    size_t align = 4;
+    size_t rlen;
+    char *seg, *sp;
+
+    do {
+	/* The padding covers the alignment of whatever comes next */
+	seg = malloc(ARCHIVE_SEGMENT + LOADFILE_ZERO_PAD);
+	if (!seg)
+	    return -1;
+
+	rlen = fread(seg, 1, ARCHIVE_SEGMENT, f);
+	if (!rlen) {
+	    free(seg);
+	    break;
+	}
+	memset(seg + rlen, 0, LOADFILE_ZERO_PAD);
+
+	if (rlen < ARCHIVE_SEGMENT) {
+	    sp = realloc(seg, rlen + LOADFILE_ZERO_PAD);
+	    if (sp)
+		seg = sp;
+	}
+
+	if (initramfs_add_data(ihead, seg, rlen, rlen, align)) {
+	    free(seg);
+	    return -1;
+	}
+	align = 1;		/* Segments must be contiguous */
+    } while (rlen == ARCHIVE_SEGMENT);
+
+    return 0;
+}
+
 int initramfs_load_archive(struct initramfs *ihead, const char *filename)
 {
+    struct stat st;
     void *data;
     size_t len;
+    FILE *f;
+    int rv;
 
-    if (loadfile(filename, &data, &len))
+    f = fopen(filename, "r");
+    if (!f)
 	return -1;
 
-    return initramfs_add_data(ihead, data, len, len, 4);
+    if (!fstat(fileno(f), &st) && !S_ISREG(st.st_mode)) {
+	rv = initramfs_load_segments(ihead, f);
+    } else {
+	rv = floadfile(f, &data, &len, NULL, 0);
+	if (!rv)
+	    rv = initramfs_add_data(ihead, data, len, len, 4);
+    }
+
+    fclose(f);
+    return rv;
 }
@@ -150,123 +150,103 @@ static size_t calc_cmdline_offset(const struct syslinux_memmap *mmap,
     return (0x9ff0 - cmdline_size) & ~15; /* Legacy value: pure hope... */
 }
 
-int bios_boot_linux(void *kernel_buf, size_t kernel_size,
-		    struct initramfs *initramfs,
-		    struct setup_data *setup_data,
-		    char *cmdline)
-{
-    struct linux_header hdr, *whdr;
+/*
+ * Where everything goes.  This is worked out the same way for booting
+ * and for syslinux_initramfs_addr(), so that an initramfs loaded at the
+ * predicted address doesn't have to be moved.
+ */
+struct linux_layout {
+    struct linux_header hdr;	/* Private copy, with the defaults filled in */
     size_t real_mode_size, prot_mode_size;
-    addr_t real_mode_base, prot_mode_base, prot_mode_max, base;
-    addr_t irf_size;
+    addr_t real_mode_base, prot_mode_base;
+    addr_t code32_shift;	/* How far the protected-mode code moved */
     size_t cmdline_size, cmdline_offset;
-    struct setup_data *sdp;
-    struct syslinux_rm_regs regs;
-    struct syslinux_movelist *fraglist = NULL;
-    struct syslinux_memmap *mmap = NULL;
-    struct syslinux_memmap *amap = NULL;
+    addr_t irf_addr;
+    uint16_t bootflags;
+    struct syslinux_memmap *mmap;	/* Memory map for shuffle_boot */
+    struct syslinux_memmap *amap;	/* Keep track of available memory */
+};
+
+static int plan_linux(struct linux_layout *lo, const void *kernel_buf,
+		      size_t kernel_size, const char *cmdline,
+		      addr_t irf_size)
+{
+    struct linux_header *hdr = &lo->hdr;
+    addr_t prot_mode_max, base;
     uint32_t memlimit = 0;
-    uint16_t video_mode = 0;
-    uint16_t bootflags = 0;
     const char *arg;
 
-    cmdline_size = strlen(cmdline) + 1;
+    memset(lo, 0, sizeof *lo);
 
     errno = EINVAL;
     if (kernel_size < 2 * 512) {
 	dprintf("Kernel size too small\n");
-	goto bail;
+	return -1;
     }
 
     /* Look for specific command-line arguments we care about */
     if ((arg = find_argument(cmdline, "mem=")))
 	memlimit = saturate32(suffix_number(arg));
 
-    if ((arg = find_argument(cmdline, "vga="))) {
-	switch (arg[0] | 0x20) {
-	case 'a':		/* "ask" */
-	    video_mode = 0xfffd;
-	    break;
-	case 'e':		/* "ext" */
-	    video_mode = 0xfffe;
-	    break;
-	case 'n':		/* "normal" */
-	    video_mode = 0xffff;
-	    break;
-	case 'c':		/* "current" */
-	    video_mode = 0x0f04;
-	    break;
-	default:
-	    video_mode = strtoul(arg, NULL, 0);
-	    break;
-	}
-    }
-
     if (syslinux_filesystem() == SYSLINUX_FS_PXELINUX &&
 	strstr(cmdline, "keeppxe")) {
 	extern __weak char KeepPXE;
 
 	KeepPXE |= 1;		/* for pxelinux_scan_memory */
-	bootflags = 3;		/* for unload_pxe */
+	lo->bootflags = 3;	/* for unload_pxe */
     }
 
-    /* Copy the header into private storage */
-    /* Use whdr to modify the actual kernel header */
-    memcpy(&hdr, kernel_buf, sizeof hdr);
-    whdr = (struct linux_header *)kernel_buf;
+    memcpy(hdr, kernel_buf, sizeof *hdr);
 
-    if (hdr.boot_flag != BOOT_MAGIC) {
+    if (hdr->boot_flag != BOOT_MAGIC) {
 	dprintf("Invalid boot magic\n");
-	goto bail;
+	return -1;
     }
 
-    if (hdr.header != LINUX_MAGIC) {
-	hdr.version = 0x0100;	/* Very old kernel */
-	hdr.loadflags = 0;
+    if (hdr->header != LINUX_MAGIC) {
+	hdr->version = 0x0100;	/* Very old kernel */
+	hdr->loadflags = 0;
     }
 
-    whdr->vid_mode = video_mode;
+    if (!hdr->setup_sects)
+	hdr->setup_sects = 4;
 
-    if (!hdr.setup_sects)
-	hdr.setup_sects = 4;
+    if (hdr->version < 0x0203 || !hdr->initrd_addr_max)
+	hdr->initrd_addr_max = 0x37ffffff;
 
-    if (hdr.version < 0x0203 || !hdr.initrd_addr_max)
-	hdr.initrd_addr_max = 0x37ffffff;
+    if (!memlimit && memlimit - 1 > hdr->initrd_addr_max)
+	memlimit = hdr->initrd_addr_max + 1;	/* Zero for no limit */
 
-    if (!memlimit && memlimit - 1 > hdr.initrd_addr_max)
-	memlimit = hdr.initrd_addr_max + 1;	/* Zero for no limit */
+    if (hdr->version < 0x0205 || !(hdr->loadflags & LOAD_HIGH))
+	hdr->relocatable_kernel = 0;
 
-    if (hdr.version < 0x0205 || !(hdr.loadflags & LOAD_HIGH))
-	hdr.relocatable_kernel = 0;
+    if (hdr->version < 0x0206)
+	hdr->cmdline_max_len = 256;
 
-    if (hdr.version < 0x0206)
-	hdr.cmdline_max_len = 256;
-
-    if (cmdline_size > hdr.cmdline_max_len) {
-	cmdline_size = hdr.cmdline_max_len;
-	cmdline[cmdline_size - 1] = '\0';
-    }
+    lo->cmdline_size = min(strlen(cmdline) + 1, (size_t)hdr->cmdline_max_len);
 
-    real_mode_size = (hdr.setup_sects + 1) << 9;
-    real_mode_base = (hdr.loadflags & LOAD_HIGH) ? 0x10000 : 0x90000;
-    prot_mode_base = (hdr.loadflags & LOAD_HIGH) ? 0x100000 : 0x10000;
-    prot_mode_max  = (hdr.loadflags & LOAD_HIGH) ? (addr_t)-1 : 0x8ffff;
-    prot_mode_size = kernel_size - real_mode_size;
+    lo->real_mode_size = (hdr->setup_sects + 1) << 9;
+    lo->real_mode_base = (hdr->loadflags & LOAD_HIGH) ? 0x10000 : 0x90000;
+    lo->prot_mode_base = (hdr->loadflags & LOAD_HIGH) ? 0x100000 : 0x10000;
+    prot_mode_max      = (hdr->loadflags & LOAD_HIGH) ? (addr_t)-1 : 0x8ffff;
+    lo->prot_mode_size = kernel_size - lo->real_mode_size;
 
     /* Get the memory map */
-    mmap = syslinux_memory_map();	/* Memory map for shuffle_boot */
-    amap = syslinux_dup_memmap(mmap);	/* Keep track of available memory */
-    if (!mmap || !amap) {
+    lo->mmap = syslinux_memory_map();
+    lo->amap = syslinux_dup_memmap(lo->mmap);
+    if (!lo->mmap || !lo->amap) {
 	errno = ENOMEM;
-	goto bail;
+	return -1;
     }
 
-    cmdline_offset = calc_cmdline_offset(mmap, &hdr, cmdline_size,
-					 real_mode_base,
-					 real_mode_base + real_mode_size);
-    dprintf("cmdline_offset at 0x%zx\n", real_mode_base + cmdline_offset);
+    lo->cmdline_offset = calc_cmdline_offset(lo->mmap, hdr, lo->cmdline_size,
+					     lo->real_mode_base,
+					     lo->real_mode_base +
+					     lo->real_mode_size);
+    dprintf("cmdline_offset at 0x%zx\n",
+	    lo->real_mode_base + lo->cmdline_offset);
 
-    if (hdr.version < 0x020a) {
+    if (hdr->version < 0x020a) {
 	/*
 	 * The 3* here is a total fudge factor... it's supposed to
 	 * account for the fact that the kernel needs to be
@@ -274,41 +254,30 @@ int bios_boot_linux(void *kernel_buf, size_t kernel_size,
 	 * This doesn't, however, account for the fact that the kernel
 	 * is decompressed into a whole other place, either.
 	 */
-	hdr.init_size = 3 * prot_mode_size;
+	hdr->init_size = 3 * lo->prot_mode_size;
     }
 
-    if (!(hdr.loadflags & LOAD_HIGH) && prot_mode_size > 512 * 1024) {
+    if (!(hdr->loadflags & LOAD_HIGH) && lo->prot_mode_size > 512 * 1024) {
 	dprintf("Kernel cannot be loaded low\n");
-	goto bail;
+	return -1;
     }
 
-    /* Get the size of the initramfs, if there is one */
-    irf_size = initramfs_size(initramfs);
-
-    if (irf_size && hdr.version < 0x0200) {
+    if (irf_size && hdr->version < 0x0200) {
 	dprintf("Initrd specified but not supported by kernel\n");
-	goto bail;
-    }
-
-    if (hdr.version >= 0x0200) {
-	whdr->type_of_loader = 0x30;	/* SYSLINUX unknown module */
-	if (hdr.version >= 0x0201) {
-	    whdr->heap_end_ptr = cmdline_offset - 0x0200;
-	    whdr->loadflags |= CAN_USE_HEAP;
-	}
+	return -1;
     }
 
     dprintf("Initial memory map:\n");
-    syslinux_dump_memmap(mmap);
+    syslinux_dump_memmap(lo->mmap);
 
     /* If the user has specified a memory limit, mark that as unavailable.
        Question: should we mark this off-limit in the mmap as well (meaning
        it's unavailable to the boot loader, which probably has already touched
        some of it), or just in the amap? */
     if (memlimit)
-	if (syslinux_add_memmap(&amap, memlimit, -memlimit, SMT_RESERVED)) {
+	if (syslinux_add_memmap(&lo->amap, memlimit, -memlimit, SMT_RESERVED)) {
 	    errno = ENOMEM;
-	    goto bail;
+	    return -1;
 	}
 
     /* Place the kernel in memory */
@@ -320,111 +289,179 @@ int bios_boot_linux(void *kernel_buf, size_t kernel_size,
      * we end up decompressing into a different location anyway), but
      * if it is, make sure everything fits.
      */
-    base = prot_mode_base;
-    if (prot_mode_size &&
-	syslinux_memmap_find(amap, &base,
-			     hdr.relocatable_kernel ?
-			     hdr.init_size : prot_mode_size,
-			     hdr.relocatable_kernel, hdr.kernel_alignment,
-			     prot_mode_base, prot_mode_max,
-			     prot_mode_base, prot_mode_max)) {
+    base = lo->prot_mode_base;
+    if (lo->prot_mode_size &&
+	syslinux_memmap_find(lo->amap, &base,
+			     hdr->relocatable_kernel ?
+			     hdr->init_size : lo->prot_mode_size,
+			     hdr->relocatable_kernel, hdr->kernel_alignment,
+			     lo->prot_mode_base, prot_mode_max,
+			     lo->prot_mode_base, prot_mode_max)) {
 	dprintf("Could not find location for protected-mode code\n");
-	goto bail;
+	return -1;
     }
 
-    whdr->code32_start += base - prot_mode_base;
-    prot_mode_base = base;
+    lo->code32_shift = base - lo->prot_mode_base;
+    lo->prot_mode_base = base;
 
     /* Real mode code */
-    if (syslinux_memmap_find(amap, &real_mode_base,
-			     cmdline_offset + cmdline_size, true, 16,
-			     real_mode_base, 0x90000, 0, 640*1024)) {
+    if (syslinux_memmap_find(lo->amap, &lo->real_mode_base,
+			     lo->cmdline_offset + lo->cmdline_size, true, 16,
+			     lo->real_mode_base, 0x90000, 0, 640*1024)) {
 	dprintf("Could not find location for real-mode code\n");
-	goto bail;
+	return -1;
     }
 
-    if (syslinux_add_movelist(&fraglist, real_mode_base, (addr_t) kernel_buf,
-			      real_mode_size))
-	goto bail;
-    if (syslinux_add_memmap
-	(&amap, real_mode_base, cmdline_offset + cmdline_size, SMT_ALLOC)) {
+    if (syslinux_add_memmap(&lo->amap, lo->real_mode_base,
+			    lo->cmdline_offset + lo->cmdline_size,
+			    SMT_ALLOC)) {
 	errno = ENOMEM;
+	return -1;
+    }
+
+    if (lo->prot_mode_size &&
+	syslinux_add_memmap(&lo->amap, lo->prot_mode_base,
+			    lo->prot_mode_size, SMT_ALLOC)) {
+	errno = ENOMEM;
+	return -1;
+    }
+
+    /* Figure out where to put the initramfs.  We should put it at
+       the highest possible address which is <= hdr.initrd_addr_max,
+       which fits the entire initramfs. */
+
+    if (irf_size) {
+	struct syslinux_memmap *ml;
+	const addr_t align_mask = INITRAMFS_MAX_ALIGN - 1;
+
+	for (ml = lo->amap; ml->type != SMT_END; ml = ml->next) {
+	    addr_t adj_start = (ml->start + align_mask) & ~align_mask;
+	    addr_t adj_end = ml->next->start & ~align_mask;
+	    if (ml->type == SMT_FREE && adj_end - adj_start >= irf_size)
+		lo->irf_addr = (adj_end - irf_size) & ~align_mask;
+	}
+
+	if (!lo->irf_addr) {
+	    dprintf("Insufficient memory for initramfs\n");
+	    return -1;
+	}
+
+	if (syslinux_add_memmap(&lo->amap, lo->irf_addr, irf_size,
+				SMT_ALLOC)) {
+	    errno = ENOMEM;
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+int bios_boot_linux(void *kernel_buf, size_t kernel_size,
+		    struct initramfs *initramfs,
+		    struct setup_data *setup_data,
+		    char *cmdline)
+{
+    struct linux_layout lo;
+    struct linux_header *whdr;
+    addr_t irf_size;
+    struct setup_data *sdp;
+    struct syslinux_rm_regs regs;
+    struct syslinux_movelist *fraglist = NULL;
+    uint16_t video_mode = 0;
+    const char *arg;
+
+    /* Get the size of the initramfs, if there is one */
+    irf_size = initramfs_size(initramfs);
+
+    if (plan_linux(&lo, kernel_buf, kernel_size, cmdline, irf_size))
 	goto bail;
+
+    if ((arg = find_argument(cmdline, "vga="))) {
+	switch (arg[0] | 0x20) {
+	case 'a':		/* "ask" */
+	    video_mode = 0xfffd;
+	    break;
+	case 'e':		/* "ext" */
+	    video_mode = 0xfffe;
+	    break;
+	case 'n':		/* "normal" */
+	    video_mode = 0xffff;
+	    break;
+	case 'c':		/* "current" */
+	    video_mode = 0x0f04;
+	    break;
+	default:
+	    video_mode = strtoul(arg, NULL, 0);
+	    break;
+	}
     }
 
+    /* Truncate the command line to what the kernel accepts */
+    cmdline[lo.cmdline_size - 1] = '\0';
+
+    /* Use whdr to modify the actual kernel header */
+    whdr = (struct linux_header *)kernel_buf;
+
+    whdr->vid_mode = video_mode;
+
+    if (lo.hdr.version >= 0x0200) {
+	whdr->type_of_loader = 0x30;	/* SYSLINUX unknown module */
+	if (lo.hdr.version >= 0x0201) {
+	    whdr->heap_end_ptr = lo.cmdline_offset - 0x0200;
+	    whdr->loadflags |= CAN_USE_HEAP;
+	}
+    }
+
+    whdr->code32_start += lo.code32_shift;
+
+    /* Real mode code */
+    if (syslinux_add_movelist(&fraglist, lo.real_mode_base,
+			      (addr_t) kernel_buf, lo.real_mode_size))
+	goto bail;
+
     /* Zero region between real mode code and cmdline */
-    if (syslinux_add_memmap(&mmap, real_mode_base + real_mode_size,
-			    cmdline_offset - real_mode_size, SMT_ZERO)) {
+    if (syslinux_add_memmap(&lo.mmap, lo.real_mode_base + lo.real_mode_size,
+			    lo.cmdline_offset - lo.real_mode_size, SMT_ZERO)) {
 	errno = ENOMEM;
 	goto bail;
     }
 
     /* Command line */
-    if (syslinux_add_movelist(&fraglist, real_mode_base + cmdline_offset,
-			      (addr_t) cmdline, cmdline_size)) {
+    if (syslinux_add_movelist(&fraglist, lo.real_mode_base + lo.cmdline_offset,
+			      (addr_t) cmdline, lo.cmdline_size)) {
 	errno = ENOMEM;
 	goto bail;
     }
-    if (hdr.version >= 0x0202) {
-	whdr->cmd_line_ptr = real_mode_base + cmdline_offset;
+    if (lo.hdr.version >= 0x0202) {
+	whdr->cmd_line_ptr = lo.real_mode_base + lo.cmdline_offset;
     } else {
 	whdr->old_cmd_line_magic = OLD_CMDLINE_MAGIC;
-	whdr->old_cmd_line_offset = cmdline_offset;
-	if (hdr.version >= 0x0200) {
+	whdr->old_cmd_line_offset = lo.cmdline_offset;
+	if (lo.hdr.version >= 0x0200) {
 	    /* Be paranoid and round up to a multiple of 16 */
-	    whdr->setup_move_size = (cmdline_offset + cmdline_size + 15) & ~15;
+	    whdr->setup_move_size =
+		(lo.cmdline_offset + lo.cmdline_size + 15) & ~15;
 	}
     }
 
     /* Protected-mode code */
-    if (prot_mode_size) {
-	if (syslinux_add_movelist(&fraglist, prot_mode_base,
-				  (addr_t) kernel_buf + real_mode_size,
-				  prot_mode_size)) {
-	    errno = ENOMEM;
-	    goto bail;
-	}
-	if (syslinux_add_memmap(&amap, prot_mode_base, prot_mode_size,
-				SMT_ALLOC)) {
+    if (lo.prot_mode_size) {
+	if (syslinux_add_movelist(&fraglist, lo.prot_mode_base,
+				  (addr_t) kernel_buf + lo.real_mode_size,
+				  lo.prot_mode_size)) {
 	    errno = ENOMEM;
 	    goto bail;
 	}
     }
 
-    /* Figure out the size of the initramfs, and where to put it.
-       We should put it at the highest possible address which is
-       <= hdr.initrd_addr_max, which fits the entire initramfs. */
-
+    /* The initramfs; any chunk already loaded in place is left alone */
     if (irf_size) {
-	addr_t best_addr = 0;
-	struct syslinux_memmap *ml;
-	const addr_t align_mask = INITRAMFS_MAX_ALIGN - 1;
-
-	if (irf_size) {
-	    for (ml = amap; ml->type != SMT_END; ml = ml->next) {
-		addr_t adj_start = (ml->start + align_mask) & ~align_mask;
-		addr_t adj_end = ml->next->start & ~align_mask;
-		if (ml->type == SMT_FREE && adj_end - adj_start >= irf_size)
-		    best_addr = (adj_end - irf_size) & ~align_mask;
-	    }
+	whdr->ramdisk_image = lo.irf_addr;
+	whdr->ramdisk_size = irf_size;
 
-	    if (!best_addr) {
-		dprintf("Insufficient memory for initramfs\n");
-		goto bail;
-	    }
-
-	    whdr->ramdisk_image = best_addr;
-	    whdr->ramdisk_size = irf_size;
-
-	    if (syslinux_add_memmap(&amap, best_addr, irf_size, SMT_ALLOC)) {
-		errno = ENOMEM;
-		goto bail;
-	    }
-
-	    if (map_initramfs(&fraglist, &mmap, initramfs, best_addr)) {
-		errno = ENOMEM;
-		goto bail;
-	    }
+	if (map_initramfs(&fraglist, &lo.mmap, initramfs, lo.irf_addr)) {
+	    errno = ENOMEM;
+	    goto bail;
 	}
     }
 
@@ -440,13 +477,13 @@ int bios_boot_linux(void *kernel_buf, size_t kernel_size,
 	    if (!sdp->data || !sdp->hdr.len)
 		continue;
 
-	    if (hdr.version < 0x0209) {
+	    if (lo.hdr.version < 0x0209) {
 		/* Setup data not supported */
 		errno = ENXIO;	/* Kind of arbitrary... */
 		goto bail;
 	    }
 
-	    for (ml = amap; ml->type != SMT_END; ml = ml->next) {
+	    for (ml = lo.amap; ml->type != SMT_END; ml = ml->next) {
 		addr_t adj_start = (ml->start + align_mask) & ~align_mask;
 		addr_t adj_end = ml->next->start & ~align_mask;
 
@@ -460,7 +497,7 @@ int bios_boot_linux(void *kernel_buf, size_t kernel_size,
 	    *prev_ptr = best_addr;
 	    prev_ptr = &sdp->hdr.next;
 
-	    if (syslinux_add_memmap(&amap, best_addr, size, SMT_ALLOC)) {
+	    if (syslinux_add_memmap(&lo.amap, best_addr, size, SMT_ALLOC)) {
 		errno = ENOMEM;
 		goto bail;
 	    }
@@ -479,17 +516,17 @@ int bios_boot_linux(void *kernel_buf, size_t kernel_size,
 
     /* Set up the registers on entry */
     memset(&regs, 0, sizeof regs);
-    regs.es = regs.ds = regs.ss = regs.fs = regs.gs = real_mode_base >> 4;
-    regs.cs = (real_mode_base >> 4) + 0x20;
+    regs.es = regs.ds = regs.ss = regs.fs = regs.gs = lo.real_mode_base >> 4;
+    regs.cs = (lo.real_mode_base >> 4) + 0x20;
     /* regs.ip = 0; */
     /* Linux is OK with sp = 0 = 64K, but perhaps other things aren't... */
-    regs.esp.w[0] = min(cmdline_offset, (size_t) 0xfff0);
+    regs.esp.w[0] = min(lo.cmdline_offset, (size_t) 0xfff0);
 
     dprintf("Final memory map:\n");
-    syslinux_dump_memmap(mmap);
+    syslinux_dump_memmap(lo.mmap);
 
     dprintf("Final available map:\n");
-    syslinux_dump_memmap(amap);
+    syslinux_dump_memmap(lo.amap);
 
     dprintf("Initial movelist:\n");
     syslinux_dump_movelist(fraglist);
@@ -505,16 +542,39 @@ int bios_boot_linux(void *kernel_buf, size_t kernel_size,
 	dprintf("*** vga=current, not calling syslinux_force_text_mode()...\n");
     }
 
-    syslinux_shuffle_boot_rm(fraglist, mmap, bootflags, &regs);
+    syslinux_shuffle_boot_rm(fraglist, lo.mmap, lo.bootflags, &regs);
     dprintf("shuffle_boot_rm failed\n");
 
 bail:
     syslinux_free_movelist(fraglist);
-    syslinux_free_memmap(mmap);
-    syslinux_free_memmap(amap);
+    syslinux_free_memmap(lo.mmap);
+    syslinux_free_memmap(lo.amap);
     return -1;
 }
 
+/*
+ * Work out where syslinux_boot_linux() is going to put an initramfs of
+ * IRF_SIZE bytes for this kernel and command line, so that the caller
+ * can load it there directly.  Returns 0 if that isn't known ahead of
+ * time, e.g. because the firmware places the initramfs itself.
+ */
+addr_t syslinux_initramfs_addr(const void *kernel_buf, size_t kernel_size,
+			       const char *cmdline, addr_t irf_size)
+{
+    struct linux_layout lo;
+    addr_t addr = 0;
+
+    if (firmware->boot_linux || !irf_size)
+	return 0;
+
+    if (!plan_linux(&lo, kernel_buf, kernel_size, cmdline, irf_size))
+	addr = lo.irf_addr;
+
+    syslinux_free_memmap(lo.mmap);
+    syslinux_free_memmap(lo.amap);
+    return addr;
+}
+
 int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
 			struct initramfs *initramfs,
 			struct setup_data *setup_data,
@@ -42,6 +42,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include <setjmp.h>
 #include <minmax.h>
@@ -82,13 +83,176 @@ static struct syslinux_movelist *dup_movelist(struct syslinux_movelist *src)
     return dst;
 }
 
+/*
+ * The working memory map is a sorted array of zone start addresses
+ * rather than a syslinux_memmap list, so that finding the zone holding
+ * an address is a binary search.  It follows the same conventions:
+ * zone 0 starts at address 0, no two adjacent zones have the same
+ * type, and the last entry is an SMT_END token with start 0 (i.e. the
+ * top of the address space.)
+ */
+struct zone {
+    addr_t start;
+    enum syslinux_memmap_types type;
+};
+
+struct zonemap {
+    struct zone *z;
+    size_t nzones;		/* Including the SMT_END token */
+    size_t size;		/* Entries allocated */
+};
+
+/* Last byte of zone i */
+static inline addr_t zone_last(const struct zonemap *zm, size_t i)
+{
+    return zm->z[i + 1].start - 1;
+}
+
+static inline addr_t zone_len(const struct zonemap *zm, size_t i)
+{
+    return zm->z[i + 1].start - zm->z[i].start;
+}
+
+static void init_zonemap(struct zonemap *zm)
+{
+    zm->size = 16;
+    zm->z = malloc(zm->size * sizeof(struct zone));
+    if (!zm->z)
+	longjmp(new_movelist_bail, 1);
+
+    zm->z[0].start = 0;
+    zm->z[0].type = SMT_UNDEFINED;
+    zm->z[1].start = 0;		/* Wrap around... */
+    zm->z[1].type = SMT_END;
+    zm->nzones = 2;
+}
+
+/*
+ * Find the zone containing addr
+ */
+static size_t find_zone(const struct zonemap *zm, addr_t addr)
+{
+    size_t lo = 0, hi = zm->nzones - 2;
+
+    while (lo < hi) {
+	size_t mid = (lo + hi + 1) >> 1;
+
+	if (zm->z[mid].start <= addr)
+	    lo = mid;
+	else
+	    hi = mid - 1;
+    }
+
+    return lo;
+}
+
+/*
+ * Replace zones [i, j) with the n zones in new[], then merge any
+ * neighbours left with the same type.
+ */
+static void replace_zones(struct zonemap *zm, size_t i, size_t j,
+			  const struct zone *new, size_t n)
+{
+    size_t nzones = zm->nzones - (j - i) + n;
+    size_t k, lo, hi;
+
+    if (nzones > zm->size) {
+	struct zone *z = realloc(zm->z, 2 * nzones * sizeof(struct zone));
+
+	if (!z)
+	    longjmp(new_movelist_bail, 1);
+	zm->z = z;
+	zm->size = 2 * nzones;
+    }
+
+    memmove(&zm->z[i + n], &zm->z[j], (zm->nzones - j) * sizeof(struct zone));
+    memcpy(&zm->z[i], new, n * sizeof(struct zone));
+    zm->nzones = nzones;
+
+    lo = i ? i : 1;
+    hi = min(i + n + 1, zm->nzones);
+    for (k = lo; k < hi; ) {
+	if (zm->z[k].type == zm->z[k - 1].type) {
+	    memmove(&zm->z[k], &zm->z[k + 1],
+		    (zm->nzones - k - 1) * sizeof(struct zone));
+	    zm->nzones--;
+	    hi--;
+	} else {
+	    k++;
+	}
+    }
+}
+
+/*
+ * Set the type of a range; the equivalent of syslinux_add_memmap().
+ */
 static void
-add_freelist(struct syslinux_memmap **mmap, addr_t start,
+add_freelist(struct zonemap *zm, addr_t start,
 	     addr_t len, enum syslinux_memmap_types type)
 {
-    if (syslinux_add_memmap(mmap, start, len, type))
-	longjmp(new_movelist_bail, 1);
+    struct zone new[3];
+    size_t i, j, n = 0;
+    addr_t last;
+
+    if (len == 0)
+	return;
+
+    last = start + len - 1;
+    i = find_zone(zm, start);
+    j = find_zone(zm, last);
+
+    if (zm->z[i].start < start)
+	new[n++] = zm->z[i];
+    new[n].start = start;
+    new[n++].type = type;
+    if (last != zone_last(zm, j)) {
+	new[n].start = last + 1;
+	new[n++].type = zm->z[j].type;
+    }
+
+    replace_zones(zm, i, j + 1, new, n);
+}
+
+/*
+ * Find the largest zone of a specific type.  Returns -1 on failure.
+ */
+static int largest_zone(const struct zonemap *zm,
+			enum syslinux_memmap_types type,
+			addr_t * start, addr_t * len)
+{
+    addr_t size, best_size = 0;
+    size_t i, best = 0;
+
+    for (i = 0; i < zm->nzones - 1; i++) {
+	size = zone_len(zm, i);
+
+	if (zm->z[i].type == type && size > best_size) {
+	    best = i;
+	    best_size = size;
+	}
+    }
+
+    if (!best_size)
+	return -1;
+
+    *start = zm->z[best].start;
+    *len = best_size;
+
+    return 0;
+}
+
+#ifdef DEBUG
+static void dump_zonemap(const struct zonemap *zm)
+{
+    size_t i;
+
+    for (i = 0; i < zm->nzones - 1; i++)
+	dprintf("%08x %08x %d\n", zm->z[i].start, zone_len(zm, i),
+		zm->z[i].type);
 }
+#else
+#define dump_zonemap(x) ((void)0)
+#endif
 
 /*
  * Take a chunk, entirely confined in **parentptr, and split it off so that
@@ -143,76 +307,69 @@ static void free_movelist(struct syslinux_movelist **parentptr)
 }
 
 /*
- * Scan the freelist looking for a particular chunk of memory.  Returns
- * the memmap chunk containing to the first byte of the region.
+ * Look up a particular chunk of memory in the freelist.  Returns the
+ * first zone of the run of usable zones holding the region, or NULL.
  */
-static const struct syslinux_memmap *is_free_zone(const struct syslinux_memmap
-						  *list, addr_t start,
-						  addr_t len)
+static const struct zone *is_free_zone(const struct zonemap *zm,
+				       addr_t start, addr_t len)
 {
-    addr_t last, llast;
+    addr_t last;
+    size_t i, j;
 
     dprintf("f: 0x%08x bytes at 0x%08x\n", len, start);
 
     last = start + len - 1;
 
-    while (list->type != SMT_END) {
-	if (list->start <= start) {
-	    const struct syslinux_memmap *ilist = list;
-	    while (valid_terminal_type(list->type)) {
-		llast = list->next->start - 1;
-		if (llast >= last)
-		    return ilist;
-		list = list->next;
-	    }
+    i = find_zone(zm, start);
+    if (!valid_terminal_type(zm->z[i].type))
+	return NULL;
 
-	    if (list->start > start)
-		return NULL;	/* Invalid type in region */
-	}
-	list = list->next;
+    while (i > 0 && valid_terminal_type(zm->z[i - 1].type))
+	i--;
+
+    for (j = i; valid_terminal_type(zm->z[j].type); j++) {
+	if (zone_last(zm, j) >= last)
+	    return &zm->z[i];
     }
 
-    return NULL;		/* Internal error? */
+    return NULL;		/* Invalid type in region */
 }
 
 /*
  * Scan the freelist looking for the smallest chunk of memory which
  * can fit X bytes; returns the length of the block on success.
  */
-static addr_t free_area(const struct syslinux_memmap *mmap,
+static addr_t free_area(const struct zonemap *zm,
 			addr_t len, addr_t * start)
 {
-    const struct syslinux_memmap *best = NULL;
-    const struct syslinux_memmap *s;
-    addr_t slen, best_len = -1;
+    addr_t slen, best_len = 0;
+    size_t i, best = 0;
 
-    for (s = mmap; s->type != SMT_END; s = s->next) {
-	if (s->type != SMT_FREE)
+    for (i = 0; i < zm->nzones - 1; i++) {
+	if (zm->z[i].type != SMT_FREE)
 	    continue;
-	slen = s->next->start - s->start;
+	slen = zone_len(zm, i);
 	if (slen >= len) {
-	    if (!best || best_len > slen) {
-		best = s;
+	    if (!best_len || best_len > slen) {
+		best = i;
 		best_len = slen;
 	    }
 	}
     }
 
-    if (best) {
-	*start = best->start;
-	return best_len;
-    } else {
-	return 0;
-    }
+    if (best_len)
+	*start = zm->z[best].start;
+
+    return best_len;
 }
 
 /*
  * Remove a chunk from the freelist
  */
 static void
-allocate_from(struct syslinux_memmap **mmap, addr_t start, addr_t len)
+allocate_from(struct zonemap *mmap, addr_t start, addr_t len)
 {
-    syslinux_add_memmap(mmap, start, len, SMT_ALLOC);
+    add_freelist(mmap, start, len, SMT_ALLOC);
 }
 
 /*
@@ -310,7 +467,7 @@ restart:
  */
 static void
 move_chunk(struct syslinux_movelist ***moves,
-	   struct syslinux_memmap **mmap,
+	   struct zonemap *mmap,
 	   struct syslinux_movelist **fp, addr_t copylen)
 {
     addr_t copydst, copysrc;
@@ -384,8 +541,9 @@ syslinux_compute_movelist(struct syslinux_movelist **moves,
 			  struct syslinux_movelist *ifrags,
 			  struct syslinux_memmap *memmap)
 {
-    struct syslinux_memmap *mmap = NULL;
-    const struct syslinux_memmap *mm, *ep;
+    struct zonemap mmap = { NULL, 0, 0 };
+    const struct syslinux_memmap *mm;
+    const struct zone *ep;
     struct syslinux_movelist *frags = NULL;
     struct syslinux_movelist *postcopy = NULL;
     struct syslinux_movelist *mv;
@@ -402,7 +560,6 @@ syslinux_compute_movelist(struct syslinux_movelist **moves,
     dprintf("entering syslinux_compute_movelist()...\n");
 
     if (setjmp(new_movelist_bail)) {
-nomem:
 	dprintf("Out of working memory!\n");
 	goto bail;
     }
@@ -411,9 +568,7 @@ nomem:
 
     /* Create our memory map.  Anything that is SMT_FREE or SMT_ZERO is
        fair game, but mark anything used by source material as SMT_ALLOC. */
-    mmap = syslinux_init_memmap();
-    if (!mmap)
-	goto nomem;
+    init_zonemap(&mmap);
 
     frags = dup_movelist(ifrags);
 
@@ -431,7 +586,7 @@ nomem:
     while ((fp = &frags, f = *fp)) {
 
 	dprintf("Current free list:\n");
-	syslinux_dump_memmap(mmap);
+	dump_zonemap(&mmap);
 	dprintf("Current frag list:\n");
 	syslinux_dump_movelist(frags);
 
@@ -470,7 +625,7 @@ nomem:
 		cbyte = o->dst;	/* "Critical byte" */
 	    }
 
-	    if (is_free_zone(mmap, needbase, needlen)) {
+	    if (is_free_zone(&mmap, needbase, needlen)) {
 		fp = op, f = o;
 		dprintf("!: 0x%08x bytes at 0x%08x -> 0x%08x\n",
 			f->len, f->src, f->dst);
@@ -513,9 +668,9 @@ nomem:
 		"reverse = %d, cbyte = 0x%08x\n",
 		needbase, needlen, reverse, cbyte);
 
-	ep = is_free_zone(mmap, cbyte, 1);
+	ep = is_free_zone(&mmap, cbyte, 1);
 	if (ep) {
-	    ep_len = ep->next->start - ep->start;
+	    ep_len = ep[1].start - ep->start;
 	    if (reverse)
 		avail = needbase + needlen - ep->start;
 	    else
@@ -553,19 +708,19 @@ nomem:
 
 	    /* Find somewhere to put it... */
 
-	    if (is_free_zone(mmap, o->dst, o->len)) {
+	    if (is_free_zone(&mmap, o->dst, o->len)) {
 		/* Score!  We can move it into place directly... */
 		copydst = o->dst;
 		copysrc = o->src;
 		copylen = o->len;
-	    } else if (free_area(mmap, o->len, &fstart)) {
+	    } else if (free_area(&mmap, o->len, &fstart)) {
 		/* We can move the whole chunk */
 		copydst = fstart;
 		copysrc = o->src;
 		copylen = o->len;
 	    } else {
 		/* Well, copy as much as we can... */
-		if (syslinux_memmap_largest(mmap, SMT_FREE, &fstart, &flen)) {
+		if (largest_zone(&mmap, SMT_FREE, &fstart, &flen)) {
 		    dprintf("No free memory at all!\n");
 		    goto bail;	/* Stuck! */
 		}
@@ -624,8 +779,7 @@ move_chunk:
 
     rv = 0;
 bail:
-    if (mmap)
-	syslinux_free_memmap(mmap);
+    free(mmap.z);
     if (frags)
 	free_movelist(&frags);
     if (postcopy)
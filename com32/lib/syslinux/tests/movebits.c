@@ -1,6 +1,7 @@
 #include "unittest/unittest.h"
 #include "unittest/memmap.h"
 #include <setjmp.h>
+#include </usr/include/string.h>
 
 #include "../../../include/minmax.h"
 #include "../zonelist.c"
@@ -77,10 +78,142 @@ bail:
     return rv;
 }
 
+/*
+ * The shuffler's working memory map must always agree with a
+ * syslinux_memmap built by the same sequence of updates.
+ */
+static int zonemap_matches_memmap(void)
+{
+    struct syslinux_memmap *mmap, *mp;
+    struct zonemap zm;
+    size_t i;
+    int n, bad = 0;
+
+    mmap = syslinux_init_memmap();
+    if (!mmap || setjmp(new_movelist_bail))
+	return -1;
+
+    init_zonemap(&zm);
+
+    for (n = 0; n < 5000; n++) {
+	addr_t start = rnd() % 0x10000;
+	addr_t len = rnd() % 0x800;
+	enum syslinux_memmap_types type = rnd() % (SMT_TERMINAL + 1);
+
+	if (n % 100 == 0) {
+	    start = (addr_t)-1 - rnd() % 0x1000;
+	    len = (addr_t)-1 - start + 1;
+	}
+
+	syslinux_add_memmap(&mmap, start, len, type);
+	add_freelist(&zm, start, len, type);
+
+	for (mp = mmap, i = 0; mp; mp = mp->next, i++) {
+	    if (i >= zm.nzones || mp->start != zm.z[i].start ||
+		mp->type != zm.z[i].type)
+		break;
+	}
+	if (mp || i != zm.nzones)
+	    bad++;
+    }
+
+    syslinux_assert_str(!bad, "%d updates left the zone maps differing", bad);
+
+    free(zm.z);
+    syslinux_free_memmap(mmap);
+    return 0;
+}
+
+/*
+ * Shuffle nfrags scattered fragments into one contiguous image, as
+ * for a scatter-loaded initramfs, and check the result by running the
+ * moves on a copy of "memory".
+ */
+#define SIM_SIZE	0x800000
+
+static int shuffle_many_fragments(int nfrags)
+{
+    struct syslinux_memmap *mmap;
+    struct syslinux_movelist *frags = NULL, *moves = NULL, *mv;
+    unsigned char *mem, *want;
+    addr_t *slot, src, dst;
+    addr_t len = 0x800;
+    double t;
+    int i, j, rv = -1;
+
+    rnd_state = nfrags;
+    mem = malloc(SIM_SIZE);
+    want = malloc(SIM_SIZE);
+    slot = malloc(nfrags * 2 * sizeof *slot);
+    mmap = syslinux_init_memmap();
+    if (!mem || !want || !slot || !mmap)
+	goto bail;
+
+    if (syslinux_add_memmap(&mmap, 0x10000, SIM_SIZE - 0x10000, SMT_FREE))
+	goto bail;
+
+    /* Sources are every other slot of the image area, in random order */
+    for (i = 0; i < nfrags * 2; i++)
+	slot[i] = 0x10000 + i * len;
+    for (i = nfrags * 2 - 1; i > 0; i--) {
+	j = rnd() % (i + 1);
+	src = slot[i];
+	slot[i] = slot[j];
+	slot[j] = src;
+    }
+
+    for (i = 0; i < SIM_SIZE; i++)
+	mem[i] = rnd();
+    memset(want, 0, SIM_SIZE);
+
+    dst = 0x10000;
+    for (i = 0; i < nfrags; i++) {
+	if (syslinux_add_movelist(&frags, dst, slot[i], len))
+	    goto bail;
+	memcpy(want + dst, mem + slot[i], len);
+	dst += len;
+    }
+
+    t = now();
+    rv = syslinux_compute_movelist(&moves, frags, mmap);
+    t = now() - t;
+    syslinux_assert_str(!rv, "Failed to shuffle %d fragments", nfrags);
+    if (rv)
+	goto bail;
+
+    for (i = 0, mv = moves; mv; mv = mv->next, i++) {
+	syslinux_assert_str(mv->dst >= 0x10000 && mv->src >= 0x10000 &&
+			    mv->dst + mv->len <= SIM_SIZE &&
+			    mv->src + mv->len <= SIM_SIZE,
+			    "Move outside free memory");
+	memmove(mem + mv->dst, mem + mv->src, mv->len);
+    }
+
+    dst = 0x10000;
+    syslinux_assert_str(!memcmp(mem + dst, want + dst, nfrags * len),
+			"Shuffled image differs");
+
+    printf("\t%5d fragments: %4d moves, %8.2f ms\n", nfrags, i, t * 1e3);
+
+bail:
+    syslinux_free_movelist(frags);
+    syslinux_free_movelist(moves);
+    syslinux_free_memmap(mmap);
+    free(slot);
+    free(want);
+    free(mem);
+    return rv;
+}
+
 int main(int argc, char **argv)
 {
     move_to_terminal_region();
     move_to_overlapping_region();
 
+    zonemap_matches_memmap();
+    shuffle_many_fragments(100);
+    shuffle_many_fragments(500);
+    shuffle_many_fragments(2000);
+
     return 0;
 }
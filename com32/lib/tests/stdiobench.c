@@ -0,0 +1,218 @@
+#include "unittest/unittest.h"
+#include </usr/include/string.h>
+#include </usr/include/errno.h>
+#include </usr/include/fcntl.h>
+#include </usr/include/unistd.h>
+
+typedef FILE host_FILE;
+
+/*
+ * Run libcom32's stdio input functions over host file descriptors.  A
+ * com32 FILE * is the file descriptor plus one; the functions are
+ * renamed so that they don't replace the host's own.
+ */
+#undef fileno
+#undef getc
+#undef BUFSIZ
+#define BUFSIZ		4096
+#define FILE		cfile
+#define fileno(f)	((int)(size_t)(f) - 1)
+#define fgetc		com32_fgetc
+#define fgets		com32_fgets
+#define getdelim	com32_getdelim
+#define _fread		com32_fread
+
+typedef struct cfile cfile;
+
+size_t _fread(void *, size_t, FILE *);
+
+/* The getc() inline and the buffers, as <stdio.h> has them */
+#include "../../include/sys/stdiobuf.h"
+
+/*
+ * Just enough of sys/file.h for sys/stdiobuf.c to tell files from
+ * consoles; read() is the host's.
+ */
+#define _COM32_SYS_FILE_H
+#define NFILES		128
+#define __DEV_TTY	0x0001
+#define __DEV_FILE	0x0002
+
+struct input_dev {
+    uint16_t flags;
+};
+
+struct file_info {
+    const struct input_dev *iop;
+};
+
+static struct file_info __file_info[NFILES];
+static const struct input_dev file_dev = { __DEV_FILE };
+static const struct input_dev console_dev = { __DEV_TTY };
+static int unbuffered;		/* Open files as consoles */
+
+#include "../sys/stdiobuf.c"
+#include "../fread.c"
+#include "../fgetc.c"
+#include "../fgets.c"
+#include "../getdelim.c"
+
+static FILE *cfopen(const char *name)
+{
+    int fd = open(name, O_RDONLY);
+
+    memset(&__stdio_bufs[fd], 0, sizeof __stdio_bufs[fd]);
+    __file_info[fd].iop = unbuffered ? &console_dev : &file_dev;
+    return (FILE *)(size_t)(fd + 1);
+}
+
+static void cfclose(FILE * f)
+{
+    free(__stdio_bufs[fileno(f)].base);
+    __file_info[fileno(f)].iop = NULL;
+    close(fileno(f));
+}
+
+static char test_file[] = "/tmp/stdiobenchXXXXXX";
+static size_t test_bytes, test_lines;
+
+/*
+ * Something shaped like pci.ids: lots of short, indented lines.
+ */
+static void make_test_file(void)
+{
+    host_FILE *hf;
+    int i;
+
+    hf = fdopen(mkstemp(test_file), "w");
+
+    for (i = 0; i < 200000; i++) {
+	test_bytes += fprintf(hf,
+			      "%s%04x  Device %d of vendor %d\n",
+			      i % 8 ? "\t" : "", i & 0xffff, i, i / 8);
+	test_lines++;
+    }
+    /* And a last line without a newline */
+    test_bytes += fprintf(hf, "ffff  Illegal Vendor ID");
+    test_lines++;
+
+    fclose(hf);
+}
+
+static size_t count_fgets(size_t bufsize, size_t *lines)
+{
+    FILE *f = cfopen(test_file);
+    char buf[bufsize];
+    size_t bytes = 0;
+
+    *lines = 0;
+    while (fgets(buf, bufsize, f)) {
+	bytes += strlen(buf);
+	if (buf[strlen(buf) - 1] == '\n')
+	    (*lines)++;
+    }
+
+    cfclose(f);
+    return bytes;
+}
+
+static size_t count_getline(size_t *lines)
+{
+    FILE *f = cfopen(test_file);
+    char *line = NULL;
+    size_t n = 0, bytes = 0;
+    ssize_t len;
+
+    *lines = 0;
+    while ((len = getdelim(&line, &n, '\n', f)) > 0) {
+	if (len != strlen(line))
+	    return 0;
+	bytes += len;
+	(*lines)++;
+    }
+
+    free(line);
+    cfclose(f);
+    return bytes;
+}
+
+/*
+ * Whole lines, lines cut short by a small buffer, and getline() all
+ * see exactly the bytes of the file.
+ */
+static int test_lines_read(void)
+{
+    size_t bytes, lines;
+
+    bytes = count_fgets(256, &lines);
+    syslinux_assert_str(bytes == test_bytes && lines == test_lines - 1,
+			"fgets() read %zu bytes, %zu lines", bytes, lines);
+
+    bytes = count_fgets(7, &lines);
+    syslinux_assert_str(bytes == test_bytes && lines == test_lines - 1,
+			"Short fgets() read %zu bytes, %zu lines", bytes, lines);
+
+    bytes = count_getline(&lines);
+    syslinux_assert_str(bytes == test_bytes && lines == test_lines,
+			"getline() read %zu bytes, %zu lines", bytes, lines);
+
+    unbuffered = 1;
+    bytes = count_getline(&lines);
+    unbuffered = 0;
+    syslinux_assert_str(bytes == test_bytes && lines == test_lines,
+			"Unbuffered getline() read %zu bytes, %zu lines",
+			bytes, lines);
+
+    return 0;
+}
+
+/*
+ * fread() after getc() continues where getc() stopped.
+ */
+static int test_mixed(void)
+{
+    FILE *f = cfopen(test_file);
+    char want[64], got[64];
+    int fd;
+
+    fd = open(test_file, O_RDONLY);
+    read(fd, want, sizeof want);
+    close(fd);
+
+    got[0] = __getc(f);
+    com32_fread(got + 1, sizeof got - 1, f);
+    syslinux_assert_str(!memcmp(want, got, sizeof got),
+			"fread() lost data read ahead by getc()");
+
+    cfclose(f);
+    return 0;
+}
+
+static void bench(const char *name, int unbuf)
+{
+    size_t bytes, lines;
+    double t;
+
+    unbuffered = unbuf;
+    t = now();
+    bytes = count_fgets(256, &lines);
+    t = now() - t;
+    unbuffered = 0;
+
+    printf("\t%-12s %6.1f ms for %zu KB, %zu lines\n", name, t * 1e3,
+	   bytes >> 10, lines);
+}
+
+int main(int argc, char **argv)
+{
+    make_test_file();
+
+    test_lines_read();
+    test_mixed();
+
+    bench("unbuffered", 1);
+    bench("buffered", 0);
+
+    unlink(test_file);
+    return 0;
+}
@@ -18,6 +18,7 @@
 #include <ctype.h>
 #include <minmax.h>
 #include <alloca.h>
+#include <arena.h>
 #include <inttypes.h>
 #include <colortbl.h>
 #include <com32.h>
@@ -48,6 +49,18 @@ static bool menusave = false;	/* True if there is any "menu save" */
 static struct menu_entry *all_entries;
 static struct menu_entry **all_entries_end = &all_entries;
 
+/*
+ * Menus, entries and the strings hanging off them all live as long as
+ * the configuration, so they are allocated from one arena.
+ */
+static struct arena config_arena = ARENA_INIT(0);
+
+/* The configuration goes away with the module */
+static void __destructor config_exit(void)
+{
+    arena_free_all(&config_arena);
+}
+
 static const struct messages messages[MSG_COUNT] = {
     [MSG_AUTOBOOT] = {"autoboot", "Automatic boot in # second{,s}..."},
     [MSG_TAB] = {"tabmsg", "Press [Tab] to edit options"},
@@ -161,7 +174,7 @@ static char *get_word(char *str, char **word)
 static struct menu *new_menu(struct menu *parent,
 			     struct menu_entry *parent_entry, const char *label)
 {
-    struct menu *m = calloc(1, sizeof(struct menu));
+    struct menu *m = arena_zalloc(&config_arena, sizeof(struct menu));
     int i;
 
     m->label = label;
@@ -263,7 +276,7 @@ static struct menu_entry *new_entry(struct menu *m)
 				  sizeof(struct menu_entry *));
     }
 
-    me = calloc(1, sizeof(struct menu_entry));
+    me = arena_zalloc(&config_arena, sizeof(struct menu_entry));
     me->menu = m;
     me->entry = m->nentries;
     m->menu_entries[m->nentries++] = me;
@@ -1108,6 +1121,7 @@ void parse_configs(char **argv)
     struct menu_entry *me;
     int k;
 
+    refstr_set_arena(&config_arena);
     empty_string = refstrdup("");
 
     /* Initialize defaults for the root and hidden menus */
@@ -1174,4 +1188,6 @@ void parse_configs(char **argv)
 	if (hide_key[k])
 	    hide_key[k] = unlabel(hide_key[k]);
     }
+
+    refstr_set_arena(NULL);
 }
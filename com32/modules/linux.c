@@ -44,6 +44,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <console.h>
+#include <sys/stat.h>
 #include <syslinux/loadfile.h>
 #include <syslinux/linux.h>
 #include <syslinux/pxe.h>
@@ -51,6 +52,7 @@
 enum ldmode {
     ldmode_raw,
     ldmode_cpio,
+    ldmode_inplace,
     ldmodes
 };
 
@@ -144,6 +146,131 @@ static int ldinitramfs_raw(struct initramfs *initramfs, char *fname)
     return initramfs_load_archive(initramfs, fname);
 }
 
+/*
+ * When the sizes of all the initrd= archives are known up front, the
+ * memory syslinux_boot_linux() is going to put the initramfs in is
+ * reserved ahead of time and the archives are read straight into it,
+ * rather than into buffers which the shuffler then has to copy.
+ */
+static char *inplace_buf;	/* Final location of the initramfs */
+static uint32_t inplace_size;
+static uint32_t inplace_used;
+
+/* Archives are aligned to 4 bytes, as initramfs_load_archive() does */
+#define INPLACE_ALIGN	4
+
+static f_ldinitramfs ldinitramfs_inplace;
+static int ldinitramfs_inplace(struct initramfs *initramfs, char *fname)
+{
+    struct stat st;
+    uint32_t offset;
+    char *dst;
+    FILE *f;
+    int rv = -1;
+
+    f = fopen(fname, "r");
+    if (!f)
+	return -1;
+
+    if (fstat(fileno(f), &st) || !S_ISREG(st.st_mode))
+	goto out;
+
+    if (st.st_size) {
+	offset = (inplace_used + INPLACE_ALIGN - 1) & ~(INPLACE_ALIGN - 1);
+	if (st.st_size > inplace_size - offset)
+	    goto out;
+
+	/* The gap is part of the initramfs, so it must be zero */
+	memset(inplace_buf + inplace_used, 0, offset - inplace_used);
+
+	dst = inplace_buf + offset;
+	if (fread(dst, 1, st.st_size, f) != (size_t)st.st_size)
+	    goto out;
+	if (initramfs_add_data(initramfs, dst, st.st_size, st.st_size,
+			       INPLACE_ALIGN))
+	    goto out;
+
+	inplace_used = offset + st.st_size;
+    }
+    rv = 0;
+
+out:
+    fclose(f);
+    return rv;
+}
+
+/* Add up the sizes of a comma-separated list of initrd= archives */
+static int initrd_list_size(char *arg, uint32_t *size)
+{
+    struct stat st;
+    FILE *f;
+    char *p;
+    int rv;
+
+    do {
+	p = strchr(arg, ',');
+	if (p)
+	    *p = '\0';
+
+	rv = -1;
+	f = fopen(arg, "r");
+	if (f) {
+	    /* Files of unknown length can't be loaded in place */
+	    if (!fstat(fileno(f), &st) && S_ISREG(st.st_mode)) {
+		if (st.st_size)
+		    *size = ((*size + INPLACE_ALIGN - 1) &
+			     ~(INPLACE_ALIGN - 1)) + st.st_size;
+		rv = 0;
+	    }
+	    fclose(f);
+	}
+
+	if (p)
+	    *p++ = ',';
+    } while (!rv && (arg = p));
+
+    return rv;
+}
+
+/*
+ * Reserve the final location of the initramfs made up of the initrd=
+ * and initrd+= archives.  Returns false if that isn't possible, in
+ * which case they are loaded the ordinary way.
+ */
+static bool reserve_initramfs(char **argv, char **argp,
+			      const void *kernel_data, size_t kernel_len,
+			      const char *cmdline)
+{
+    uint32_t size = 0, addr;
+    char **argl, *arg;
+
+    if ((arg = find_argument(argp, "initrd=")) &&
+	initrd_list_size(arg, &size))
+	return false;
+
+    argl = argv;
+    while ((argl = find_arguments(argl, &arg, "initrd+="))) {
+	argl++;
+	if (initrd_list_size(arg, &size))
+	    return false;
+    }
+
+    if (!size)
+	return false;
+
+    addr = syslinux_initramfs_addr(kernel_data, kernel_len, cmdline, size);
+    if (!addr)
+	return false;
+
+    inplace_buf = malloc_at((void *)addr, size);
+    if (!inplace_buf)
+	return false;
+
+    inplace_size = size;
+    inplace_used = 0;
+    return true;
+}
+
 static f_ldinitramfs ldinitramfs_cpio;
 static int ldinitramfs_cpio(struct initramfs *initramfs, char *fname)
 {
@@ -198,6 +325,10 @@ static int process_initramfs_args(char *arg, struct initramfs *initramfs,
 	mode_msg = "Loading";
 	ldinitramfs = ldinitramfs_raw;
 	break;
+    case ldmode_inplace:
+	mode_msg = "Loading";
+	ldinitramfs = ldinitramfs_inplace;
+	break;
     case ldmode_cpio:
 	mode_msg = "Encapsulating";
 	ldinitramfs = ldinitramfs_cpio;
@@ -265,6 +396,7 @@ int main(int argc, char *argv[])
     void *dhcpdata;
     size_t dhcplen;
     char **argp, **argl, *arg;
+    enum ldmode raw_mode;
 
     (void)argc;
     argp = argv + 1;
@@ -329,9 +461,18 @@ int main(int argc, char *argv[])
 	goto bail;
     }
 
+    /*
+     * The raw archives can only be loaded in place if nothing else
+     * goes into the initramfs, since that changes where it ends up.
+     */
+    raw_mode = ldmode_raw;
+    if (!opt_dhcpinfo && !find_argument(argv, "initrdfile=") &&
+	reserve_initramfs(argv, argp, kernel_data, kernel_len, cmdline))
+	raw_mode = ldmode_inplace;
+
     /* Process initramfs arguments */
     if ((arg = find_argument(argp, "initrd="))) {
-	if (process_initramfs_args(arg, initramfs, kernel_name, ldmode_raw,
+	if (process_initramfs_args(arg, initramfs, kernel_name, raw_mode,
 				   opt_quiet))
 	    goto bail;
     }
@@ -339,7 +480,7 @@ int main(int argc, char *argv[])
     argl = argv;
     while ((argl = find_arguments(argl, &arg, "initrd+="))) {
 	argl++;
-	if (process_initramfs_args(arg, initramfs, kernel_name, ldmode_raw,
+	if (process_initramfs_args(arg, initramfs, kernel_name, raw_mode,
 				   opt_quiet))
 	    goto bail;
     }
@@ -174,6 +174,8 @@ void bios_adv_init(void)
 
     memset(&reg, 0, sizeof(reg));
     call16(adv_init, &reg, NULL);
+
+    bios_disk_adv_init();
 }
 
 int bios_adv_write(void)
@@ -693,11 +695,13 @@ static void bios_cleanup_hardware(void)
 extern void *bios_malloc(size_t, enum heap, size_t);
 extern void *bios_realloc(void *, size_t);
 extern void bios_free(void *);
+extern void *bios_malloc_at(void *, size_t, enum heap, size_t);
 
 struct mem_ops bios_mem_ops = {
 	.malloc = bios_malloc,
 	.realloc = bios_realloc,
 	.free = bios_free,
+	.malloc_at = bios_malloc_at,
 };
 
 struct firmware bios_fw = {
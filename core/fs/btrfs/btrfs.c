@@ -28,12 +28,26 @@ union tree_buf {
 	struct btrfs_leaf leaf;
 };
 
+/* a decompressed extent, as much of it as the file uses */
+struct btrfs_zextent {
+	u64 ino;
+	u64 start;		/* file offset of data[0] */
+	u32 len;		/* bytes valid at data */
+	char *data;		/* points into buf */
+	char *buf;		/* BTRFS_MAX_UNCOMPRESSED bytes */
+};
+
+#define BTRFS_ZCACHE_SLOTS 2
+
 /* filesystem instance structure */
 struct btrfs_info {
 	u64 fs_tree;
 	struct btrfs_super_block sb;
 	struct btrfs_chunk_map chunk_map;
 	union tree_buf *tree_buf;
+	struct btrfs_zextent zcache[BTRFS_ZCACHE_SLOTS];
+	int zcache_next;	/* next slot to replace */
+	char *zbuf;		/* compressed data, BTRFS_MAX_COMPRESSED */
 };
 
 /* compare function used for bin_search */
@@ -478,8 +492,10 @@ static struct inode *btrfs_iget(const char *name, struct inode *parent)
 	search_key.offset = btrfs_name_hash(name, strlen(name));
 	clear_path(&path);
 	ret = search_tree(fs, bfs->fs_tree, &search_key, &path);
-	if (ret)
+	if (ret) {
+		errno = ENOENT;
 		return NULL;
+	}
 	dir_item = *(struct btrfs_dir_item *)path.data;
 
 	return btrfs_iget_by_inr(fs, dir_item.location.objectid);
@@ -561,8 +577,9 @@ static int btrfs_next_extent(struct inode *inode, uint32_t lstart)
 	    return -1;
 	}
 	if (extent_item.compression) {
-	    printf("btrfs: found compressed data, cannot continue!\n");
-	    return -1;
+		/* btrfs_getfssec() decodes these itself */
+		PVT(inode)->compressed = true;
+		return -1;
 	}
 
 	if (extent_item.type == BTRFS_FILE_EXTENT_INLINE) {/* inline file */
@@ -582,6 +599,150 @@ static int btrfs_next_extent(struct inode *inode, uint32_t lstart)
 	return 0;
 }
 
+/*
+ * Find the decompressed extent covering file offset pos, decoding it
+ * if necessary.  Returns 0 and sets *zp on success, 1 if the extent
+ * there isn't compressed, and -1 if it is but can't be read.
+ */
+static int btrfs_get_zextent(struct inode *inode, u64 pos,
+			     struct btrfs_zextent **zp)
+{
+	struct fs_info * const fs = inode->fs;
+	struct btrfs_info * const bfs = fs->fs_info;
+	struct btrfs_zextent *z;
+	struct btrfs_disk_key search_key;
+	struct btrfs_file_extent_item *extent_item;
+	struct btrfs_path path;
+	const char *src;
+	u64 skip, len;
+	u32 srclen;
+	int i, ret;
+
+	for (i = 0; i < BTRFS_ZCACHE_SLOTS; i++) {
+		z = &bfs->zcache[i];
+		if (z->buf && z->ino == inode->ino &&
+		    pos >= z->start && pos < z->start + z->len) {
+			*zp = z;
+			return 0;
+		}
+	}
+
+	/* the extent starting at or before pos */
+	search_key.objectid = inode->ino;
+	search_key.type = BTRFS_EXTENT_DATA_KEY;
+	search_key.offset = pos;
+	clear_path(&path);
+	search_tree(fs, bfs->fs_tree, &search_key, &path);
+	if (btrfs_comp_keys_type(&search_key, &path.item.key) ||
+	    path.item.key.offset > pos)
+		return 1;
+	extent_item = (struct btrfs_file_extent_item *)path.data;
+	if (!extent_item->compression || extent_item->encryption)
+		return 1;
+
+	if (extent_item->type == BTRFS_FILE_EXTENT_INLINE) {
+		/* data follows the item header, in place of disk_bytenr */
+		src = (char *)path.data +
+			offsetof(struct btrfs_file_extent_item, disk_bytenr);
+		srclen = path.item.size -
+			offsetof(struct btrfs_file_extent_item, disk_bytenr);
+		skip = 0;
+		len = extent_item->ram_bytes;
+	} else {
+		srclen = extent_item->disk_num_bytes;
+		skip = extent_item->offset;
+		len = extent_item->num_bytes;
+	}
+	if (pos >= path.item.key.offset + len)
+		return 1;		/* a hole */
+
+	if (extent_item->ram_bytes > BTRFS_MAX_UNCOMPRESSED ||
+	    srclen > BTRFS_MAX_COMPRESSED ||
+	    skip + len > extent_item->ram_bytes) {
+		printf("btrfs: bad compressed extent!\n");
+		return -1;
+	}
+
+	if (!bfs->zbuf) {
+		bfs->zbuf = malloc(BTRFS_MAX_COMPRESSED);
+		if (!bfs->zbuf)
+			return -1;
+	}
+	z = &bfs->zcache[bfs->zcache_next];
+	if (!z->buf) {
+		z->buf = malloc(BTRFS_MAX_UNCOMPRESSED);
+		if (!z->buf)
+			return -1;
+	}
+	z->len = 0;		/* invalid until decoded */
+
+	if (extent_item->type != BTRFS_FILE_EXTENT_INLINE) {
+		cache_read(fs, bfs->zbuf,
+			   logical_physical(fs, extent_item->disk_bytenr),
+			   srclen);
+		src = bfs->zbuf;
+	}
+
+	ret = btrfs_decompress(extent_item->compression, z->buf,
+			       extent_item->ram_bytes, src, srclen);
+	if (ret < 0) {
+		printf("btrfs: corrupt compressed extent!\n");
+		return -1;
+	}
+	memset(z->buf + ret, 0, extent_item->ram_bytes - ret);
+
+	z->ino = inode->ino;
+	z->start = path.item.key.offset;
+	z->data = z->buf + skip;
+	z->len = len;
+	bfs->zcache_next = (bfs->zcache_next + 1) % BTRFS_ZCACHE_SLOTS;
+
+	*zp = z;
+	return 0;
+}
+
+/*
+ * Compressed extents can't be mapped to sectors, so they are decoded
+ * as a whole and copied from; returns -1 if file->offset isn't in one.
+ */
+static int btrfs_getfssec_compressed(struct file *file, char *buf,
+				     int sectors, bool *have_more)
+{
+	struct inode * const inode = file->inode;
+	struct fs_info * const fs = file->fs;
+	u32 lsector = file->offset >> SECTOR_SHIFT(fs);
+	struct btrfs_zextent *z;
+	u32 off, bytes;
+	int ret;
+
+	/* sectors the generic code has mapped are never compressed */
+	if ((lsector >= inode->this_extent.lstart &&
+	     lsector < inode->this_extent.lstart + inode->this_extent.len) ||
+	    (lsector >= inode->next_extent.lstart &&
+	     lsector < inode->next_extent.lstart + inode->next_extent.len))
+		return -1;
+
+	if (file->offset >= inode->size)
+		return -1;
+
+	ret = btrfs_get_zextent(inode, file->offset, &z);
+	if (ret > 0)
+		return -1;
+	if (ret < 0) {
+		*have_more = 0;
+		return 0;
+	}
+
+	off = file->offset - z->start;
+	bytes = min(z->len - off, inode->size - file->offset);
+	bytes = min(bytes, (u32)sectors << SECTOR_SHIFT(fs));
+	memcpy(buf, z->data + off, bytes);
+
+	file->offset += bytes;
+	*have_more = file->offset < inode->size;
+	return bytes;
+}
+
 static uint32_t btrfs_getfssec(struct file *file, char *buf, int sectors,
 					bool *have_more)
 {
@@ -589,14 +750,33 @@ static uint32_t btrfs_getfssec(struct file *file, char *buf, int sectors,
 	struct fs_info *fs = file->fs;
 	u32 off = PVT(file->inode)->offset % SECTOR_SIZE(fs);
 	bool handle_inline = false;
+	int zret;
+
+	/*
+	 * Only a file btrfs_next_extent() has seen a compressed extent in
+	 * pays for looking up the extent at each read position.
+	 */
+	if (PVT(file->inode)->compressed) {
+		zret = btrfs_getfssec_compressed(file, buf, sectors, have_more);
+		if (zret >= 0)
+			return zret;
+	}
 
 	if (off && !file->offset) {/* inline file first read patch */
 		file->inode->size += off;
 		handle_inline = true;
 	}
 	ret = generic_getfssec(file, buf, sectors, have_more);
-	if (!ret)
+	if (!ret) {
+		/* stopped at the first compressed extent of the file? */
+		if (PVT(file->inode)->compressed) {
+			zret = btrfs_getfssec_compressed(file, buf, sectors,
+							 have_more);
+			if (zret > 0)
+				return zret;
+		}
 		return ret;
+	}
 	off = PVT(file->inode)->offset % SECTOR_SIZE(fs);
 	if (handle_inline) {/* inline file patch */
 		ret -= off;
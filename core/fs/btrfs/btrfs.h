@@ -1,6 +1,8 @@
 #ifndef _BTRFS_H_
 #define _BTRFS_H_
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <zconf.h>
 
@@ -53,6 +55,15 @@ typedef u64 __le64;
 #define BTRFS_FILE_EXTENT_REG 1
 #define BTRFS_FILE_EXTENT_PREALLOC 2
 
+#define BTRFS_COMPRESS_NONE 0
+#define BTRFS_COMPRESS_ZLIB 1
+#define BTRFS_COMPRESS_LZO  2
+#define BTRFS_COMPRESS_ZSTD 3
+
+/* btrfs never writes compressed extents bigger than these */
+#define BTRFS_MAX_COMPRESSED   (128 * 1024)
+#define BTRFS_MAX_UNCOMPRESSED (128 * 1024)
+
 #define BTRFS_MAX_LEVEL 8
 #define BTRFS_MAX_CHUNK_ENTRIES 256
 
@@ -290,8 +301,13 @@ struct btrfs_root_ref {
  */
 struct btrfs_pvt_inode {
     uint64_t offset;
+    bool compressed;	/* seen a compressed extent */
 };
 
 #define PVT(i) ((struct btrfs_pvt_inode *)((i)->pvt))
 
+/* decompress.c */
+int btrfs_decompress(int type, void *dst, size_t dstlen,
+		     const void *src, size_t srclen);
+
 #endif
@@ -0,0 +1,246 @@
+/*
+ * decompress.c -- decoders for btrfs compressed extents
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, Inc., 53 Temple Place Ste 330,
+ * Boston MA 02111-1307, USA; either version 2 of the License, or
+ * (at your option) any later version; incorporated herein by reference.
+ *
+ * Every compressed extent is decoded in one go: the compressed bytes
+ * (at most BTRFS_MAX_COMPRESSED) are in memory, and the output is at
+ * most BTRFS_MAX_UNCOMPRESSED bytes.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <minmax.h>
+#include <zlib.h>
+#include "btrfs.h"
+#include "zstd.h"
+
+static int btrfs_zlib_decompress(void *dst, size_t dstlen,
+				 const void *src, size_t srclen)
+{
+	z_stream zs;
+	int rv;
+
+	memset(&zs, 0, sizeof zs);
+	zs.next_in = (Bytef *)src;
+	zs.avail_in = srclen;
+	zs.next_out = dst;
+	zs.avail_out = dstlen;
+
+	if (inflateInit(&zs) != Z_OK)
+		return -1;
+
+	rv = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+
+	/* A full output buffer is fine; the extent may be truncated */
+	if (rv != Z_STREAM_END && !(rv == Z_BUF_ERROR && !zs.avail_out))
+		return -1;
+
+	return zs.total_out;
+}
+
+/*
+ * LZO1X "safe" decoder: the same algorithm as lzo1x_decompress_safe(),
+ * checking every access against both buffers.  Returns the number of
+ * bytes produced, or -1.
+ */
+#define LZO_M2_MAX_OFFSET	0x0800
+
+static int lzo1x_decompress_safe(uint8_t *out, size_t out_len,
+				 const uint8_t *in, size_t in_len)
+{
+	const uint8_t *ip = in;
+	const uint8_t * const ip_end = in + in_len;
+	uint8_t *op = out;
+	uint8_t * const op_end = out + out_len;
+	const uint8_t *m_pos;
+	size_t t, next, state = 0;
+
+#define NEED_IP(x)	if ((size_t)(ip_end - ip) < (size_t)(x)) return -1
+#define NEED_OP(x)	if ((size_t)(op_end - op) < (size_t)(x)) return -1
+#define TEST_LB(m)	if ((m) < out) return -1
+
+	NEED_IP(3);
+	if (*ip > 17) {
+		t = *ip++ - 17;
+		if (t < 4) {
+			next = t;
+			goto match_next;
+		}
+		goto copy_literal_run;
+	}
+
+	for (;;) {
+		t = *ip++;
+		if (t < 16) {
+			if (state == 0) {
+				/* Literal run */
+				if (t == 0) {
+					while (*ip == 0) {
+						t += 255;
+						ip++;
+						NEED_IP(1);
+					}
+					t += 15 + *ip++;
+				}
+				t += 3;
+copy_literal_run:
+				NEED_OP(t);
+				NEED_IP(t + 3);
+				memcpy(op, ip, t);
+				op += t;
+				ip += t;
+				state = 4;
+				continue;
+			} else if (state != 4) {
+				/* Two byte match right after a short run */
+				next = t & 3;
+				m_pos = op - 1 - (t >> 2) - (*ip++ << 2);
+				TEST_LB(m_pos);
+				NEED_OP(2);
+				op[0] = m_pos[0];
+				op[1] = m_pos[1];
+				op += 2;
+				goto match_next;
+			} else {
+				next = t & 3;
+				m_pos = op - (1 + LZO_M2_MAX_OFFSET) -
+					(t >> 2) - (*ip++ << 2);
+				t = 3;
+			}
+		} else if (t >= 64) {
+			next = t & 3;
+			m_pos = op - 1 - ((t >> 2) & 7) - (*ip++ << 3);
+			t = (t >> 5) + 1;
+		} else if (t >= 32) {
+			t = (t & 31) + 2;
+			if (t == 2) {
+				while (*ip == 0) {
+					t += 255;
+					ip++;
+					NEED_IP(1);
+				}
+				t += 31 + *ip++;
+				NEED_IP(2);
+			}
+			next = ip[0] | (ip[1] << 8);
+			ip += 2;
+			m_pos = op - 1 - (next >> 2);
+			next &= 3;
+		} else {
+			m_pos = op - ((t & 8) << 11);
+			t = (t & 7) + 2;
+			if (t == 2) {
+				while (*ip == 0) {
+					t += 255;
+					ip++;
+					NEED_IP(1);
+				}
+				t += 7 + *ip++;
+				NEED_IP(2);
+			}
+			next = ip[0] | (ip[1] << 8);
+			ip += 2;
+			m_pos -= next >> 2;
+			next &= 3;
+			if (m_pos == op)
+				break;		/* End of stream marker */
+			m_pos -= 0x4000;
+		}
+
+		/* Matches may overlap their own output */
+		TEST_LB(m_pos);
+		NEED_OP(t);
+		while (t--)
+			*op++ = *m_pos++;
+
+match_next:
+		state = next;
+		t = next;
+		NEED_IP(t + 3);
+		NEED_OP(t);
+		while (t--)
+			*op++ = *ip++;
+	}
+
+#undef NEED_IP
+#undef NEED_OP
+#undef TEST_LB
+
+	return (t == 3 && ip == ip_end) ? op - out : -1;
+}
+
+/*
+ * btrfs wraps LZO1X as: the total compressed length, then segments of
+ * (length, data), each decoding to at most one page.  All the lengths
+ * are 32-bit little endian, and a segment header never straddles a
+ * page boundary of the compressed data.
+ */
+#define LZO_LEN		4
+#define LZO_PAGE	4096
+
+static inline size_t lzo_len(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((size_t)p[3] << 24);
+}
+
+static int btrfs_lzo_decompress(void *dst, size_t dstlen,
+				const void *src, size_t srclen)
+{
+	const uint8_t *in = src;
+	uint8_t *out = dst;
+	size_t total, pos, seglen, outpos = 0;
+	int n;
+
+	if (srclen < LZO_LEN)
+		return -1;
+	total = lzo_len(in);
+	if (total > srclen)
+		return -1;
+
+	pos = LZO_LEN;
+	while (pos < total && outpos < dstlen) {
+		if (LZO_PAGE - (pos & (LZO_PAGE - 1)) < LZO_LEN)
+			pos = (pos + LZO_PAGE - 1) & ~(LZO_PAGE - 1);
+		if (total - pos < LZO_LEN)
+			break;
+		seglen = lzo_len(in + pos);
+		pos += LZO_LEN;
+		if (!seglen || seglen > total - pos)
+			return -1;
+
+		n = lzo1x_decompress_safe(out + outpos,
+					  min(dstlen - outpos, LZO_PAGE),
+					  in + pos, seglen);
+		if (n < 0)
+			return -1;
+		outpos += n;
+		pos += seglen;
+	}
+
+	return outpos;
+}
+
+/*
+ * Decompress an extent of the given compression type.  Returns the
+ * number of bytes produced, or -1.
+ */
+int btrfs_decompress(int type, void *dst, size_t dstlen,
+		     const void *src, size_t srclen)
+{
+	switch (type) {
+	case BTRFS_COMPRESS_ZLIB:
+		return btrfs_zlib_decompress(dst, dstlen, src, srclen);
+	case BTRFS_COMPRESS_LZO:
+		return btrfs_lzo_decompress(dst, dstlen, src, srclen);
+	case BTRFS_COMPRESS_ZSTD:
+		return zstd_decompress(dst, dstlen, src, srclen);
+	default:
+		return -1;
+	}
+}
@@ -0,0 +1,880 @@
+/*
+ * zstd.c -- a small Zstandard (RFC 8878) decoder for btrfs extents
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, Inc., 53 Temple Place Ste 330,
+ * Boston MA 02111-1307, USA; either version 2 of the License, or
+ * (at your option) any later version; incorporated herein by reference.
+ *
+ * Frames are decoded into one flat output buffer, which makes the
+ * window simply "everything decoded so far".  Dictionaries are not
+ * supported (btrfs never uses them) and checksums are not verified.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zstd.h"
+
+#define ZSTD_MAGIC		0xFD2FB528U
+#define ZSTD_SKIP_MAGIC		0x184D2A50U	/* Low 4 bits are free */
+#define ZSTD_BLOCK_MAX		(128 << 10)
+
+#define LL_MAX_SYMBOL		35
+#define ML_MAX_SYMBOL		52
+#define OF_MAX_SYMBOL		31
+#define LL_MAX_LOG		9
+#define ML_MAX_LOG		9
+#define OF_MAX_LOG		8
+#define HUF_MAX_LOG		11
+#define HUF_MAX_SYMBOLS		256
+#define HUF_WEIGHT_MAX_LOG	6
+
+struct fse_entry {
+	uint16_t base;		/* Next state, before adding the new bits */
+	uint8_t symbol;
+	uint8_t bits;
+};
+
+struct fse_table {
+	int log;
+	struct fse_entry e[1 << LL_MAX_LOG];	/* LL and ML are the largest */
+};
+
+struct huf_entry {
+	uint8_t symbol;
+	uint8_t bits;
+};
+
+struct zstd_ctx {
+	struct fse_table ll, ml, of;
+	struct fse_table wt;	/* Huffman weights */
+	bool have_ll, have_ml, have_of;
+	struct huf_entry huf[1 << HUF_MAX_LOG];
+	int huf_log;		/* 0 = no table yet */
+	uint32_t rep[3];
+	uint8_t *lit;		/* Literals of the current block */
+	size_t nlit;
+};
+
+static const int16_t ll_default[LL_MAX_SYMBOL + 1] = {
+	4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+	-1, -1, -1, -1
+};
+
+static const int16_t ml_default[ML_MAX_SYMBOL + 1] = {
+	1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+	-1, -1, -1, -1, -1
+};
+
+static const int16_t of_default[29] = {
+	1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+};
+
+static const uint32_t ll_base[LL_MAX_SYMBOL + 1] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512,
+	1024, 2048, 4096, 8192, 16384, 32768, 65536
+};
+
+static const uint8_t ll_bits[LL_MAX_SYMBOL + 1] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+	13, 14, 15, 16
+};
+
+static const uint32_t ml_base[ML_MAX_SYMBOL + 1] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+	19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+	35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027,
+	2051, 4099, 8195, 16387, 32771, 65539
+};
+
+static const uint8_t ml_bits[ML_MAX_SYMBOL + 1] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+	12, 13, 14, 15, 16
+};
+
+static inline int highbit(uint32_t v)
+{
+	return 31 - __builtin_clz(v);
+}
+
+static inline uint32_t get_le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get_le24(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+	return get_le24(p) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * Backward bit reader, used by all the entropy coded streams: the
+ * stream is read from its last byte towards the first, and the highest
+ * set bit of the last byte marks where the data starts.  Reading past
+ * the beginning yields zeroes and leaves pos negative.
+ */
+struct bitrd {
+	const uint8_t *p;
+	long pos;		/* Bits left to read */
+};
+
+static int br_init(struct bitrd *br, const uint8_t *p, size_t len)
+{
+	if (!len || !p[len - 1])
+		return -1;
+
+	br->p = p;
+	br->pos = (long)(len - 1) * 8 + highbit(p[len - 1]);
+	return 0;
+}
+
+static inline uint32_t br_peek(const struct bitrd *br, int n)
+{
+	long pos = br->pos - n;
+	long i, first;
+	uint64_t v = 0;
+
+	if (!n)
+		return 0;
+
+	/* Gather the bytes covering bits [pos, pos + n) */
+	first = pos >> 3;	/* Arithmetic shift: rounds down */
+	for (i = (pos + n - 1) >> 3; i >= first; i--) {
+		v <<= 8;
+		if (i >= 0)
+			v |= br->p[i];
+	}
+	return (v >> (pos & 7)) & ((1U << n) - 1);
+}
+
+static inline uint32_t br_read(struct bitrd *br, int n)
+{
+	uint32_t v = br_peek(br, n);
+
+	br->pos -= n;
+	return v;
+}
+
+/*
+ * Peek at the 24+ bits starting at bit bitpos of a forward bitstream,
+ * padding with zeroes past the end.
+ */
+static uint32_t fwd_peek(const uint8_t *p, size_t len, size_t bitpos)
+{
+	size_t i, byte = bitpos >> 3;
+	uint32_t v = 0;
+
+	for (i = 0; i < 4 && byte + i < len; i++)
+		v |= (uint32_t)p[byte + i] << (8 * i);
+	return v >> (bitpos & 7);
+}
+
+/*
+ * FSE tables
+ */
+static int fse_build(struct fse_table *t, const int16_t *norm, int nsym,
+		     int log)
+{
+	uint16_t next[ML_MAX_SYMBOL + 1];
+	unsigned int size = 1 << log;
+	unsigned int high = size - 1;
+	unsigned int step = (size >> 1) + (size >> 3) + 3;
+	unsigned int pos = 0;
+	unsigned int u, n;
+	int s, i, bits;
+
+	t->log = log;
+
+	for (s = 0; s < nsym; s++) {
+		if (norm[s] == -1) {
+			t->e[high--].symbol = s;
+			next[s] = 1;
+		} else {
+			next[s] = norm[s];
+		}
+	}
+
+	for (s = 0; s < nsym; s++) {
+		for (i = 0; i < norm[s]; i++) {
+			t->e[pos].symbol = s;
+			do {
+				pos = (pos + step) & (size - 1);
+			} while (pos > high);
+		}
+	}
+	if (pos)
+		return -1;	/* Probabilities don't add up */
+
+	for (u = 0; u < size; u++) {
+		n = next[t->e[u].symbol]++;
+		bits = log - highbit(n);
+		t->e[u].bits = bits;
+		t->e[u].base = (n << bits) - size;
+	}
+
+	return 0;
+}
+
+static void fse_rle(struct fse_table *t, uint8_t symbol)
+{
+	t->log = 0;
+	t->e[0].symbol = symbol;
+	t->e[0].bits = 0;
+	t->e[0].base = 0;
+}
+
+/*
+ * Read an FSE table description, which is a forward (little endian)
+ * bitstream.  Returns the number of bytes used, or -1.
+ */
+static int fse_read(struct fse_table *t, const uint8_t *p, size_t len,
+		    int max_symbol, int max_log)
+{
+	int16_t norm[ML_MAX_SYMBOL + 1];
+	size_t bitpos = 4;
+	int log, remaining, threshold, nbits, symbol, max, count;
+	uint32_t v, rep;
+	bool prev0 = false;
+
+	if (!len)
+		return -1;
+
+	log = (p[0] & 15) + 5;
+	if (log > max_log)
+		return -1;
+
+	remaining = (1 << log) + 1;
+	threshold = 1 << log;
+	nbits = log + 1;
+	symbol = 0;
+
+	while (remaining > 1 && symbol <= max_symbol) {
+		if (prev0) {
+			/* Runs of zero probabilities, two bits at a time */
+			do {
+				if ((bitpos >> 3) >= len)
+					return -1;
+				rep = fwd_peek(p, len, bitpos) & 3;
+				bitpos += 2;
+				for (v = 0; v < rep; v++) {
+					if (symbol > max_symbol)
+						return -1;
+					norm[symbol++] = 0;
+				}
+			} while (rep == 3);
+			if (symbol > max_symbol)
+				break;
+		}
+
+		if ((bitpos >> 3) >= len)
+			return -1;
+		v = fwd_peek(p, len, bitpos);
+
+		max = (2 * threshold - 1) - remaining;
+		if ((int)(v & (threshold - 1)) < max) {
+			count = v & (threshold - 1);
+			bitpos += nbits - 1;
+		} else {
+			count = v & (2 * threshold - 1);
+			if (count >= threshold)
+				count -= max;
+			bitpos += nbits;
+		}
+		count--;	/* -1 means "less than 1" */
+		remaining -= count < 0 ? -count : count;
+		norm[symbol++] = count;
+		prev0 = !count;
+		while (remaining < threshold) {
+			nbits--;
+			threshold >>= 1;
+		}
+	}
+
+	if (remaining != 1 || ((bitpos + 7) >> 3) > len)
+		return -1;
+
+	if (fse_build(t, norm, symbol, log))
+		return -1;
+
+	return (bitpos + 7) >> 3;
+}
+
+static inline uint8_t fse_symbol(const struct fse_table *t, uint32_t state)
+{
+	return t->e[state].symbol;
+}
+
+static inline uint32_t fse_update(const struct fse_table *t, uint32_t state,
+				  struct bitrd *br)
+{
+	return t->e[state].base + br_read(br, t->e[state].bits);
+}
+
+/*
+ * Huffman tables for the literals
+ */
+static int huf_read(struct zstd_ctx *ctx, const uint8_t *p, size_t len)
+{
+	uint8_t w[HUF_MAX_SYMBOLS];
+	uint32_t rank[HUF_MAX_LOG + 2];
+	uint32_t total, left, pos, u;
+	int nsym, hdr, n, i, log, bits;
+
+	if (!len)
+		return -1;
+
+	hdr = p[0];
+	if (hdr >= 128) {
+		/* Directly stored, 4 bits per weight */
+		nsym = hdr - 127;
+		hdr = (nsym + 1) >> 1;
+		if ((size_t)hdr + 1 > len)
+			return -1;
+		for (i = 0; i < nsym; i++)
+			w[i] = (i & 1) ? p[1 + (i >> 1)] & 15 : p[1 + (i >> 1)] >> 4;
+	} else {
+		/* FSE compressed, decoded with two interleaved states */
+		struct fse_table *t = &ctx->wt;
+		struct bitrd br;
+		uint32_t s1, s2;
+
+		if ((size_t)hdr + 1 > len)
+			return -1;
+		n = fse_read(t, p + 1, hdr, HUF_MAX_LOG + 1, HUF_WEIGHT_MAX_LOG);
+		if (n < 0 || br_init(&br, p + 1 + n, hdr - n))
+			return -1;
+
+		s1 = br_read(&br, t->log);
+		s2 = br_read(&br, t->log);
+		nsym = 0;
+		for (;;) {
+			if (nsym > HUF_MAX_SYMBOLS - 2)
+				return -1;
+			w[nsym++] = fse_symbol(t, s1);
+			s1 = fse_update(t, s1, &br);
+			if (br.pos < 0) {
+				w[nsym++] = fse_symbol(t, s2);
+				break;
+			}
+			if (nsym > HUF_MAX_SYMBOLS - 2)
+				return -1;
+			w[nsym++] = fse_symbol(t, s2);
+			s2 = fse_update(t, s2, &br);
+			if (br.pos < 0) {
+				w[nsym++] = fse_symbol(t, s1);
+				break;
+			}
+		}
+	}
+
+	if (nsym >= HUF_MAX_SYMBOLS)
+		return -1;
+
+	/* The weight of the last symbol is implied */
+	memset(rank, 0, sizeof rank);
+	total = 0;
+	for (i = 0; i < nsym; i++) {
+		if (w[i] > HUF_MAX_LOG)
+			return -1;
+		rank[w[i]]++;
+		if (w[i])
+			total += 1 << (w[i] - 1);
+	}
+	if (!total)
+		return -1;
+	log = highbit(total) + 1;
+	if (log > HUF_MAX_LOG)
+		return -1;
+	left = (1 << log) - total;
+	if (left & (left - 1))
+		return -1;
+	w[nsym] = highbit(left) + 1;
+	rank[w[nsym]]++;
+	nsym++;
+
+	/* Longest codes (lowest weights) fill the table from the bottom */
+	pos = 0;
+	for (i = 1; i <= log; i++) {
+		u = pos;
+		pos += rank[i] << (i - 1);
+		rank[i] = u;
+	}
+	for (i = 0; i < nsym; i++) {
+		if (!w[i])
+			continue;
+		bits = log + 1 - w[i];
+		n = 1 << (w[i] - 1);
+		for (u = rank[w[i]]; u < rank[w[i]] + n; u++) {
+			ctx->huf[u].symbol = i;
+			ctx->huf[u].bits = bits;
+		}
+		rank[w[i]] += n;
+	}
+
+	ctx->huf_log = log;
+	return hdr + 1;
+}
+
+static int huf_stream(const struct zstd_ctx *ctx, uint8_t *dst, size_t n,
+		      const uint8_t *p, size_t len)
+{
+	const struct huf_entry *e;
+	struct bitrd br;
+
+	if (br_init(&br, p, len))
+		return -1;
+
+	while (n--) {
+		e = &ctx->huf[br_peek(&br, ctx->huf_log)];
+		*dst++ = e->symbol;
+		br.pos -= e->bits;
+	}
+
+	return br.pos ? -1 : 0;
+}
+
+/*
+ * Literals section; returns the number of bytes consumed
+ */
+static int decode_literals(struct zstd_ctx *ctx, const uint8_t *p, size_t len)
+{
+	uint8_t hb[5];
+	int type, format, n, i;
+	size_t regen, csize, hlen, part, used;
+	uint32_t h;
+
+	if (!len)
+		return -1;
+
+	/* The header is 1-5 bytes; pad it so it can be read in one go */
+	memset(hb, 0, sizeof hb);
+	memcpy(hb, p, len < sizeof hb ? len : sizeof hb);
+	type = hb[0] & 3;
+	format = (hb[0] >> 2) & 3;
+
+	if (type < 2) {
+		/* Raw or RLE */
+		switch (format) {
+		case 1:
+			regen = get_le16(hb) >> 4;
+			hlen = 2;
+			break;
+		case 3:
+			regen = get_le24(hb) >> 4;
+			hlen = 3;
+			break;
+		default:
+			regen = hb[0] >> 3;
+			hlen = 1;
+			break;
+		}
+		if (regen > ZSTD_BLOCK_MAX)
+			return -1;
+		ctx->nlit = regen;
+		if (type == 0) {
+			if (hlen + regen > len)
+				return -1;
+			memcpy(ctx->lit, p + hlen, regen);
+			return hlen + regen;
+		} else {
+			if (hlen + 1 > len)
+				return -1;
+			memset(ctx->lit, p[hlen], regen);
+			return hlen + 1;
+		}
+	}
+
+	/* Huffman compressed, possibly with the previous tree */
+	switch (format) {
+	case 0:
+	case 1:
+		h = get_le24(hb);
+		regen = (h >> 4) & 0x3ff;
+		csize = h >> 14;
+		hlen = 3;
+		break;
+	case 2:
+		h = get_le32(hb);
+		regen = (h >> 4) & 0x3fff;
+		csize = h >> 18;
+		hlen = 4;
+		break;
+	default:
+		h = get_le32(hb);
+		regen = (h >> 4) & 0x3ffff;
+		csize = (h >> 22) | (hb[4] << 10);
+		hlen = 5;
+		break;
+	}
+	if (regen > ZSTD_BLOCK_MAX || hlen + csize > len)
+		return -1;
+	ctx->nlit = regen;
+	used = hlen + csize;
+	p += hlen;
+
+	if (type == 2) {
+		n = huf_read(ctx, p, csize);
+		if (n < 0)
+			return -1;
+		p += n;
+		csize -= n;
+	} else if (!ctx->huf_log) {
+		return -1;
+	}
+
+	if (format == 0) {
+		if (huf_stream(ctx, ctx->lit, regen, p, csize))
+			return -1;
+	} else {
+		size_t slen[4];
+
+		if (csize < 6)
+			return -1;
+		slen[0] = get_le16(p);
+		slen[1] = get_le16(p + 2);
+		slen[2] = get_le16(p + 4);
+		p += 6;
+		csize -= 6;
+		if (slen[0] + slen[1] + slen[2] > csize)
+			return -1;
+		slen[3] = csize - slen[0] - slen[1] - slen[2];
+
+		part = (regen + 3) >> 2;
+		if (3 * part > regen)
+			return -1;
+		for (i = 0; i < 4; i++) {
+			if (huf_stream(ctx, ctx->lit + i * part,
+				       i < 3 ? part : regen - 3 * part,
+				       p, slen[i]))
+				return -1;
+			p += slen[i];
+		}
+	}
+
+	return used;
+}
+
+/*
+ * Set up one of the sequence FSE tables according to its mode;
+ * returns the number of bytes consumed.
+ */
+static int seq_table(struct fse_table *t, bool *have, int mode,
+		     const uint8_t *p, size_t len, const int16_t *def,
+		     int ndef, int def_log, int max_symbol, int max_log)
+{
+	int n;
+
+	switch (mode) {
+	case 0:			/* Predefined */
+		if (fse_build(t, def, ndef, def_log))
+			return -1;
+		n = 0;
+		break;
+	case 1:			/* RLE */
+		if (!len || p[0] > max_symbol)
+			return -1;
+		fse_rle(t, p[0]);
+		n = 1;
+		break;
+	case 2:			/* FSE compressed */
+		n = fse_read(t, p, len, max_symbol, max_log);
+		if (n < 0)
+			return -1;
+		break;
+	default:		/* Repeat */
+		if (!*have)
+			return -1;
+		n = 0;
+		break;
+	}
+
+	*have = true;
+	return n;
+}
+
+/*
+ * Sequences section: decode and execute, producing the block output
+ * at dst + *pos.  The whole of dst before that is the window.
+ */
+static int decode_sequences(struct zstd_ctx *ctx, uint8_t *dst, size_t dstlen,
+			    size_t *pos, const uint8_t *p, size_t len)
+{
+	const uint8_t *lit = ctx->lit;
+	const uint8_t *lend = lit + ctx->nlit;
+	uint32_t nseq, llstate, mlstate, ofstate;
+	uint32_t ofv, offset, ll, ml;
+	uint8_t llc, mlc, ofc;
+	struct bitrd br;
+	size_t op = *pos;
+	int n;
+
+	if (!len)
+		return -1;
+
+	nseq = p[0];
+	if (nseq < 128) {
+		p++, len--;
+	} else if (nseq < 255) {
+		if (len < 2)
+			return -1;
+		nseq = ((nseq - 128) << 8) + p[1];
+		p += 2, len -= 2;
+	} else {
+		if (len < 3)
+			return -1;
+		nseq = get_le16(p + 1) + 0x7f00;
+		p += 3, len -= 3;
+	}
+
+	if (nseq) {
+		int modes;
+
+		if (!len)
+			return -1;
+		modes = *p++;
+		len--;
+		if (modes & 3)
+			return -1;	/* Reserved */
+
+		n = seq_table(&ctx->ll, &ctx->have_ll, modes >> 6, p, len,
+			      ll_default, LL_MAX_SYMBOL + 1, 6,
+			      LL_MAX_SYMBOL, LL_MAX_LOG);
+		if (n < 0)
+			return -1;
+		p += n, len -= n;
+		n = seq_table(&ctx->of, &ctx->have_of, (modes >> 4) & 3, p, len,
+			      of_default, 29, 5, OF_MAX_SYMBOL, OF_MAX_LOG);
+		if (n < 0)
+			return -1;
+		p += n, len -= n;
+		n = seq_table(&ctx->ml, &ctx->have_ml, (modes >> 2) & 3, p, len,
+			      ml_default, ML_MAX_SYMBOL + 1, 6,
+			      ML_MAX_SYMBOL, ML_MAX_LOG);
+		if (n < 0)
+			return -1;
+		p += n, len -= n;
+
+		if (br_init(&br, p, len))
+			return -1;
+		llstate = br_read(&br, ctx->ll.log);
+		ofstate = br_read(&br, ctx->of.log);
+		mlstate = br_read(&br, ctx->ml.log);
+
+		while (nseq--) {
+			llc = fse_symbol(&ctx->ll, llstate);
+			mlc = fse_symbol(&ctx->ml, mlstate);
+			ofc = fse_symbol(&ctx->of, ofstate);
+			if (llc > LL_MAX_SYMBOL || mlc > ML_MAX_SYMBOL ||
+			    ofc > OF_MAX_SYMBOL)
+				return -1;
+
+			ofv = (1U << ofc) + br_read(&br, ofc);
+			ml = ml_base[mlc] + br_read(&br, ml_bits[mlc]);
+			ll = ll_base[llc] + br_read(&br, ll_bits[llc]);
+
+			if (ofv > 3) {
+				offset = ofv - 3;
+				ctx->rep[2] = ctx->rep[1];
+				ctx->rep[1] = ctx->rep[0];
+				ctx->rep[0] = offset;
+			} else {
+				if (!ll)
+					ofv++;
+				if (ofv == 1) {
+					offset = ctx->rep[0];
+				} else {
+					offset = ofv == 4 ? ctx->rep[0] - 1
+							  : ctx->rep[ofv - 1];
+					if (ofv != 2)
+						ctx->rep[2] = ctx->rep[1];
+					ctx->rep[1] = ctx->rep[0];
+					ctx->rep[0] = offset;
+				}
+			}
+
+			if (nseq) {
+				llstate = fse_update(&ctx->ll, llstate, &br);
+				mlstate = fse_update(&ctx->ml, mlstate, &br);
+				ofstate = fse_update(&ctx->of, ofstate, &br);
+			}
+			if (br.pos < 0)
+				return -1;
+
+			/* Execute */
+			if (ll > (size_t)(lend - lit) || ll > dstlen - op)
+				return -1;
+			memcpy(dst + op, lit, ll);
+			lit += ll;
+			op += ll;
+
+			if (!offset || offset > op || ml > dstlen - op)
+				return -1;
+			while (ml--) {
+				dst[op] = dst[op - offset];
+				op++;
+			}
+		}
+
+		if (br.pos)
+			return -1;
+	}
+
+	/* Trailing literals */
+	if ((size_t)(lend - lit) > dstlen - op)
+		return -1;
+	memcpy(dst + op, lit, lend - lit);
+	op += lend - lit;
+
+	*pos = op;
+	return 0;
+}
+
+static int decode_frame(struct zstd_ctx *ctx, uint8_t *dst, size_t dstlen,
+			size_t *pos, const uint8_t *p, size_t len)
+{
+	static const uint8_t did_size[4] = { 0, 1, 2, 4 };
+	static const uint8_t fcs_size[4] = { 0, 2, 4, 8 };
+	const uint8_t *start = p;
+	uint32_t hdr, bsize, dictid;
+	int fhd, btype, last, n;
+	size_t hlen;
+
+	if (len < 5)
+		return -1;
+	fhd = p[4];
+	if (fhd & 0x08)
+		return -1;	/* Reserved bit */
+
+	hlen = 5;
+	if (!(fhd & 0x20))
+		hlen++;		/* Window descriptor */
+	dictid = 0;
+	n = did_size[fhd & 3];
+	if (hlen + n > len)
+		return -1;
+	memcpy(&dictid, p + hlen, n);	/* Little endian */
+	if (dictid)
+		return -1;
+	hlen += n;
+	n = fcs_size[fhd >> 6];
+	if (!n && (fhd & 0x20))
+		n = 1;
+	hlen += n;
+	if (hlen > len)
+		return -1;
+	p += hlen, len -= hlen;
+
+	ctx->rep[0] = 1;
+	ctx->rep[1] = 4;
+	ctx->rep[2] = 8;
+	ctx->huf_log = 0;
+	ctx->have_ll = ctx->have_ml = ctx->have_of = false;
+
+	do {
+		if (len < 3)
+			return -1;
+		hdr = get_le24(p);
+		p += 3, len -= 3;
+		last = hdr & 1;
+		btype = (hdr >> 1) & 3;
+		bsize = hdr >> 3;
+
+		switch (btype) {
+		case 0:		/* Raw */
+			if (bsize > len || bsize > dstlen - *pos)
+				return -1;
+			memcpy(dst + *pos, p, bsize);
+			*pos += bsize;
+			break;
+		case 1:		/* RLE */
+			if (!len || bsize > dstlen - *pos)
+				return -1;
+			memset(dst + *pos, p[0], bsize);
+			*pos += bsize;
+			bsize = 1;
+			break;
+		case 2:		/* Compressed */
+			if (bsize > len || bsize > ZSTD_BLOCK_MAX)
+				return -1;
+			n = decode_literals(ctx, p, bsize);
+			if (n < 0 || decode_sequences(ctx, dst, dstlen, pos,
+						      p + n, bsize - n))
+				return -1;
+			break;
+		default:
+			return -1;
+		}
+		p += bsize, len -= bsize;
+	} while (!last);
+
+	if (fhd & 0x04) {
+		/* Content checksum; not verified */
+		if (len < 4)
+			return -1;
+		p += 4;
+	}
+
+	return p - start;
+}
+
+/*
+ * Decompress a sequence of frames into dst.  Decoding stops at the
+ * first thing which is not a frame, since btrfs pads the compressed
+ * data to a whole sector.  Returns the number of bytes produced, or
+ * -1 on error.
+ */
+int zstd_decompress(void *dst, size_t dstlen, const void *src, size_t srclen)
+{
+	const uint8_t *p = src;
+	struct zstd_ctx *ctx;
+	size_t pos = 0;
+	uint32_t magic, skip;
+	int n = 0;
+
+	ctx = malloc(sizeof *ctx);
+	if (!ctx)
+		return -1;
+	ctx->lit = malloc(ZSTD_BLOCK_MAX);
+	if (!ctx->lit) {
+		free(ctx);
+		return -1;
+	}
+
+	while (srclen >= 8) {
+		magic = get_le32(p);
+		if ((magic & ~15U) == ZSTD_SKIP_MAGIC) {
+			skip = get_le32(p + 4);
+			if (skip > srclen - 8)
+				break;
+			n = skip + 8;
+		} else if (magic == ZSTD_MAGIC) {
+			n = decode_frame(ctx, dst, dstlen, &pos, p, srclen);
+			if (n < 0)
+				break;
+		} else {
+			break;
+		}
+		p += n;
+		srclen -= n;
+	}
+
+	free(ctx->lit);
+	free(ctx);
+	return n < 0 ? -1 : (int)pos;
+}
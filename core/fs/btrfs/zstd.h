@@ -0,0 +1,8 @@
+#ifndef _ZSTD_H_
+#define _ZSTD_H_
+
+#include <stddef.h>
+
+int zstd_decompress(void *dst, size_t dstlen, const void *src, size_t srclen);
+
+#endif /* _ZSTD_H_ */
@@ -6,42 +6,140 @@
 #include <stdio.h>
 #include <string.h>
 #include <dprintf.h>
+#include <ilog2.h>
+#include <minmax.h>
 #include "core.h"
 #include "cache.h"
 
 
+/*
+ * Pick a cache size for a system with _memsize_ bytes of free memory:
+ * about 1/64 of it, clamped to [CACHE_MIN_SIZE, CACHE_MAX_SIZE].  If
+ * the memory size is unknown we stick to the minimum.
+ */
+uint32_t cache_size_for_memory(size_t memsize)
+{
+    size_t size = memsize >> 6;
+
+    if (size < CACHE_MIN_SIZE)
+	size = CACHE_MIN_SIZE;
+    else if (size > CACHE_MAX_SIZE)
+	size = CACHE_MAX_SIZE;
+
+    return size;
+}
+
+static inline struct cache **cache_bucket(struct device *dev, block_t block)
+{
+    uint32_t key = (uint32_t)block ^ (uint32_t)(block >> 32);
+
+    if (!dev->cache_hash_shift)
+	return dev->cache_hash;	/* Single bucket; >> 32 is undefined */
+
+    /* Fibonacci hashing; the top bits are the best mixed */
+    return &dev->cache_hash[(key * 0x9e370001U) >> (32 - dev->cache_hash_shift)];
+}
+
+static void cache_hash_remove(struct device *dev, struct cache *cs)
+{
+    struct cache **pp;
+
+    if (cs->block == (block_t)-1)
+	return;
+
+    for (pp = cache_bucket(dev, cs->block); *pp; pp = &(*pp)->hnext) {
+	if (*pp == cs) {
+	    *pp = cs->hnext;
+	    break;
+	}
+    }
+    cs->hnext = NULL;
+}
+
+static void cache_hash_insert(struct device *dev, struct cache *cs,
+			      block_t block)
+{
+    struct cache **pp = cache_bucket(dev, block);
+
+    cs->block = block;
+    cs->hnext = *pp;
+    *pp = cs;
+}
+
 /*
  * Initialize the cache data structres. the _block_size_shift_ specify
  * the block size, which is 512 byte for FAT fs of the current 
  * implementation since the block(cluster) size in FAT is a bit big.
+ *
+ * The cache memory is laid out as the read-ahead staging area, then
+ * the data blocks, followed by the LRU head node and one descriptor
+ * per block, followed by the hash buckets used to look blocks up.
  */
 void cache_init(struct device *dev, int block_size_shift)
 {
     struct cache *prev, *cur;
     char *data = dev->cache_data;
     struct cache *head, *cache;
+    uint32_t entries, size, ra_size;
     int i;
 
     dev->cache_block_size = 1 << block_size_shift;
 
-    if (dev->cache_size < dev->cache_block_size + 2*sizeof(struct cache)) {
+    /* Use up to 1/8 of the cache as read-ahead staging area */
+    ra_size = dev->cache_size >> 3;
+    if (ra_size > CACHE_RA_SIZE)
+	ra_size = CACHE_RA_SIZE;
+    ra_size &= ~(dev->cache_block_size - 1);
+    if (ra_size < 2*dev->cache_block_size)
+	ra_size = 0;
+    size = dev->cache_size - ra_size;
+
+    if (size < dev->cache_block_size + 2*sizeof(struct cache) +
+	sizeof(struct cache *)) {
 	dev->cache_head = NULL;
 	return;			/* Cache unusably small */
     }
 
-    /* We need one struct cache for the headnode plus one for each block */
-    dev->cache_entries =
-	(dev->cache_size - sizeof(struct cache))/
-	(dev->cache_block_size + sizeof(struct cache));
+    /*
+     * We need one struct cache for the headnode plus one for each
+     * block, and at most one hash bucket per block.
+     */
+    entries = (size - sizeof(struct cache))/
+	(dev->cache_block_size + sizeof(struct cache) +
+	 sizeof(struct cache *));
+    if (entries > 0xffff)
+	entries = 0xffff;
+    dev->cache_entries = entries;
+
+    dev->cache_ra_buf = ra_size ? data : NULL;
+    dev->cache_ra_limit = min(ra_size >> block_size_shift, entries >> 1);
+    if (dev->cache_ra_limit < 2)
+	dev->cache_ra_buf = NULL;
+    dev->cache_ra_max = dev->cache_ra_buf ? dev->cache_ra_limit : 0;
+    dev->cache_last_miss = -1;
+    dev->cache_end = -1;
+    if (dev->disk->sectors > dev->disk->part_start)
+	dev->cache_end = (dev->disk->sectors - dev->disk->part_start) >>
+	    (block_size_shift - dev->disk->sector_shift);
+    memset(&dev->cache_stats, 0, sizeof dev->cache_stats);
+    data += ra_size;
 
     dev->cache_head = head = (struct cache *)
 	(data + (dev->cache_entries << block_size_shift));
     cache = head + 1;		/* First cache descriptor */
 
+    /* A power of two number of buckets, for a load factor below 2 */
+    dev->cache_hash_shift = ilog2(dev->cache_entries);
+    dev->cache_hash = (struct cache **)&cache[dev->cache_entries];
+    memset(dev->cache_hash, 0,
+	   sizeof(struct cache *) << dev->cache_hash_shift);
+
     head->prev  = &cache[dev->cache_entries-1];
     head->prev->next = head;
     head->block = -1;
+    head->hnext = NULL;
     head->data  = NULL;
+    head->flags = 0;
 
     prev = head;
     
@@ -49,6 +147,8 @@ void cache_init(struct device *dev, int block_size_shift)
         cur = &cache[i];
         cur->data  = data;
         cur->block = -1;
+        cur->hnext = NULL;
+        cur->flags = 0;
         cur->prev  = prev;
         prev->next = cur;
         data += dev->cache_block_size;
@@ -58,6 +158,20 @@ void cache_init(struct device *dev, int block_size_shift)
     dev->cache_init = 1; /* Set cache as initialized */
 }
 
+/*
+ * Set the maximum number of blocks a single cache miss may load.
+ * Values of 0 or 1 turn read-ahead off.
+ */
+void cache_set_readahead(struct device *dev, unsigned int nblocks)
+{
+    if (!dev->cache_ra_buf || nblocks < 2)
+	nblocks = 0;
+    else if (nblocks > dev->cache_ra_limit)
+	nblocks = dev->cache_ra_limit;
+
+    dev->cache_ra_max = nblocks;
+}
+
 /*
  * Lock a block permanently in the cache by removing it
  * from the LRU chain.
@@ -74,23 +188,25 @@ void cache_lock_block(struct cache *cs)
  * Check for a particular BLOCK in the block cache, 
  * and if it is already there, just do nothing and return;
  * otherwise pick a victim block and update the LRU link.
+ *
+ * A victim is taken off the hash index and marked invalid, so the
+ * caller has to fill it in (see get_cache()) before it can be found.
  */
 struct cache *_get_cache_block(struct device *dev, block_t block)
 {
     struct cache *head = dev->cache_head;
     struct cache *cs;
-    int i;
 
-    cs = dev->cache_head + 1;
-
-    for (i = 0; i < dev->cache_entries; i++) {
+    for (cs = *cache_bucket(dev, block); cs; cs = cs->hnext) {
 	if (cs->block == block)
 	    goto found;
-	cs++;
     }
     
     /* Not found, pick a victim */
     cs = head->next;
+    cache_hash_remove(dev, cs);
+    cs->block = -1;
+    cs->flags = 0;
 
 found:
     /* Move to the end of the LRU chain, unless the block is already locked */
@@ -107,44 +223,142 @@ found:
     return cs;
 }    
 
+static inline bool cache_has_block(struct device *dev, block_t block)
+{
+    struct cache *cs;
+
+    for (cs = *cache_bucket(dev, block); cs; cs = cs->hnext) {
+	if (cs->block == block)
+	    return true;
+    }
+    return false;
+}
+
 /*
- * Check for a particular BLOCK in the block cache, 
- * and if it is already there, just do nothing and return;
- * otherwise load it from disk and update the LRU link.
- * Return the data pointer.
+ * Load BLOCK into the descriptor CS, which must be a fresh victim.
+ * Up to NBLOCKS-1 following blocks are loaded along with it in one
+ * disk request, stopping at the first block which is already cached
+ * or at the end of the disk.
  */
-const void *get_cache(struct device *dev, block_t block)
+static void cache_fill(struct device *dev, struct cache *cs, block_t block,
+		       uint32_t nblocks)
+{
+    struct disk *disk = dev->disk;
+    int sec_per_block = dev->cache_block_size / disk->sector_size;
+    const char *p;
+    uint32_t n, got;
+    int rv;
+
+    if (nblocks > dev->cache_ra_max)
+	nblocks = dev->cache_ra_max;
+    if (block >= dev->cache_end)
+	nblocks = 1;
+    else if (nblocks > dev->cache_end - block)
+	nblocks = dev->cache_end - block;
+
+    for (n = 1; n < nblocks; n++) {
+	if (cache_has_block(dev, block + n))
+	    break;
+    }
+
+    if (n < 2) {
+	getoneblk(disk, cs->data, block, dev->cache_block_size);
+	cache_hash_insert(dev, cs, block);
+	return;
+    }
+
+    /* On error, the sectors before the failing one are still good */
+    rv = disk->rdwr_sectors(disk, dev->cache_ra_buf, block * sec_per_block,
+			    n * sec_per_block, 0);
+    got = rv > 0 ? rv / sec_per_block : 0;
+    if (!got) {
+	getoneblk(disk, cs->data, block, dev->cache_block_size);
+	cache_hash_insert(dev, cs, block);
+	return;
+    }
+
+    dev->cache_stats.ra_reads++;
+    dev->cache_stats.ra_blocks += got - 1;
+
+    p = dev->cache_ra_buf;
+    memcpy(cs->data, p, dev->cache_block_size);
+    cache_hash_insert(dev, cs, block);
+
+    for (n = 1; n < got; n++) {
+	p += dev->cache_block_size;
+	cs = _get_cache_block(dev, block + n);
+	memcpy(cs->data, p, dev->cache_block_size);
+	cache_hash_insert(dev, cs, block + n);
+	cs->flags |= CACHE_PREFETCHED;
+    }
+}
+
+/*
+ * Look up BLOCK, loading it on a miss.  NBLOCKS is the number of
+ * consecutive blocks the caller knows it is going to want; a miss
+ * right after the previous miss is treated as a sequential scan and
+ * reads ahead as far as the read-ahead window allows.
+ */
+static const void *get_cache_run(struct device *dev, block_t block,
+				 uint32_t nblocks)
 {
     struct cache *cs;
 
     cs = _get_cache_block(dev, block);
-    if (cs->block != block) {
-	cs->block = block;
-        getoneblk(dev->disk, cs->data, block, dev->cache_block_size);
+    if (cs->block == block) {
+	dev->cache_stats.hits++;
+	if (cs->flags & CACHE_PREFETCHED) {
+	    dev->cache_stats.ra_hits++;
+	    cs->flags &= ~CACHE_PREFETCHED;
+	}
+	return cs->data;
     }
 
+    dev->cache_stats.misses++;
+    if (block == dev->cache_last_miss + 1)
+	nblocks = dev->cache_ra_max;
+    dev->cache_last_miss = block;
+
+    cache_fill(dev, cs, block, nblocks);
+
     return cs->data;
 }
 
+/*
+ * Check for a particular BLOCK in the block cache, 
+ * and if it is already there, just do nothing and return;
+ * otherwise load it from disk and update the LRU link.
+ * Return the data pointer.
+ */
+const void *get_cache(struct device *dev, block_t block)
+{
+    return get_cache_run(dev, block, 1);
+}
+
 /*
  * Read data from the cache at an arbitrary byte offset and length.
  * This is useful for filesystems whose metadata is not necessarily
  * aligned with their blocks.
  *
- * This is still reading linearly on the disk.
+ * Blocks missing from the cache are fetched in as few disk requests
+ * as the read-ahead window allows.
  */
 size_t cache_read(struct fs_info *fs, void *buf, uint64_t offset, size_t count)
 {
     const char *cd;
     char *p = buf;
     size_t off, cnt, total;
-    block_t block;
+    block_t block, last;
+
+    if (!count)
+	return 0;
 
     total = count;
+    last = (offset + count - 1) >> fs->block_shift;
     while (count) {
 	block = offset >> fs->block_shift;
 	off = offset & (fs->block_size - 1);
-	cd = get_cache(fs->fs_dev, block);
+	cd = get_cache_run(fs->fs_dev, block, last - block + 1);
 	if (!cd)
 	    break;
 	cnt = fs->block_size - off;
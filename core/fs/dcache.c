@@ -0,0 +1,173 @@
+/*
+ * core/fs/dcache.c: A small cache of path lookups for searchdir().
+ *
+ * Entries are keyed by (parent inode, name).  A positive entry holds a
+ * reference to a directory inode, which in turn keeps its whole parent
+ * chain alive; a negative entry records that the name does not exist
+ * and holds a reference to the parent instead.  Either way the parent
+ * pointer in the key can never dangle.
+ *
+ * Negative entries are only made when iget reports ENOENT, so running
+ * out of memory or failing to read a directory isn't remembered, and
+ * at most DCACHE_NEG_ENTRIES of them are kept.
+ *
+ * Only directories are cached positively: several filesystems keep
+ * per-open read state in the inode, so a file inode must not be shared
+ * between two opens.  Cached directories are likewise only used to walk
+ * through, never handed back as the result of the lookup.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dprintf.h>
+#include <linux/list.h>
+#include "core.h"
+#include "fs.h"
+
+#define DCACHE_ENTRIES		64
+#define DCACHE_NEG_ENTRIES	16
+#define DCACHE_HASH_SHIFT	5
+#define DCACHE_HASH_SIZE	(1 << DCACHE_HASH_SHIFT)
+
+struct dentry {
+    struct dentry *hnext;	/* Hash chain */
+    struct list_head lru;	/* Most recently used first */
+    struct inode *parent;
+    struct inode *inode;	/* NULL for a negative entry */
+    uint32_t hash;
+    char name[];
+};
+
+struct dcache_stats dcache_stats;
+
+static struct dentry *dcache_hash[DCACHE_HASH_SIZE];
+static LIST_HEAD(dcache_lru);
+static int dcache_count, dcache_neg_count;
+
+static uint32_t dcache_hashfn(const struct inode *parent, const char *name)
+{
+    uint32_t h = (uint32_t)(uintptr_t)parent;
+
+    while (*name)
+	h = h * 31 + (unsigned char)*name++;
+
+    return h;
+}
+
+static inline struct dentry **dcache_bucket(uint32_t hash)
+{
+    return &dcache_hash[(hash * 0x9e370001U) >> (32 - DCACHE_HASH_SHIFT)];
+}
+
+static struct dentry *dcache_find(struct inode *parent, const char *name,
+				  uint32_t hash)
+{
+    struct dentry *de;
+
+    for (de = *dcache_bucket(hash); de; de = de->hnext) {
+	if (de->hash == hash && de->parent == parent &&
+	    !strcmp(de->name, name))
+	    return de;
+    }
+
+    return NULL;
+}
+
+static void dcache_evict(struct dentry *de)
+{
+    struct dentry **pp;
+
+    for (pp = dcache_bucket(de->hash); *pp != de; pp = &(*pp)->hnext)
+	;
+    *pp = de->hnext;
+    list_del(&de->lru);
+    dcache_count--;
+    if (!de->inode)
+	dcache_neg_count--;
+
+    put_inode(de->inode ? de->inode : de->parent);
+    free(de);
+}
+
+/*
+ * Look NAME up in PARENT.  Returns true if the cache knows the answer,
+ * in which case *childp is either the cached directory (no reference
+ * is taken) or NULL if the name is known not to exist.  A directory is
+ * only returned when DIR is set, i.e. the path continues below it.
+ */
+bool dcache_lookup(struct inode *parent, const char *name, bool dir,
+		   struct inode **childp)
+{
+    struct dentry *de;
+
+    de = dcache_find(parent, name, dcache_hashfn(parent, name));
+    if (!de || (de->inode && !dir)) {
+	dcache_stats.misses++;
+	return false;
+    }
+
+    list_move(&de->lru, &dcache_lru);
+    if (de->inode)
+	dcache_stats.hits++;
+    else
+	dcache_stats.neg_hits++;
+
+    *childp = de->inode;
+    return true;
+}
+
+/*
+ * Remember the result of looking NAME up in PARENT; CHILD is the inode
+ * that iget returned, or NULL if the name doesn't exist.  CHILD->parent
+ * must already be set up.
+ */
+void dcache_add(struct inode *parent, const char *name, struct inode *child)
+{
+    struct dentry *de, **bucket;
+    uint32_t hash;
+    size_t len;
+
+    if (child && child->mode != DT_DIR)
+	return;
+
+    hash = dcache_hashfn(parent, name);
+    de = dcache_find(parent, name, hash);
+    if (de) {
+	list_move(&de->lru, &dcache_lru);
+	return;
+    }
+
+    if (!child && dcache_neg_count >= DCACHE_NEG_ENTRIES) {
+	/* Replace the least recently used negative entry */
+	list_for_each_entry_reverse(de, &dcache_lru, lru) {
+	    if (!de->inode) {
+		dcache_evict(de);
+		break;
+	    }
+	}
+    } else if (dcache_count >= DCACHE_ENTRIES) {
+	dcache_evict(list_entry(dcache_lru.prev, struct dentry, lru));
+    }
+
+    len = strlen(name) + 1;
+    de = malloc(sizeof *de + len);
+    if (!de)
+	return;			/* Not fatal, just uncached */
+
+    memcpy(de->name, name, len);
+    de->hash = hash;
+    de->parent = parent;
+    de->inode = child;
+    get_inode(child ? child : parent);
+
+    bucket = dcache_bucket(hash);
+    de->hnext = *bucket;
+    *bucket = de;
+    list_add(&de->lru, &dcache_lru);
+    dcache_count++;
+    if (!child)
+	dcache_neg_count++;
+
+    dprintf("dcache: added %s%s\n", name, child ? "" : " (negative)");
+}
@@ -6,10 +6,12 @@
 #include <core.h>
 #include <fs.h>
 #include <disk.h>
+#include <cache.h>
 #include <ilog2.h>
 #include <minmax.h>
 
 #include <syslinux/firmware.h>
+#include <syslinux/memscan.h>
 
 void getoneblk(struct disk *disk, char *buf, block_t block, int block_size)
 {
@@ -18,16 +20,41 @@ void getoneblk(struct disk *disk, char *buf, block_t block, int block_size)
     disk->rdwr_sectors(disk, buf, block * sec_per_block, sec_per_block, 0);
 }
 
+/*
+ * Add up the free memory in the firmware's memory map.  This works the
+ * same on BIOS and EFI, whereas on EFI cs_memsize is only the end of
+ * whichever region the heap setup happened to scan last.
+ */
+static int add_free_memory(void *data, addr_t start, addr_t len,
+			   enum syslinux_memmap_types type)
+{
+    size_t *total = data;
+
+    (void)start;
+
+    if (type == SMT_FREE && len <= ~(size_t)0 - *total)
+	*total += len;
+    return 0;
+}
+
 /*
  * Initialize the device structure.
  */
 struct device * device_init(void *args)
 {
     static struct device dev;
+    size_t memsize = 0;
 
     dev.disk = firmware->disk_init(args);
-    dev.cache_size = 128*1024;
+
+    if (syslinux_scan_memory(add_free_memory, &memsize) || !memsize)
+	memsize = __com32.cs_memsize;
+    dev.cache_size = cache_size_for_memory(memsize);
     dev.cache_data = malloc(dev.cache_size);
+    if (!dev.cache_data && dev.cache_size > CACHE_MIN_SIZE) {
+	dev.cache_size = CACHE_MIN_SIZE;
+	dev.cache_data = malloc(dev.cache_size);
+    }
     dev.cache_init = 0; /* Explicitly set cache as uninitialized */
 
     return &dev;
@@ -2,9 +2,19 @@
 #include <com32.h>
 #include <fs.h>
 #include <ilog2.h>
+#include <minmax.h>
+#include <syslinux/adv.h>
+#include <syslinux/firmware.h>
 
 #define RETRY_COUNT 6
 
+/*
+ * Number of error-free transfers before we try a bigger maxtransfer
+ * again.  Doubled every time such an attempt fails.
+ */
+#define XFER_GROW_AFTER	64
+#define XFER_BACKOFF_MAX 0x10000
+
 static inline sector_t chs_max(const struct disk *disk)
 {
     return (sector_t)disk->secpercyl << 10;
@@ -15,8 +25,12 @@ struct edd_rdwr_packet {
     uint16_t blocks;
     far_ptr_t buf;
     uint64_t lba;
+    uint64_t flatbuf;		/* EDD 3.0, used if buf == FFFF:FFFF */
 };
 
+/* Size of the packet without the EDD 3.0 extension */
+#define EDD_PACKET_SIZE_V1	16
+
 struct edd_disk_params {
     uint16_t  len;
     uint16_t  flags;
@@ -42,6 +56,119 @@ static inline bool is_power_of_2(uint32_t x)
     return !(x & (x-1));
 }
 
+/*
+ * A transfer of CHUNK sectors went through.  If we were trying out a
+ * larger maxtransfer, it evidently works; otherwise, after enough good
+ * transfers, try doubling maxtransfer.  Returns the new maxtransfer.
+ */
+static unsigned int xfer_ok(struct disk *disk, size_t chunk)
+{
+    struct bios_disk_private *priv = disk->private;
+
+    if (priv->xfer_safe && chunk > priv->xfer_safe) {
+	priv->xfer_safe = 0;
+	priv->xfer_backoff = XFER_GROW_AFTER;
+    }
+
+    if (!priv->xfer_safe && disk->maxtransfer < priv->hard_maxtransfer &&
+	++priv->xfer_good >= priv->xfer_backoff) {
+	priv->xfer_good = 0;
+	priv->xfer_safe = disk->maxtransfer;
+	disk->maxtransfer = min(disk->maxtransfer << 1,
+				priv->hard_maxtransfer);
+	dprintf("disk: trying maxtransfer %u\n", disk->maxtransfer);
+    }
+
+    return disk->maxtransfer;
+}
+
+/*
+ * A transfer of *CHUNK sectors failed.  If that was more than the
+ * last size known to work, don't bother retrying: go back to the good
+ * size and wait longer before trying again.
+ */
+static bool xfer_probe_failed(struct disk *disk, size_t *chunk)
+{
+    struct bios_disk_private *priv = disk->private;
+
+    priv->xfer_good = 0;
+
+    if (!priv->xfer_safe || *chunk <= priv->xfer_safe)
+	return false;
+
+    *chunk = disk->maxtransfer = priv->xfer_safe;
+    priv->xfer_safe = 0;
+    if (priv->xfer_backoff < XFER_BACKOFF_MAX)
+	priv->xfer_backoff <<= 1;
+
+    dprintf("disk: maxtransfer back to %u\n", disk->maxtransfer);
+    return true;
+}
+
+/*
+ * Find this disk's ADV_MAXXFER entry.  If there is none and CREATE is
+ * set, add one at the end of the ADV, if there is room.
+ */
+static uint8_t *adv_maxxfer_slot(const struct disk *disk, bool create)
+{
+    uint8_t *p = syslinux_adv_ptr();
+    size_t left = syslinux_adv_size();
+
+    while (left >= 2) {
+	uint8_t tag = p[0];
+	size_t len = p[1] + 2;
+
+	if (tag == ADV_END)
+	    break;
+	if (len > left)
+	    return NULL;	/* Corrupt ADV, leave it alone */
+	if (tag == ADV_MAXXFER && len == 4 && p[2] == disk->disk_number)
+	    return p;
+	p += len;
+	left -= len;
+    }
+
+    if (!create || left < 4)
+	return NULL;
+
+    p[0] = ADV_MAXXFER;
+    p[1] = 2;
+    p[2] = disk->disk_number;
+    p[3] = 0;
+    if (left > 4)
+	p[4] = ADV_END;
+    return p;
+}
+
+/*
+ * Once a transfer has settled on a different maxtransfer than the ADV
+ * has for this disk, store the new value, so that later boots start
+ * out with a size this BIOS can handle instead of running into the
+ * errors again.  That happens when errors forced it down, or when a
+ * larger size was tried out and worked.
+ */
+static void xfer_remember(struct disk *disk)
+{
+    struct bios_disk_private *priv = disk->private;
+    uint8_t *slot;
+
+    if (!priv->adv_maxtransfer || priv->xfer_safe ||
+	disk->maxtransfer == priv->adv_maxtransfer)
+	return;		/* No ADV yet, still trying a size, or no news */
+
+    priv->adv_maxtransfer = disk->maxtransfer;
+
+    slot = adv_maxxfer_slot(disk,
+			    disk->maxtransfer < priv->hard_maxtransfer);
+    if (!slot)
+	return;
+
+    printf("Disk %02x: saving maxtransfer %u in the ADV\n",
+	   disk->disk_number, disk->maxtransfer);
+    slot[3] = disk->maxtransfer;
+    firmware->adv_ops->write();
+}
+
 static int chs_rdwr_sectors(struct disk *disk, void *buf,
 			    sector_t lba, size_t count, bool is_write)
 {
@@ -120,6 +247,13 @@ static int chs_rdwr_sectors(struct disk *disk, void *buf,
 
 		dprintf("CHS: error AX = %04x\n", oreg.eax.w[0]);
 
+		if (xfer_probe_failed(disk, &chunk)) {
+		    maxtransfer = chunk;
+		    retry = RETRY_COUNT;
+		    ireg.eax.b[0] = chunk;
+		    continue;
+		}
+
 		if (retry--)
 		    continue;
 
@@ -150,6 +284,7 @@ static int chs_rdwr_sectors(struct disk *disk, void *buf,
 
 	/* If we dropped maxtransfer, it eventually worked, so remember it */
 	disk->maxtransfer = maxtransfer;
+	maxtransfer = xfer_ok(disk, chunk);
 
 	ptr   += bytes;
 	xlba  += chunk;
@@ -157,13 +292,75 @@ static int chs_rdwr_sectors(struct disk *disk, void *buf,
 	done  += chunk;
     }
 
+    xfer_remember(disk);
     return done;
 }
 
+/*
+ * Plenty of BIOSes report EDD 3.0 but ignore the flat buffer address,
+ * not all of them by setting CF: some transfer to FFFF:FFFF instead.
+ * Before the first flat transfer, read the first sector of the
+ * partition both through the bounce buffer and flat into high memory,
+ * and only trust flat addressing if the two agree.
+ *
+ * The flat buffer and FFFF:FFFF (0x10ffef) both lie in a window which
+ * the linker script keeps clear, so a broken BIOS can't hit anything.
+ */
+extern char __edd_probe_start[], __edd_probe_end[];
+
+static bool edd_check_flat(struct disk *disk)
+{
+    static __lowmem struct edd_rdwr_packet pkt;
+    char * const high = __edd_probe_start;
+    char * const wrap = (char *)0x10ffef;	/* FFFF:FFFF */
+    size_t bytes = disk->sector_size;
+    com32sys_t ireg, oreg;
+    bool ok = false;
+    size_t i;
+
+    if (high + bytes > wrap || wrap + bytes > __edd_probe_end)
+	goto out;		/* Sectors too big for the probe window */
+
+    memset(&ireg, 0, sizeof ireg);
+
+    ireg.eax.b[1] = 0x42;
+    ireg.edx.b[0] = disk->disk_number;
+    ireg.ds       = SEG(&pkt);
+    ireg.esi.w[0] = OFFS(&pkt);
+
+    pkt.size   = EDD_PACKET_SIZE_V1;
+    pkt.blocks = 1;
+    pkt.lba    = disk->part_start;
+    pkt.buf    = FAR_PTR(core_xfer_buf);
+
+    __intcall(0x13, &ireg, &oreg);
+    if (oreg.eflags.l & EFLAGS_CF)
+	goto out;
+
+    /* Make sure stale memory can't pass for a successful read */
+    for (i = 0; i < bytes; i++)
+	high[i] = ~core_xfer_buf[i];
+
+    pkt.size    = sizeof pkt;
+    pkt.blocks  = 1;
+    pkt.lba     = disk->part_start;
+    pkt.buf.ptr = 0xffffffff;
+    pkt.flatbuf = (size_t)high;
+
+    __intcall(0x13, &ireg, &oreg);
+    ok = !(oreg.eflags.l & EFLAGS_CF) && !memcmp(high, core_xfer_buf, bytes);
+
+out:
+    dprintf("EDD[%02x]: flat addressing %s\n", disk->disk_number,
+	    ok ? "works" : "disabled");
+    return ok;
+}
+
 static int edd_rdwr_sectors(struct disk *disk, void *buf,
 			    sector_t lba, size_t count, bool is_write)
 {
     static __lowmem struct edd_rdwr_packet pkt;
+    struct bios_disk_private *priv = disk->private;
     char *ptr = buf;
     char *tptr;
     size_t chunk, freeseg;
@@ -172,6 +369,7 @@ static int edd_rdwr_sectors(struct disk *disk, void *buf,
     size_t done = 0;
     size_t bytes;
     int retry;
+    bool flat;
     uint32_t maxtransfer = disk->maxtransfer;
 
     memset(&ireg, 0, sizeof ireg);
@@ -190,10 +388,21 @@ static int edd_rdwr_sectors(struct disk *disk, void *buf,
 	    chunk = maxtransfer;
 
 	freeseg = (0x10000 - ((size_t)ptr & 0xffff)) >> sector_shift;
+	flat = false;
+
+	if (priv->edd_flat && !priv->edd_flat_checked) {
+	    priv->edd_flat_checked = true;
+	    priv->edd_flat = edd_check_flat(disk);
+	}
 
 	if ((size_t)ptr <= 0xf0000 && freeseg) {
 	    /* Can do a direct load */
 	    tptr = ptr;
+	} else if (priv->edd_flat) {
+	    /* EDD 3.0: let the BIOS address the buffer directly */
+	    tptr = ptr;
+	    flat = true;
+	    freeseg = chunk;
 	} else {
 	    /* Either accessing high memory or we're crossing a 64K line */
 	    tptr = core_xfer_buf;
@@ -210,10 +419,16 @@ static int edd_rdwr_sectors(struct disk *disk, void *buf,
 	retry = RETRY_COUNT;
 
 	for (;;) {
-	    pkt.size   = sizeof pkt;
 	    pkt.blocks = chunk;
-	    pkt.buf    = FAR_PTR(tptr);
 	    pkt.lba    = lba;
+	    if (flat) {
+		pkt.size    = sizeof pkt;
+		pkt.buf.ptr = 0xffffffff;
+		pkt.flatbuf = (size_t)tptr;
+	    } else {
+		pkt.size    = EDD_PACKET_SIZE_V1;
+		pkt.buf     = FAR_PTR(tptr);
+	    }
 
 	    dprintf("EDD[%02x]: %u @ %llu %04x:%04x %s %p\n",
 		    ireg.edx.b[0], pkt.blocks, pkt.lba,
@@ -227,6 +442,21 @@ static int edd_rdwr_sectors(struct disk *disk, void *buf,
 
 	    dprintf("EDD: error AX = %04x\n", oreg.eax.w[0]);
 
+	    if (flat) {
+		/*
+		 * edd_check_flat() passed, but the BIOS refuses this one;
+		 * go back to the bounce buffer for good.
+		 */
+		priv->edd_flat = false;
+		break;
+	    }
+
+	    if (xfer_probe_failed(disk, &chunk)) {
+		maxtransfer = chunk;
+		retry = RETRY_COUNT;
+		continue;
+	    }
+
 	    if (retry--)
 		continue;
 
@@ -269,6 +499,9 @@ static int edd_rdwr_sectors(struct disk *disk, void *buf,
 	    return done;	/* Failure */
 	}
 
+	if (flat && !priv->edd_flat)
+	    continue;		/* Redo this chunk through the bounce buffer */
+
 	bytes = chunk << sector_shift;
 
 	if (tptr != ptr && !is_write)
@@ -276,12 +509,15 @@ static int edd_rdwr_sectors(struct disk *disk, void *buf,
 
 	/* If we dropped maxtransfer, it eventually worked, so remember it */
 	disk->maxtransfer = maxtransfer;
+	maxtransfer = xfer_ok(disk, chunk);
 
 	ptr   += bytes;
 	lba   += chunk;
 	count -= chunk;
 	done  += chunk;
     }
+
+    xfer_remember(disk);
     return done;
 }
 
@@ -348,6 +584,9 @@ struct disk *bios_disk_init(void *private)
 	    ebios = true;
 	    hard_max_transfer = 127;
 
+	    /* EDD 3.0 and later can take a 64-bit flat buffer address */
+	    priv->edd_flat = oreg.eax.b[1] >= 0x30;
+
 	    /* Query EBIOS parameters */
 	    /* The memset() is needed once this function can be called
 	       more than once */
@@ -369,6 +608,7 @@ struct disk *bios_disk_init(void *private)
 		if (edd_params.sector_size >= 512 &&
 		    is_power_of_2(edd_params.sector_size))
 		    sector_size = edd_params.sector_size;
+		disk.sectors = edd_params.sectors;
 	    }
 	}
 
@@ -386,6 +626,9 @@ struct disk *bios_disk_init(void *private)
 
     disk.maxtransfer   = MaxTransfer;
 
+    priv->hard_maxtransfer = MaxTransfer;
+    priv->xfer_backoff = XFER_GROW_AFTER;
+
     dprintf("disk %02x cdrom %d type %d sector %u/%u offset %llu limit %u\n",
 	    devno, cdrom, ebios, sector_size, disk.sector_shift,
 	    part_start, disk.maxtransfer);
@@ -394,6 +637,36 @@ struct disk *bios_disk_init(void *private)
     return &disk;
 }
 
+/*
+ * Start out with the maxtransfer stored in the ADV, if it is lower
+ * than the boot sector's.  Called once the ADV has been read; nothing
+ * is written here.
+ */
+void bios_disk_adv_init(void)
+{
+    struct disk *disk;
+    struct bios_disk_private *priv;
+    uint8_t *slot;
+    unsigned int stored;
+
+    if (!this_fs || !this_fs->fs_dev)
+	return;			/* Not a disk boot */
+
+    disk = this_fs->fs_dev->disk;
+    priv = disk->private;
+
+    slot = adv_maxxfer_slot(disk, false);
+    stored = priv->hard_maxtransfer;
+    if (slot && slot[3] && slot[3] < stored)
+	stored = slot[3];
+
+    if (stored < disk->maxtransfer)
+	disk->maxtransfer = stored;
+
+    /* Anything lower than this was found out during this boot */
+    priv->adv_maxtransfer = stored;
+}
+
 void pm_fs_init(com32sys_t *regs)
 {
 	static struct bios_disk_private priv;
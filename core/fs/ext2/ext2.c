@@ -89,6 +89,145 @@ ext2_get_cache(struct inode *inode, block_t lblock)
     return get_cache(inode->fs->fs_dev, pblock);
 }
 
+/*
+ * Search one directory block for a name
+ */
+static const struct ext2_dir_entry *
+ext2_find_in_block(struct fs_info *fs, const char *data,
+		   const char *dname, size_t dname_len)
+{
+    uint32_t offset = 0, maxoffset = BLOCK_SIZE(fs);
+    const struct ext2_dir_entry *de;
+
+    /* The smallest possible size is 9 bytes */
+    while (offset < maxoffset-8) {
+	de = (const struct ext2_dir_entry *)(data + offset);
+	if (de->d_rec_len > maxoffset - offset)
+	    break;
+
+	if (ext2_match_entry(dname, dname_len, de))
+	    return de;
+
+	offset += de->d_rec_len;
+    }
+
+    return NULL;
+}
+
+/*
+ * Binary search an index block for the last entry with hash <= hash.
+ * Returns its position, or -1 if the block doesn't look like an index.
+ */
+static int ext2_dx_search(struct fs_info *fs, const char *data,
+			  uint32_t eoff, uint32_t hash, uint32_t *countp)
+{
+    const struct ext2_dx_countlimit *cl =
+	(const struct ext2_dx_countlimit *)(data + eoff);
+    const struct ext2_dx_entry *entries =
+	(const struct ext2_dx_entry *)(data + eoff);
+    int lo, hi, mid;
+
+    if (!cl->count || cl->count > cl->limit ||
+	cl->limit > (BLOCK_SIZE(fs) - eoff) / sizeof *entries)
+	return -1;
+
+    /* entries[0] has no hash; it covers everything below entries[1] */
+    lo = 1;
+    hi = cl->count - 1;
+    while (lo <= hi) {
+	mid = (lo + hi) / 2;
+	if (entries[mid].hash > hash)
+	    hi = mid - 1;
+	else
+	    lo = mid + 1;
+    }
+
+    *countp = cl->count;
+    return lo - 1;
+}
+
+/*
+ * Look a name up through the htree index of a directory, reading only
+ * the root, the interior nodes and the leaf it hashes to.  Returns 0
+ * with *dep set (NULL if the name isn't there), or -1 if the index is
+ * unusable and the directory has to be scanned linearly.
+ */
+static int ext2_dx_find_entry(struct fs_info *fs, struct inode *inode,
+			      const char *dname, size_t dname_len,
+			      const struct ext2_dir_entry **dep)
+{
+    const struct ext2_sb_info *sbi = EXT2_SB(fs);
+    const struct ext2_dx_root_info *info;
+    const struct ext2_dx_entry *entries;
+    const char *data;
+    block_t node = 0, block;
+    uint32_t eoff, hash, count, next_hash;
+    bool have_next = false;
+    int levels, version, at;
+
+    data = ext2_get_cache(inode, 0);
+    info = (const struct ext2_dx_root_info *)(data + EXT2_DX_ROOT_INFO);
+    if (info->reserved_zero || info->info_length < sizeof *info ||
+	info->indirect_levels >= EXT2_DX_MAX_LEVELS)
+	return -1;
+
+    version = info->hash_version;
+    if (version <= EXT2_DX_HASH_TEA)
+	version += sbi->s_hash_unsigned;
+    if (ext2_dirhash(dname, dname_len, version, sbi->s_hash_seed, &hash))
+	return -1;
+
+    levels = info->indirect_levels;
+    eoff = EXT2_DX_ROOT_INFO + info->info_length;
+
+    /* Walk down the index */
+    for (;;) {
+	at = ext2_dx_search(fs, data, eoff, hash, &count);
+	if (at < 0)
+	    return -1;
+
+	entries = (const struct ext2_dx_entry *)(data + eoff);
+	block = entries[at].block & EXT2_DX_BLOCK_MASK;
+	if (at + 1 < (int)count) {
+	    next_hash = entries[at + 1].hash;
+	    have_next = true;
+	}
+
+	if (!levels--)
+	    break;
+
+	node = block;
+	eoff = EXT2_DX_NODE_ENTRIES;
+	data = ext2_get_cache(inode, node);
+    }
+
+    /*
+     * Search the leaf.  Names with the same hash may spill over into
+     * the following leaves, which the index marks by setting the low
+     * bit of their hash.
+     */
+    for (;;) {
+	data = ext2_get_cache(inode, block);
+	*dep = ext2_find_in_block(fs, data, dname, dname_len);
+	if (*dep)
+	    return 0;
+
+	if (!have_next || (next_hash & ~1) != hash)
+	    return 0;		/* Not there */
+	if (at + 1 >= (int)count)
+	    return -1;		/* Continues in the next index node */
+
+	/* Get the following entry from the lowest index node */
+	data = ext2_get_cache(inode, node);
+	entries = (const struct ext2_dx_entry *)(data + eoff);
+	at++;
+	block = entries[at].block & EXT2_DX_BLOCK_MASK;
+	have_next = at + 1 < (int)count;
+	if (have_next)
+	    next_hash = entries[at + 1].hash;
+    }
+}
+
 /*
  * find a dir entry, return it if found, or return NULL.
  */
@@ -96,27 +235,20 @@ static const struct ext2_dir_entry *
 ext2_find_entry(struct fs_info *fs, struct inode *inode, const char *dname)
 {
     block_t index = 0;
-    uint32_t i = 0, offset, maxoffset;
+    uint32_t i = 0;
     const struct ext2_dir_entry *de;
     const char *data;
     size_t dname_len = strlen(dname);
 
+    if (EXT2_SB(fs)->s_dir_index && (inode->flags & EXT2_INDEX_FL) &&
+	!ext2_dx_find_entry(fs, inode, dname, dname_len, &de))
+	return de;
+
     while (i < inode->size) {
 	data = ext2_get_cache(inode, index++);
-	offset = 0;
-	maxoffset =  min(BLOCK_SIZE(fs), i-inode->size);
-
-	/* The smallest possible size is 9 bytes */
-	while (offset < maxoffset-8) {
-	    de = (const struct ext2_dir_entry *)(data + offset);
-	    if (de->d_rec_len > maxoffset - offset)
-		break;
-
-	    if (ext2_match_entry(dname, dname_len, de))
-		return de;
-
-	    offset += de->d_rec_len;
-	}
+	de = ext2_find_in_block(fs, data, dname, dname_len);
+	if (de)
+	    return de;
 	i += BLOCK_SIZE(fs);
     }
 
@@ -189,8 +321,10 @@ static struct inode *ext2_iget(const char *dname, struct inode *parent)
     struct fs_info *fs = parent->fs;
 
     de = ext2_find_entry(fs, parent, dname);
-    if (!de)
+    if (!de) {
+	errno = ENOENT;
 	return NULL;
+    }
     
     return ext2_iget_by_inr(fs, de->d_inode);
 }
@@ -317,6 +451,11 @@ static int ext2_fs_init(struct fs_info *fs)
     sbi->s_first_data_block = sb.s_first_data_block;
     sbi->s_inode_size = sb.s_inode_size;
 
+    /* htree directory index */
+    sbi->s_dir_index = !!(sb.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX);
+    sbi->s_hash_unsigned = (sb.s_flags & EXT2_FLAGS_UNSIGNED_HASH) ? 3 : 0;
+    memcpy(sbi->s_hash_seed, sb.s_hash_seed, sizeof(sbi->s_hash_seed));
+
     /* Volume UUID */
     memcpy(sbi->s_uuid, sb.s_uuid, sizeof(sbi->s_uuid));
 
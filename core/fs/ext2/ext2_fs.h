@@ -1,6 +1,7 @@
 #ifndef __EXT2_FS_H
 #define __EXT2_FS_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #define	EXT2_SUPER_MAGIC	0xEF53
@@ -25,6 +26,15 @@
 #define EXT2_FEATURE_INCOMPAT_META_BG		0x0010
 #define EXT2_FEATURE_INCOMPAT_ANY		0xffffffff
 
+// ...but an htree index makes lookups in big directories cheaper.
+#define EXT2_FEATURE_COMPAT_DIR_INDEX		0x0020
+
+#define EXT2_INDEX_FL		0x00001000	// Hash-indexed directory
+
+// s_flags
+#define EXT2_FLAGS_SIGNED_HASH		0x0001
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+
 #define EXT2_NDIR_BLOCKS	12
 #define	EXT2_IND_BLOCK		EXT2_NDIR_BLOCKS
 #define EXT2_DIND_BLOCK		(EXT2_IND_BLOCK+1)
@@ -214,6 +224,43 @@ struct ext2_dir_entry {
     char	d_name[EXT2_NAME_LEN];	        /* File name */
 };
 
+/*
+ * htree directory index; the root lives in block 0 of the directory,
+ * behind fake "." and ".." entries, and interior nodes behind one fake
+ * entry covering the whole block.
+ */
+#define EXT2_DX_HASH_LEGACY		0
+#define EXT2_DX_HASH_HALF_MD4		1
+#define EXT2_DX_HASH_TEA		2
+#define EXT2_DX_HASH_LEGACY_UNSIGNED	3
+#define EXT2_DX_HASH_HALF_MD4_UNSIGNED	4
+#define EXT2_DX_HASH_TEA_UNSIGNED	5
+
+#define EXT2_HTREE_EOF		0x7fffffffU
+#define EXT2_DX_MAX_LEVELS	3	/* With the ext4 largedir feature */
+#define EXT2_DX_ROOT_INFO	24	/* Offset of ext2_dx_root_info */
+#define EXT2_DX_NODE_ENTRIES	8	/* Offset of entries in a node */
+#define EXT2_DX_BLOCK_MASK	0x0fffffff
+
+struct ext2_dx_root_info {
+    uint32_t reserved_zero;
+    uint8_t  hash_version;
+    uint8_t  info_length;	/* 8 */
+    uint8_t  indirect_levels;
+    uint8_t  unused_flags;
+};
+
+struct ext2_dx_entry {
+    uint32_t hash;
+    uint32_t block;
+};
+
+/* Overlays the hash of the first ext2_dx_entry, which is implicitly 0 */
+struct ext2_dx_countlimit {
+    uint16_t limit;
+    uint16_t count;
+};
+
 /*******************************************************************************
 #define EXT2_DIR_PAD	 4
 #define EXT2_DIR_ROUND	(EXT2_DIR_PAD - 1)
@@ -279,6 +326,9 @@ struct ext2_sb_info {
     int      s_inode_size;
     uint8_t  s_uuid[16];	/* 128-bit uuid for volume */
     int      s_desc_size;	/* size of group descriptor */
+    bool     s_dir_index;	/* htree lookups enabled */
+    uint8_t  s_hash_unsigned;	/* 3 if hash should be unsigned, else 0 */
+    uint32_t s_hash_seed[4];	/* HTREE hash seed */
 };
 
 static inline struct ext2_sb_info *EXT2_SB(struct fs_info *fs)
@@ -308,5 +358,6 @@ struct ext2_pvt_inode {
  */
 block_t ext2_bmap(struct inode *, block_t, size_t *);
 int ext2_next_extent(struct inode *, uint32_t);
+int ext2_dirhash(const char *, int, int, const uint32_t *, uint32_t *);
 
 #endif /* ext2_fs.h */
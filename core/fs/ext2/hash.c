@@ -0,0 +1,199 @@
+/*
+ * ext2/hash.c
+ *
+ * The htree directory hashes, as in linux/fs/ext4/hash.c:
+ * Copyright (C) 2002 by Theodore Ts'o
+ *
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <fs.h>
+#include "ext2_fs.h"
+
+#define DELTA 0x9E3779B9
+
+static void TEA_transform(uint32_t buf[4], const uint32_t in[4])
+{
+    uint32_t sum = 0;
+    uint32_t b0 = buf[0], b1 = buf[1];
+    uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+    int n = 16;
+
+    do {
+	sum += DELTA;
+	b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+	b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    } while (--n);
+
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+/* F, G and H are basic MD4 functions: selection, majority, parity */
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+
+#define ROUND(f, a, b, c, d, x, s) \
+    (a += f(b, c, d) + x, a = (a << s) | (a >> (32 - s)))
+#define K1 0
+#define K2 013240474631UL
+#define K3 015666365641UL
+
+static void half_md4_transform(uint32_t buf[4], const uint32_t in[8])
+{
+    uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    /* Round 1 */
+    ROUND(F, a, b, c, d, in[0] + K1,  3);
+    ROUND(F, d, a, b, c, in[1] + K1,  7);
+    ROUND(F, c, d, a, b, in[2] + K1, 11);
+    ROUND(F, b, c, d, a, in[3] + K1, 19);
+    ROUND(F, a, b, c, d, in[4] + K1,  3);
+    ROUND(F, d, a, b, c, in[5] + K1,  7);
+    ROUND(F, c, d, a, b, in[6] + K1, 11);
+    ROUND(F, b, c, d, a, in[7] + K1, 19);
+
+    /* Round 2 */
+    ROUND(G, a, b, c, d, in[1] + K2,  3);
+    ROUND(G, d, a, b, c, in[3] + K2,  5);
+    ROUND(G, c, d, a, b, in[5] + K2,  9);
+    ROUND(G, b, c, d, a, in[7] + K2, 13);
+    ROUND(G, a, b, c, d, in[0] + K2,  3);
+    ROUND(G, d, a, b, c, in[2] + K2,  5);
+    ROUND(G, c, d, a, b, in[4] + K2,  9);
+    ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+    /* Round 3 */
+    ROUND(H, a, b, c, d, in[3] + K3,  3);
+    ROUND(H, d, a, b, c, in[7] + K3,  9);
+    ROUND(H, c, d, a, b, in[2] + K3, 11);
+    ROUND(H, b, c, d, a, in[6] + K3, 15);
+    ROUND(H, a, b, c, d, in[1] + K3,  3);
+    ROUND(H, d, a, b, c, in[5] + K3,  9);
+    ROUND(H, c, d, a, b, in[0] + K3, 11);
+    ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+/* The old legacy hash */
+static uint32_t dx_hack_hash(const char *name, int len, bool unsigned_char)
+{
+    uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+    int c;
+
+    while (len--) {
+	c = unsigned_char ? (int)(unsigned char)*name : (int)(signed char)*name;
+	name++;
+	hash = hash1 + (hash0 ^ (c * 7152373));
+
+	if (hash & 0x80000000)
+	    hash -= 0x7fffffff;
+	hash1 = hash0;
+	hash0 = hash;
+    }
+    return hash0 << 1;
+}
+
+static void str2hashbuf(const char *msg, int len, uint32_t *buf, int num,
+			bool unsigned_char)
+{
+    uint32_t pad, val;
+    int i, c;
+
+    pad = (uint32_t)len | ((uint32_t)len << 8);
+    pad |= pad << 16;
+
+    val = pad;
+    if (len > num * 4)
+	len = num * 4;
+    for (i = 0; i < len; i++) {
+	c = unsigned_char ? (int)(unsigned char)msg[i]
+			  : (int)(signed char)msg[i];
+	val = c + (val << 8);
+	if ((i % 4) == 3) {
+	    *buf++ = val;
+	    val = pad;
+	    num--;
+	}
+    }
+    if (--num >= 0)
+	*buf++ = val;
+    while (--num >= 0)
+	*buf++ = pad;
+}
+
+/*
+ * Compute the htree hash of a name.  Returns -1 for unsupported hash
+ * versions.
+ */
+int ext2_dirhash(const char *name, int len, int version,
+		 const uint32_t *seed, uint32_t *hashp)
+{
+    uint32_t hash, in[8], buf[4];
+    bool unsigned_char = false;
+    int i;
+
+    /* The default seed is the MD4 initial state */
+    buf[0] = 0x67452301;
+    buf[1] = 0xefcdab89;
+    buf[2] = 0x98badcfe;
+    buf[3] = 0x10325476;
+
+    for (i = 0; i < 4; i++) {
+	if (seed[i]) {
+	    memcpy(buf, seed, sizeof buf);
+	    break;
+	}
+    }
+
+    switch (version) {
+    case EXT2_DX_HASH_LEGACY_UNSIGNED:
+	unsigned_char = true;
+	/* fall through */
+    case EXT2_DX_HASH_LEGACY:
+	hash = dx_hack_hash(name, len, unsigned_char);
+	break;
+    case EXT2_DX_HASH_HALF_MD4_UNSIGNED:
+	unsigned_char = true;
+	/* fall through */
+    case EXT2_DX_HASH_HALF_MD4:
+	while (len > 0) {
+	    str2hashbuf(name, len, in, 8, unsigned_char);
+	    half_md4_transform(buf, in);
+	    len -= 32;
+	    name += 32;
+	}
+	hash = buf[1];
+	break;
+    case EXT2_DX_HASH_TEA_UNSIGNED:
+	unsigned_char = true;
+	/* fall through */
+    case EXT2_DX_HASH_TEA:
+	while (len > 0) {
+	    str2hashbuf(name, len, in, 4, unsigned_char);
+	    TEA_transform(buf, in);
+	    len -= 16;
+	    name += 16;
+	}
+	hash = buf[0];
+	break;
+    default:
+	return -1;
+    }
+
+    /* The low bit is the collision flag in the index */
+    hash &= ~1;
+    if (hash == (EXT2_HTREE_EOF << 1))
+	hash = (EXT2_HTREE_EOF - 1) << 1;
+
+    *hashp = hash;
+    return 0;
+}
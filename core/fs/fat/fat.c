@@ -8,6 +8,7 @@
 #include <disk.h>
 #include <fs.h>
 #include <ilog2.h>
+#include <minmax.h>
 #include <klibc/compiler.h>
 #include "codepage.h"
 #include "fat_fs.h"
@@ -29,6 +30,43 @@ static const void *get_fat_sector(struct fs_info *fs, sector_t sector)
     return get_cache(fs->fs_dev, FAT_SB(fs)->fat + sector);
 }
 
+/*
+ * Byte offset of the FAT entry for a cluster
+ */
+static inline uint32_t fat_entry_offset(int fat_type, uint32_t clust_num)
+{
+    switch (fat_type) {
+    case FAT12:
+	return clust_num + (clust_num >> 1);
+    case FAT16:
+	return clust_num << 1;
+    default:
+	return clust_num << 2;
+    }
+}
+
+/*
+ * Decode the FAT entry for a cluster, given a pointer to its first byte
+ */
+static inline uint32_t fat_entry(int fat_type, const uint8_t *p,
+				 uint32_t clust_num)
+{
+    uint32_t next_cluster;
+
+    switch (fat_type) {
+    case FAT12:
+	next_cluster = p[0] + (p[1] << 8);
+	if (clust_num & 0x0001)
+	    return next_cluster >> 4;		/* cluster number is ODD */
+	else
+	    return next_cluster & 0x0fff;	/* cluster number is EVEN */
+    case FAT16:
+	return *(const uint16_t *)p;
+    default:
+	return *(const uint32_t *)p & 0x0fffffff;
+    }
+}
+
 static uint32_t get_next_cluster(struct fs_info *fs, uint32_t clust_num)
 {
     uint32_t next_cluster = 0;
@@ -36,8 +74,15 @@ static uint32_t get_next_cluster(struct fs_info *fs, uint32_t clust_num)
     uint32_t offset;
     uint32_t sector_mask = SECTOR_SIZE(fs) - 1;
     const uint8_t *data;
+    const struct fat_sb_info *sbi = FAT_SB(fs);
+
+    if (sbi->fat_copy)
+	return fat_entry(sbi->fat_type,
+			 sbi->fat_copy + fat_entry_offset(sbi->fat_type,
+							  clust_num),
+			 clust_num);
 
-    switch(FAT_SB(fs)->fat_type) {
+    switch(sbi->fat_type) {
     case FAT12:
 	offset = clust_num + (clust_num >> 1);
 	fat_sector = offset >> SECTOR_SHIFT(fs);
@@ -84,59 +129,142 @@ static uint32_t get_next_cluster(struct fs_info *fs, uint32_t clust_num)
     return next_cluster;
 }
 
-static int fat_next_extent(struct inode *inode, uint32_t lstart)
+/*
+ * The FAT sectors most recently read while walking a cluster chain
+ */
+struct fat_window {
+    uint32_t start;		/* First sector, relative to the FAT */
+    uint32_t nsec;
+    uint8_t *buf;
+};
+
+/*
+ * Follow one link of a cluster chain.  FAT16 and FAT32 entries are
+ * read FAT_WINDOW_SECS sectors at a time rather than one sector per
+ * lookup; FAT12 entries can straddle sectors, but a FAT12 FAT is
+ * always small enough to be held in fat_copy anyway.
+ */
+static uint32_t fat_walk_next(struct fs_info *fs, struct fat_window *w,
+			      uint32_t clust_num)
+{
+    struct fat_sb_info *sbi = FAT_SB(fs);
+    struct disk *disk = fs->fs_dev->disk;
+    uint32_t offset, sector;
+
+    if (sbi->fat_copy || !w->buf || sbi->fat_type == FAT12)
+	return get_next_cluster(fs, clust_num);
+
+    offset = fat_entry_offset(sbi->fat_type, clust_num);
+    sector = offset >> SECTOR_SHIFT(fs);
+    if (sector >= sbi->fat_secs)
+	return 0;		/* Not a valid cluster */
+
+    if (sector - w->start >= w->nsec) {
+	w->start = sector;
+	w->nsec = min(sbi->fat_secs - sector, FAT_WINDOW_SECS);
+	if (disk->rdwr_sectors(disk, w->buf, sbi->fat + sector,
+			       w->nsec, 0) != w->nsec) {
+	    /* Don't try again for the rest of this walk */
+	    free(w->buf);
+	    w->buf = NULL;
+	    return get_next_cluster(fs, clust_num);
+	}
+    }
+
+    offset -= w->start << SECTOR_SHIFT(fs);
+    return fat_entry(sbi->fat_type, w->buf + offset, clust_num);
+}
+
+/*
+ * Walk the whole cluster chain of a file once, recording it as runs
+ * of contiguous clusters.  A chain which ends early truncates the file.
+ */
+static int fat_load_extents(struct inode *inode)
 {
     struct fs_info *fs = inode->fs;
     struct fat_sb_info *sbi = FAT_SB(fs);
-    uint32_t mcluster = lstart >> sbi->clust_shift;
-    uint32_t lcluster;
-    uint32_t pcluster;
-    uint32_t tcluster;
-    uint32_t xcluster;
     const uint32_t cluster_bytes = UINT32_C(1) << sbi->clust_byte_shift;
-    const uint32_t cluster_secs  = UINT32_C(1) << sbi->clust_shift;
-    sector_t data_area = sbi->data;
+    struct fat_extent *ext = NULL, *e;
+    uint32_t n = 0, alloc = 0;
+    uint32_t lcluster, pcluster, tcluster;
+    struct fat_window w;
 
     tcluster = (inode->size + cluster_bytes - 1) >> sbi->clust_byte_shift;
-    if (mcluster >= tcluster)
-	goto err;		/* Requested cluster beyond end of file */
 
-    lcluster = PVT(inode)->offset >> sbi->clust_shift;
-    pcluster = ((PVT(inode)->here - data_area) >> sbi->clust_shift) + 2;
+    w.start = w.nsec = 0;
+    w.buf = malloc(FAT_WINDOW_SECS << SECTOR_SHIFT(fs));
 
-    if (lcluster > mcluster || PVT(inode)->here < data_area) {
-	lcluster = 0;
-	pcluster = PVT(inode)->start_cluster;
-    }
+    pcluster = PVT(inode)->start_cluster;
+    for (lcluster = 0; lcluster < tcluster; lcluster++) {
+	if (lcluster)
+	    pcluster = fat_walk_next(fs, &w, pcluster);
 
-    for (;;) {
 	if (pcluster-2 >= sbi->clusters) {
-	    inode->size = lcluster << sbi->clust_shift;
-	    goto err;
+	    inode->size = (uint64_t)lcluster << sbi->clust_byte_shift;
+	    break;
 	}
 
-	if (lcluster >= mcluster)
-	    break;
+	if (n && ext[n-1].pcluster + ext[n-1].len == pcluster) {
+	    ext[n-1].len++;
+	    continue;
+	}
 
-	lcluster++;
-	pcluster = get_next_cluster(fs, pcluster);
+	if (n == alloc) {
+	    alloc = alloc ? alloc << 1 : 8;
+	    e = realloc(ext, alloc * sizeof *ext);
+	    if (!e) {
+		free(ext);
+		free(w.buf);
+		return -1;
+	    }
+	    ext = e;
+	}
+
+	ext[n].lcluster = lcluster;
+	ext[n].pcluster = pcluster;
+	ext[n].len = 1;
+	n++;
     }
 
-    inode->next_extent.pstart =
-	((sector_t)(pcluster-2) << sbi->clust_shift) + data_area;
-    inode->next_extent.len = cluster_secs;
-    xcluster = 0;		/* Nonsense */
-
-    while (++lcluster < tcluster) {
-	xcluster = get_next_cluster(fs, pcluster);
-	if (xcluster != ++pcluster)
-	    break;		/* Not contiguous */
-	inode->next_extent.len += cluster_secs;
+    free(w.buf);
+
+    PVT(inode)->extents = ext;
+    PVT(inode)->nextents = n;
+    return n ? 0 : -1;
+}
+
+static int fat_next_extent(struct inode *inode, uint32_t lstart)
+{
+    struct fs_info *fs = inode->fs;
+    struct fat_sb_info *sbi = FAT_SB(fs);
+    uint32_t mcluster = lstart >> sbi->clust_shift;
+    const struct fat_extent *e;
+    uint32_t lo, hi, mid;
+    uint32_t skip;
+
+    if (!PVT(inode)->extents && fat_load_extents(inode))
+	goto err;
+
+    /* Find the run containing mcluster */
+    lo = 0;
+    hi = PVT(inode)->nextents;
+    while (lo < hi) {
+	mid = (lo + hi) >> 1;
+	e = &PVT(inode)->extents[mid];
+	if (mcluster < e->lcluster)
+	    hi = mid;
+	else if (mcluster >= e->lcluster + e->len)
+	    lo = mid + 1;
+	else
+	    break;
     }
+    if (lo >= hi)
+	goto err;		/* Requested cluster beyond end of file */
 
-    /* Note: ->here is bogus if ->offset >= EOF, but that's okay */
-    PVT(inode)->offset = lcluster << sbi->clust_shift;
-    PVT(inode)->here   = ((xcluster-2) << sbi->clust_shift) + data_area;
+    skip = lstart - (e->lcluster << sbi->clust_shift);
+    inode->next_extent.pstart =
+	((sector_t)(e->pcluster-2) << sbi->clust_shift) + sbi->data + skip;
+    inode->next_extent.len = (e->len << sbi->clust_shift) - skip;
 
     return 0;
 
@@ -145,6 +273,11 @@ err:
     return -1;
 }
 
+static void fat_release_inode(struct inode *inode)
+{
+    free(PVT(inode)->extents);
+}
+
 static sector_t get_next_sector(struct fs_info* fs, uint32_t sector)
 {
     struct fat_sb_info *sbi = FAT_SB(fs);
@@ -456,7 +589,7 @@ static struct inode *vfat_find_entry(const char *dname, struct inode *dir)
 
     slots = (strlen(dname) + 12) / 13;
     if (slots > 20)
-	return NULL;		/* Name too long */
+	goto not_found;		/* Name too long */
 
     slots |= 0x40;
     vfat_init = vfat_next = slots;
@@ -471,7 +604,7 @@ static struct inode *vfat_find_entry(const char *dname, struct inode *dir)
 
 	while (entries--) {
 	    if (de->name[0] == 0)
-		return NULL;
+		goto not_found;
 
 	    if (de->attr == 0x0f) {
 		/*
@@ -542,6 +675,9 @@ static struct inode *vfat_find_entry(const char *dname, struct inode *dir)
 	/* Try with the next sector */
 	dir_sector = get_next_sector(fs, dir_sector);
     }
+
+not_found:
+    errno = ENOENT;
     return NULL;		/* Nothing found... */
 
 found:
@@ -778,6 +914,19 @@ static int vfat_fs_init(struct fs_info *fs)
     }
     sbi->clusters = clusters;
 
+    /* Small FATs are read in one go and never looked up sector by sector */
+    sbi->fat_secs = sectors_per_fat;
+    sbi->fat_copy = NULL;
+    if (sectors_per_fat <= (FAT_PREFETCH_MAX >> fs->sector_shift)) {
+	sbi->fat_copy = malloc(sectors_per_fat << fs->sector_shift);
+	if (sbi->fat_copy &&
+	    disk->rdwr_sectors(disk, sbi->fat_copy, sbi->fat,
+			       sectors_per_fat, 0) != sectors_per_fat) {
+	    free(sbi->fat_copy);
+	    sbi->fat_copy = NULL;
+	}
+    }
+
     /* fs UUID - serial number */
     if (FAT32 == sbi->fat_type)
 	sbi->uuid = fat.fat32.num_serial;
@@ -855,6 +1004,7 @@ const struct fs_ops vfat_fs_ops = {
     .iget_root     = vfat_iget_root,
     .iget          = vfat_iget,
     .next_extent   = fat_next_extent,
+    .release_inode = fat_release_inode,
     .copy_super    = vfat_copy_superblock,
     .fs_uuid       = vfat_fs_uuid,
 };
@@ -98,6 +98,8 @@ struct fat_sb_info {
 	int      clust_size;
 
 	int      fat_type;
+	uint32_t fat_secs;         /* Sectors in one FAT */
+	uint8_t *fat_copy;         /* The whole FAT, if small enough */
 
 	uint32_t uuid;             /* fs UUID */
 } __attribute__ ((packed));
@@ -145,6 +147,24 @@ static inline int root_dir_size(struct fs_info *fs, struct fat_bpb *fat)
 	>> (SECTOR_SHIFT(fs) - 5);
 }
 
+/*
+ * Largest FAT we keep in memory in its entirety.  This covers every
+ * FAT12 and FAT16 volume, and FAT32 volumes up to 64K clusters.
+ */
+#define FAT_PREFETCH_MAX	(256 << 10)
+
+/* FAT sectors read at a time when mapping a file on a larger volume */
+#define FAT_WINDOW_SECS		16
+
+/*
+ * A run of physically contiguous clusters in a file
+ */
+struct fat_extent {
+    uint32_t lcluster;		/* First cluster, relative to the file */
+    uint32_t pcluster;		/* First cluster on disk */
+    uint32_t len;		/* Number of clusters */
+};
+
 /*
  * FAT private inode information
  */
@@ -153,6 +173,8 @@ struct fat_pvt_inode {
     sector_t start;		/* Starting sector */
     sector_t offset;		/* Current sector offset */
     sector_t here;		/* Sector corresponding to offset */
+    struct fat_extent *extents;	/* Cluster chain, once it has been walked */
+    uint32_t nextents;
 };
 
 #define PVT(i) ((struct fat_pvt_inode *)((i)->pvt))
@@ -47,6 +47,9 @@ void put_inode(struct inode *inode)
 	if (refcnt)
 	    break;		/* We still have references */
 	inode = dead->parent;
+	getfssec_forget(dead);
+	if (dead->fs->fs_ops->release_inode)
+	    dead->fs->fs_ops->release_inode(dead);
 	if (dead->name)
 	    free((char *)dead->name);
 	free(dead);
@@ -235,9 +238,28 @@ int searchdir(const char *name, int flags)
 
 	/* Anything else */
 	tmp = inode;
-	inode = this_fs->fs_ops->iget(inode_name, inode);
+	if (dcache_lookup(tmp, inode_name, next_inode_name != NULL, &inode)) {
+	    if (inode) {
+		/* A cached directory already has tmp as its parent */
+		get_inode(inode);
+		put_inode(tmp);
+		continue;
+	    }
+	    /* Known not to exist */
+	    put_inode(tmp);
+	    break;
+	}
+
+	errno = 0;
+	inode = this_fs->fs_ops->iget(inode_name, tmp);
 	if (!inode) {
-	    /* Failure.  Release the chain */
+	    /*
+	     * Failure.  Remember it if the filesystem says the name
+	     * doesn't exist, as opposed to having failed to look, and
+	     * release the chain.
+	     */
+	    if (errno == ENOENT)
+		dcache_add(tmp, inode_name, NULL);
 	    put_inode(tmp);
 	    break;
 	}
@@ -253,6 +275,7 @@ int searchdir(const char *name, int flags)
 	inode->parent = tmp;
 	inode->name = strdup(inode_name);
 	dprintf("searchdir: path component: %s\n", inode->name);
+	dcache_add(tmp, inode_name, inode);
 
 	/* Symlink handling */
 	if (inode->mode == DT_LNK) {
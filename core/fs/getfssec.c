@@ -56,11 +56,29 @@
  * and coalescing.  However, if the filesystem can do extent coalescing
  * very cheaply by using filesystem-specific knowledge, then that is
  * preferred (e.g. FAT).
+ *
+ * If the disk provides an asynchronous read interface (read_start and
+ * read_wait), the sectors following each read are fetched into a
+ * second buffer while the caller is busy with the data it got; the
+ * next call then finds them there.  Only one such read is in flight.
  */
 
 #include <dprintf.h>
 #include <minmax.h>
+#include <stdlib.h>
+#include <string.h>
 #include "fs.h"
+#include "disk.h"
+
+#define PREFETCH_SIZE	(256 << 10)
+
+static struct {
+    struct inode *inode;	/* Owner of the buffer, NULL if unused */
+    uint32_t lstart;		/* First logical sector in the buffer */
+    uint32_t len;		/* Number of sectors in the buffer */
+    bool pending;		/* Read started but not yet waited for */
+    char *buf;
+} prefetch;
 
 static inline sector_t next_psector(sector_t psector, uint32_t skip)
 {
@@ -90,6 +108,104 @@ static void get_next_extent(struct inode *inode)
 	    inode->next_extent.pstart, inode->next_extent.len);
 }
 
+static void prefetch_wait(struct disk *disk)
+{
+    int rv;
+
+    if (!prefetch.pending)
+	return;
+
+    prefetch.pending = false;
+    rv = disk->read_wait(disk);
+    if (rv <= 0)
+	prefetch.inode = NULL;
+    else if ((uint32_t)rv < prefetch.len)
+	prefetch.len = rv;
+}
+
+/*
+ * Drop any prefetched data belonging to an inode which is going away.
+ */
+void getfssec_forget(struct inode *inode)
+{
+    if (inode && prefetch.inode == inode) {
+	prefetch_wait(inode->fs->fs_dev->disk);
+	prefetch.inode = NULL;
+    }
+}
+
+/*
+ * Copy whatever part of the request starting at LSECTOR is already in
+ * the prefetch buffer.  Returns the number of sectors copied.
+ */
+static uint32_t prefetch_get(struct inode *inode, char *buf,
+			     uint32_t lsector, uint32_t sectors)
+{
+    struct fs_info *fs = inode->fs;
+    uint32_t off, n;
+
+    if (prefetch.inode != inode)
+	return 0;
+
+    prefetch_wait(fs->fs_dev->disk);
+
+    if (!prefetch.inode || lsector < prefetch.lstart ||
+	lsector >= prefetch.lstart + prefetch.len) {
+	prefetch.inode = NULL;	/* Seeked away, discard */
+	return 0;
+    }
+
+    off = lsector - prefetch.lstart;
+    n = min(sectors, prefetch.len - off);
+    memcpy(buf, prefetch.buf + (off << SECTOR_SHIFT(fs)),
+	   n << SECTOR_SHIFT(fs));
+
+    if (off + n == prefetch.len)
+	prefetch.inode = NULL;	/* All used up */
+
+    return n;
+}
+
+/*
+ * Start reading the rest of the current extent, up to SECTORS_LEFT
+ * sectors, in the background.
+ */
+static void prefetch_start(struct inode *inode, uint32_t sectors_left)
+{
+    struct fs_info *fs = inode->fs;
+    struct disk *disk = fs->fs_dev->disk;
+    const struct extent *ext = &inode->this_extent;
+    uint32_t len;
+
+    if (!disk->read_start || prefetch.inode)
+	return;
+
+    if (!ext->len || EXTENT_SPECIAL(ext->pstart))
+	return;
+
+    len = min(ext->len, sectors_left);
+    len = min(len, PREFETCH_SIZE >> SECTOR_SHIFT(fs));
+    if (!len)
+	return;
+
+    if (!prefetch.buf) {
+	prefetch.buf = malloc(PREFETCH_SIZE);
+	if (!prefetch.buf)
+	    return;
+    }
+
+    if (disk->read_start(disk, prefetch.buf, ext->pstart, len))
+	return;
+
+    dprintf("Prefetch: inode %p @ %u start %llu len %u\n",
+	    inode, ext->lstart, ext->pstart, len);
+
+    prefetch.inode   = inode;
+    prefetch.lstart  = ext->lstart;
+    prefetch.len     = len;
+    prefetch.pending = true;
+}
+
 uint32_t generic_getfssec(struct file *file, char *buf,
 			  int sectors, bool *have_more)
 {
@@ -101,6 +217,7 @@ uint32_t generic_getfssec(struct file *file, char *buf,
     uint32_t sectors_left =
 	(bytes_left + SECTOR_SIZE(fs) - 1) >> SECTOR_SHIFT(fs);
     uint32_t lsector;
+    uint32_t got;
 
     if (sectors > sectors_left)
 	sectors = sectors_left;
@@ -111,6 +228,15 @@ uint32_t generic_getfssec(struct file *file, char *buf,
     lsector = file->offset >> SECTOR_SHIFT(fs);
     dprintf("Offset: %u  lsector: %u\n", file->offset, lsector);
 
+    /* Anything we already have from the previous call? */
+    got = prefetch_get(inode, buf, lsector, sectors);
+    if (got) {
+	buf += got << SECTOR_SHIFT(fs);
+	bytes_read += got << SECTOR_SHIFT(fs);
+	lsector += got;
+	sectors -= got;
+    }
+
     if (lsector < inode->this_extent.lstart ||
 	lsector >= inode->this_extent.lstart + inode->this_extent.len) {
 	/* inode->this_extent unusable, maybe next_extent is... */
@@ -195,5 +321,8 @@ uint32_t generic_getfssec(struct file *file, char *buf,
     if (have_more)
 	*have_more = bytes_read < bytes_left;
 
+    if (bytes_read < bytes_left)
+	prefetch_start(inode, sectors_left - (bytes_read >> SECTOR_SHIFT(fs)));
+
     return bytes_read;
 }
@@ -198,8 +198,10 @@ static struct inode *iso_iget(const char *dname, struct inode *parent)
     dprintf("iso_iget %p %s\n", parent, dname);
 
     de = iso_find_entry(dname, parent);
-    if (!de)
+    if (!de) {
+	errno = ENOENT;
 	return NULL;
+    }
     
     return iso_get_inode(parent->fs, de);
 }
@@ -28,6 +28,7 @@
 #include <disk.h>
 #include <fs.h>
 #include <ilog2.h>
+#include <minmax.h>
 #include <klibc/compiler.h>
 #include <ctype.h>
 
@@ -43,6 +44,7 @@ static f_mft_record_lookup ntfs_mft_record_lookup_3_1;
 static inline enum dirent_type get_inode_mode(struct ntfs_mft_record *mrec);
 static inline struct ntfs_attr_record * ntfs_attr_lookup(struct fs_info *fs, uint32_t type, struct ntfs_mft_record **mmrec, struct ntfs_mft_record *mrec);
 static inline uint8_t *mapping_chunk_init(struct ntfs_attr_record *attr,struct mapping_chunk *chunk,uint32_t *offset);
+static int ntfs_attr_runlist(struct ntfs_attr_record *attr, struct runlist *rlist);
 static int parse_data_run(const void *stream, uint32_t *offset, uint8_t *attr_len, struct mapping_chunk *chunk);
 
 /*** Function definitions */
@@ -180,6 +182,71 @@ out:
     return -1;
 }
 
+/*
+ * Return a malloc()ed copy of MFT record FILE if it is in the cache,
+ * or NULL.
+ */
+static struct ntfs_mft_record *ntfs_mft_cache_get(struct fs_info *fs,
+                                                  uint32_t file)
+{
+    struct ntfs_sb_info *sbi = NTFS_SB(fs);
+    struct ntfs_mft_cache *mc = sbi->mft_cache;
+    struct ntfs_mft_record *mrec;
+    int i;
+
+    if (!mc)
+        return NULL;
+
+    for (i = 0; i < NTFS_MFT_CACHE_ENTRIES; i++) {
+        if (mc->entries[i].used && mc->entries[i].file == file)
+            break;
+    }
+    if (i == NTFS_MFT_CACHE_ENTRIES)
+        return NULL;
+
+    mrec = malloc(sbi->mft_record_size);
+    if (!mrec) {
+        malloc_error("uint8_t *");
+        return NULL;
+    }
+
+    memcpy(mrec, mc->records + i * sbi->mft_record_size,
+           sbi->mft_record_size);
+    mc->entries[i].used = ++mc->clock;
+
+    return mrec;
+}
+
+/*
+ * Remember a valid MFT record, replacing the least recently used one.
+ */
+static void ntfs_mft_cache_put(struct fs_info *fs, uint32_t file,
+                               const struct ntfs_mft_record *mrec)
+{
+    struct ntfs_sb_info *sbi = NTFS_SB(fs);
+    struct ntfs_mft_cache *mc = sbi->mft_cache;
+    int i, victim;
+
+    if (!mc) {
+        mc = zalloc(sizeof *mc +
+                    NTFS_MFT_CACHE_ENTRIES * sbi->mft_record_size);
+        if (!mc)
+            return;     /* just run uncached */
+        sbi->mft_cache = mc;
+    }
+
+    victim = 0;
+    for (i = 1; i < NTFS_MFT_CACHE_ENTRIES; i++) {
+        if (mc->entries[i].used < mc->entries[victim].used)
+            victim = i;
+    }
+
+    memcpy(mc->records + victim * sbi->mft_record_size, mrec,
+           sbi->mft_record_size);
+    mc->entries[victim].file = file;
+    mc->entries[victim].used = ++mc->clock;
+}
+
 /* AndyAlex: read and validate single MFT record. Keep in mind that MFT itself can be fragmented */
 static struct ntfs_mft_record *ntfs_mft_record_lookup_any(struct fs_info *fs,
                                                 uint32_t file, block_t *out_blk, bool is_v31)
@@ -193,50 +260,53 @@ static struct ntfs_mft_record *ntfs_mft_record_lookup_any(struct fs_info *fs,
     block_t blk = 0;
     uint64_t offset = 0;
 
+    struct ntfs_sb_info *sbi = NTFS_SB(fs);
     struct ntfs_mft_record *mrec = NULL, *lmrec = NULL;
     uint64_t start_blk = 0;
     struct ntfs_attr_record *attr = NULL;
-    uint8_t *stream = NULL;
-    uint32_t attr_offset = 0;
-    uint8_t *attr_len = NULL;
-    struct mapping_chunk chunk;
+    const struct runlist_element *run;
 
     int err = 0;
 
     /* determine MFT record's LCN */
     uint64_t vcn = (file << mft_record_shift >> clust_byte_shift);
     dprintf("in %s(%s)\n", __func__,(is_v31?"v3.1":"v3.0"));
+
+    /* Records only get into the cache once read and fixed up */
+    mrec = ntfs_mft_cache_get(fs, file);
+    if (mrec && is_v31 && mrec->mft_record_no != file) {
+      free(mrec);
+      return NULL;
+    }
+    if (mrec) {
+      if (out_blk)
+        *out_blk = (file << mft_record_shift >> BLOCK_SHIFT(fs));
+      return mrec;
+    }
+
     if (0==vcn) {
-      lcn = NTFS_SB(fs)->mft_lcn;
-    } else do {
-      dprintf("%s: looking for VCN %u for MFT record %u\n", __func__,(unsigned)vcn,(unsigned)file);
-      mrec = NTFS_SB(fs)->mft_record_lookup(fs, 0, &start_blk);
-      if (!mrec) {dprintf("%s: read MFT(0) failed\n", __func__); break;}
-      lmrec = mrec;
-      if (get_inode_mode(mrec) != DT_REG) {dprintf("%s: $MFT is not a file\n", __func__); break;}
-      attr = ntfs_attr_lookup(fs, NTFS_AT_DATA, &mrec, lmrec);
-      if (!attr) {dprintf("%s: $MFT have no data attr\n", __func__); break;}
-      if (!attr->non_resident) {dprintf("%s: $MFT data attr is resident\n", __func__); break;}
-      attr_len = (uint8_t *)attr + attr->len;
-      stream = mapping_chunk_init(attr, &chunk, &attr_offset);
-      while (true) {
-        err = parse_data_run(stream, &attr_offset, attr_len, &chunk);
+      lcn = sbi->mft_lcn;
+    } else {
+      /* $MFT's own runs are decoded once, from record 0 */
+      if (runlist_is_empty(sbi->mft_rlist)) do {
+        mrec = sbi->mft_record_lookup(fs, 0, &start_blk);
+        if (!mrec) {dprintf("%s: read MFT(0) failed\n", __func__); break;}
+        lmrec = mrec;
+        if (get_inode_mode(mrec) != DT_REG) {dprintf("%s: $MFT is not a file\n", __func__); break;}
+        attr = ntfs_attr_lookup(fs, NTFS_AT_DATA, &mrec, lmrec);
+        if (!attr) {dprintf("%s: $MFT have no data attr\n", __func__); break;}
+        if (!attr->non_resident) {dprintf("%s: $MFT data attr is resident\n", __func__); break;}
+        err = ntfs_attr_runlist(attr, sbi->mft_rlist);
         if (err) {dprintf("%s: $MFT data run parse failed with error %d\n", __func__,err); break;}
-        if (chunk.flags & MAP_UNALLOCATED) continue;
-        if (chunk.flags & MAP_END) break;
-        if (chunk.flags & MAP_ALLOCATED) {
-          dprintf("%s: Chunk: VCN=%u, LCN=%u, len=%u\n", __func__,(unsigned)chunk.vcn,(unsigned)chunk.lcn,(unsigned)chunk.len);
-          if ((vcn>=chunk.vcn)&&(vcn<chunk.vcn+chunk.len)) {
-            lcn=vcn-chunk.vcn+chunk.lcn;
-            dprintf("%s: VCN %u for MFT record %u maps to lcn %u\n", __func__,(unsigned)vcn,(unsigned)file,(unsigned)lcn);
-            break;
-          }
-          chunk.vcn += chunk.len;
-        }
+      } while(false);
+      if (mrec!=NULL) free(mrec);
+      mrec = NULL;
+      run = runlist_lookup(sbi->mft_rlist, vcn);
+      if (run && vcn >= run->vcn) {
+        lcn=vcn-run->vcn+run->lcn;
+        dprintf("%s: VCN %u for MFT record %u maps to lcn %u\n", __func__,(unsigned)vcn,(unsigned)file,(unsigned)lcn);
       }
-    } while(false);
-    if (mrec!=NULL) free(mrec);
-    mrec = NULL;
+    }
     if (0==lcn) {
       dprintf("%s: unable to map VCN %u for MFT record %u\n", __func__,(unsigned)vcn,(unsigned)file);
       return NULL;
@@ -268,6 +338,7 @@ static struct ntfs_mft_record *ntfs_mft_record_lookup_any(struct fs_info *fs,
     if (mrec->magic != NTFS_MAGIC_FILE) mrec = NULL;
     if (mrec && is_v31) if (mrec->mft_record_no != file) mrec = NULL;
     if (mrec!=NULL) {
+      ntfs_mft_cache_put(fs, file, mrec);
       if (out_blk) {
         *out_blk = (file << mft_record_shift >> BLOCK_SHIFT(fs));   /* update record starting block */
       }
@@ -383,7 +454,7 @@ static int parse_data_run(const void *stream, uint32_t *offset,
 
     mask = 0xFFFFFFFF;
     res = 0LL;
-    if (*byte & 0x80)
+    if (l && (*byte & 0x80))
         res |= (int64_t)mask;   /* sign-extend it */
 
     while (count--)
@@ -391,7 +462,7 @@ static int parse_data_run(const void *stream, uint32_t *offset,
 
     chunk->lcn += res;
     /* are VCNS from cur_vcn to next_vcn - 1 unallocated ? */
-    if (!chunk->lcn)
+    if (!l)
         chunk->flags |= MAP_UNALLOCATED;
     else
         chunk->flags |= MAP_ALLOCATED;
@@ -404,6 +475,36 @@ out:
     return -1;
 }
 
+/* Decode all the data runs of a non-resident attribute into RLIST.
+ *
+ * return 0 on success or -1 on failure.
+ */
+static int ntfs_attr_runlist(struct ntfs_attr_record *attr,
+                            struct runlist *rlist)
+{
+    uint8_t *attr_len = (uint8_t *)attr + attr->len;
+    struct mapping_chunk chunk;
+    uint32_t offset;
+    uint8_t *stream;
+
+    stream = mapping_chunk_init(attr, &chunk, &offset);
+    for (;;) {
+        if (parse_data_run(stream, &offset, attr_len, &chunk)) {
+            printf("parse_data_run()\n");
+            runlist_free(rlist);
+            return -1;
+        }
+
+        if (chunk.flags & MAP_END)
+            return 0;
+        if (chunk.flags & MAP_ALLOCATED)
+            runlist_append(rlist, (struct runlist_element *)&chunk);
+
+        /* update for next VCN; sparse runs are left as holes */
+        chunk.vcn += chunk.len;
+    }
+}
+
 static struct ntfs_mft_record *
 ntfs_attr_list_lookup(struct fs_info *fs, struct ntfs_attr_record *attr,
                       uint32_t type, struct ntfs_mft_record *mrec)
@@ -614,11 +715,7 @@ static int index_inode_setup(struct fs_info *fs, unsigned long mft_no,
     struct ntfs_mft_record *mrec, *lmrec;
     struct ntfs_attr_record *attr;
     enum dirent_type d_type;
-    uint8_t *attr_len;
-    struct mapping_chunk chunk;
-    int err;
-    uint8_t *stream;
-    uint32_t offset;
+    struct runlist *rlist;
 
     dprintf("in %s()\n", __func__);
 
@@ -675,31 +772,11 @@ static int index_inode_setup(struct fs_info *fs, unsigned long mft_no,
                 (uint32_t)((uint8_t *)attr + attr->data.resident.value_offset);
             inode->size = attr->data.resident.value_len;
         } else {
-            attr_len = (uint8_t *)attr + attr->len;
-
-            stream = mapping_chunk_init(attr, &chunk, &offset);
-            NTFS_PVT(inode)->data.non_resident.rlist = NULL;
-            for (;;) {
-                err = parse_data_run(stream, &offset, attr_len, &chunk);
-                if (err) {
-                    printf("parse_data_run()\n");
-                    goto out;
-                }
-
-                if (chunk.flags & MAP_UNALLOCATED)
-                    continue;
-                if (chunk.flags & MAP_END)
-                    break;
-                if (chunk.flags &  MAP_ALLOCATED) {
-                    /* append new run to the runlist */
-                    runlist_append(&NTFS_PVT(inode)->data.non_resident.rlist,
-                                    (struct runlist_element *)&chunk);
-                    /* update for next VCN */
-                    chunk.vcn += chunk.len;
-                }
-            }
+            rlist = &NTFS_PVT(inode)->data.non_resident.rlist;
+            if (ntfs_attr_runlist(attr, rlist))
+                goto out;
 
-            if (runlist_is_empty(NTFS_PVT(inode)->data.non_resident.rlist)) {
+            if (runlist_is_empty(rlist)) {
                 printf("No mapping found\n");
                 goto out;
             }
@@ -783,6 +860,7 @@ static struct inode *ntfs_index_lookup(const char *dname, struct inode *dir)
     /* check for the presence of a child node */
     if (!(ie->flags & INDEX_ENTRY_NODE)) {
         printf("No child node, aborting...\n");
+        errno = ENOENT;
         goto out;
     }
 
@@ -864,6 +942,9 @@ static struct inode *ntfs_index_lookup(const char *dname, struct inode *dir)
         }
     } while (!(chunk.flags & MAP_END));
 
+    if (!err)
+        errno = ENOENT;		/* Searched every index block */
+
 not_found:
     dprintf("Index not found\n");
 
@@ -915,8 +996,9 @@ static int ntfs_next_extent(struct inode *inode, uint32_t lstart)
     struct fs_info *fs = inode->fs;
     struct ntfs_sb_info *sbi = NTFS_SB(fs);
     sector_t pstart = 0;
-    struct runlist *rlist;
-    struct runlist *ret;
+    const struct runlist_element *run;
+    uint64_t vcn;
+    sector_t end;
     const uint32_t sec_size = SECTOR_SIZE(fs);
     const uint32_t sec_shift = SECTOR_SHIFT(fs);
 
@@ -927,27 +1009,25 @@ static int ntfs_next_extent(struct inode *inode, uint32_t lstart)
                 sec_shift;
         inode->next_extent.len = (inode->size + sec_size - 1) >> sec_shift;
     } else {
-        rlist = NTFS_PVT(inode)->data.non_resident.rlist;
+        vcn = lstart >> sbi->clust_shift;
+        run = runlist_lookup(&NTFS_PVT(inode)->data.non_resident.rlist, vcn);
 
-        if (!lstart || lstart >= NTFS_PVT(inode)->here) {
-            if (runlist_is_empty(rlist))
+        if (run && vcn >= run->vcn) {
+            pstart = (run->lcn << sbi->clust_shift) +
+                (lstart - (run->vcn << sbi->clust_shift));
+            end = (run->vcn + run->len) << sbi->clust_shift;
+        } else {
+            /* a sparse run, up to the next allocated one or EOF */
+            pstart = EXTENT_ZERO;
+            if (run)
+                end = run->vcn << sbi->clust_shift;
+            else
+                end = (inode->size + sec_size - 1) >> sec_shift;
+            if (end <= lstart)
                 goto out;   /* nothing to do ;-) */
-
-            ret = runlist_remove(&rlist);
-
-            NTFS_PVT(inode)->here =
-                ((ret->run.len << sbi->clust_byte_shift) >> sec_shift);
-
-            pstart = ret->run.lcn << sbi->clust_shift;
-            inode->next_extent.len =
-                ((ret->run.len << sbi->clust_byte_shift) + sec_size - 1) >>
-                sec_shift;
-
-            NTFS_PVT(inode)->data.non_resident.rlist = rlist;
-
-            free(ret);
-            ret = NULL;
         }
+
+        inode->next_extent.len = min(end - lstart, (sector_t)0xffffffff);
     }
 
     inode->next_extent.pstart = pstart;
@@ -1010,6 +1090,12 @@ out:
     return 0;
 }
 
+static void ntfs_release_inode(struct inode *inode)
+{
+    if (NTFS_PVT(inode)->non_resident)
+        runlist_free(&NTFS_PVT(inode)->data.non_resident.rlist);
+}
+
 static inline bool is_filename_printable(const char *s)
 {
     return s && (*s != '.' && *s != '$');
@@ -1352,6 +1438,10 @@ static int ntfs_fs_init(struct fs_info *fs)
     sbi->major_ver = 3;
     sbi->minor_ver = 0;
     sbi->mft_record_lookup = ntfs_mft_record_lookup_3_0;
+    sbi->mft_rlist = zalloc(sizeof *sbi->mft_rlist);
+    if (!sbi->mft_rlist)
+        malloc_error("runlist structure");
+    sbi->mft_cache = NULL;
 
     /* Initialize the cache */
     cache_init(fs->fs_dev, BLOCK_SHIFT(fs));
@@ -1372,5 +1462,6 @@ const struct fs_ops ntfs_fs_ops = {
     .iget_root      = ntfs_iget_root,
     .iget           = ntfs_iget,
     .next_extent    = ntfs_next_extent,
+    .release_inode  = ntfs_release_inode,
     .fs_uuid        = NULL,
 };
@@ -50,6 +50,18 @@ struct ntfs_bpb {
     uint8_t pad[428];       /* padding to a sector boundary (512 bytes) */
 } __attribute__((__packed__));
 
+/* Recently read MFT records, kept after their fixups have been applied */
+#define NTFS_MFT_CACHE_ENTRIES  32
+
+struct ntfs_mft_cache {
+    uint32_t clock;                 /* Bumped on every hit or fill */
+    struct {
+        uint32_t file;              /* MFT record number */
+        uint32_t used;              /* Clock at last use, 0 if empty */
+    } entries[NTFS_MFT_CACHE_ENTRIES];
+    uint8_t records[];              /* NTFS_MFT_CACHE_ENTRIES records */
+};
+
 /* Function type for an NTFS-version-dependent MFT record lookup */
 struct ntfs_mft_record;
 typedef struct ntfs_mft_record *f_mft_record_lookup(struct fs_info *,
@@ -75,6 +87,9 @@ struct ntfs_sb_info {
 
     /* NTFS-version-dependent MFT record lookup function to use */
     f_mft_record_lookup *mft_record_lookup;
+
+    struct runlist *mft_rlist;      /* Data runs of $MFT, once decoded */
+    struct ntfs_mft_cache *mft_cache;
 } __attribute__((__packed__));
 
 /* The NTFS in-memory inode structure */
@@ -90,7 +105,7 @@ struct ntfs_inode {
             uint32_t offset;    /* Data offset */
         } resident;
         struct {            /* Used only if non_resident is set */
-            struct runlist *rlist;
+            struct runlist rlist;
         } non_resident;
     } data;
     uint32_t start_cluster; /* Starting cluster address */
@@ -26,58 +26,65 @@ struct runlist_element {
     uint64_t len;
 };
 
+/*
+ * The allocated runs of a non-resident attribute, sorted by VCN.  The
+ * array is built once, when the mapping pairs are decoded, and is never
+ * modified afterwards, so it can be looked up in any order.  Sparse
+ * runs are not stored: they are the gaps between the elements.
+ */
 struct runlist {
-    struct runlist_element run;
-    struct runlist *next;
+    struct runlist_element *runs;
+    uint32_t nruns;
+    uint32_t alloc;
 };
 
-static struct runlist *tail;
-
-static inline bool runlist_is_empty(struct runlist *rlist)
+static inline bool runlist_is_empty(const struct runlist *rlist)
 {
-    return !rlist;
+    return !rlist->nruns;
 }
 
-static inline struct runlist *runlist_alloc(void)
+static inline void runlist_append(struct runlist *rlist,
+                                const struct runlist_element *elem)
 {
-    struct runlist *rlist;
-
-    rlist = malloc(sizeof *rlist);
-    if (!rlist)
-        malloc_error("runlist structure");
-
-    rlist->next = NULL;
+    struct runlist_element *runs;
+
+    if (rlist->nruns == rlist->alloc) {
+        rlist->alloc = rlist->alloc ? rlist->alloc << 1 : 8;
+        runs = realloc(rlist->runs, rlist->alloc * sizeof *runs);
+        if (!runs)
+            malloc_error("runlist array");
+        rlist->runs = runs;
+    }
 
-    return rlist;
+    rlist->runs[rlist->nruns++] = *elem;
 }
 
-static inline void runlist_append(struct runlist **rlist,
-                                struct runlist_element *elem)
+static inline void runlist_free(struct runlist *rlist)
 {
-    struct runlist *n = runlist_alloc();
-
-    n->run = *elem;
-
-    if (runlist_is_empty(*rlist)) {
-        *rlist = n;
-        tail = n;
-    } else {
-        tail->next = n;
-        tail = n;
-    }
+    free(rlist->runs);
+    rlist->runs = NULL;
+    rlist->nruns = rlist->alloc = 0;
 }
 
-static inline struct runlist *runlist_remove(struct runlist **rlist)
+/*
+ * Return the first run which ends after VCN: the run containing it, or
+ * if VCN falls in a hole, the run following the hole.  NULL means VCN
+ * is past the last allocated run.
+ */
+static inline const struct runlist_element *
+runlist_lookup(const struct runlist *rlist, uint64_t vcn)
 {
-    struct runlist *ret;
-
-    if (runlist_is_empty(*rlist))
-        return NULL;
-
-    ret = *rlist;
-    *rlist = ret->next;
+    uint32_t lo = 0, hi = rlist->nruns, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) >> 1;
+        if (rlist->runs[mid].vcn + rlist->runs[mid].len <= vcn)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
 
-    return ret;
+    return lo < rlist->nruns ? &rlist->runs[lo] : NULL;
 }
 
 #endif /* _RUNLIST_H_ */
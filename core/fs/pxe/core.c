@@ -2,6 +2,7 @@
 #include <lwip/api.h>
 #include <lwip/tcpip.h>
 #include <lwip/dns.h>
+#include <lwip/netif.h>
 #include <core.h>
 #include <net.h>
 #include "pxe.h"
@@ -95,13 +96,15 @@ void core_udp_disconnect(struct pxe_pvt_inode *socket)
  * @out: src_ip, ip address of the data source
  * @out: src_port, port number of the data source, host-byte order
  */
-int core_udp_recv(struct pxe_pvt_inode *socket, void *buf, uint16_t *buf_len,
-		  uint32_t *src_ip, uint16_t *src_port)
+int core_udp_recvv(struct pxe_pvt_inode *socket,
+		   const struct net_iovec *iov, int niov, uint16_t *buf_len,
+		   uint32_t *src_ip, uint16_t *src_port)
 {
     struct net_private_lwip *priv = &socket->net.lwip;
     struct netbuf *nbuf;
-    u16_t nbuf_len;
-    int err;
+    u16_t nbuf_len, offset, n;
+    size_t space;
+    int i, err;
 
     err = netconn_recv(priv->conn, &nbuf);
     if (err)
@@ -115,16 +118,49 @@ int core_udp_recv(struct pxe_pvt_inode *socket, void *buf, uint16_t *buf_len,
 
     netbuf_first(nbuf);		/* XXX needed? */
     nbuf_len = netbuf_len(nbuf);
-    if (nbuf_len <= *buf_len)
-	netbuf_copy(nbuf, buf, nbuf_len);
-    else
-	nbuf_len = 0; /* impossible mtu < PKTBUF_SIZE */
+
+    space = 0;
+    for (i = 0; i < niov; i++)
+	space += iov[i].len;
+
+    /*
+     * Copy straight from the pbuf chain into each piece in turn.  A
+     * datagram which doesn't fit is dropped, not passed on cut short.
+     */
+    offset = 0;
+    if (nbuf_len <= space) {
+	while (niov-- && offset < nbuf_len) {
+	    n = netbuf_copy_partial(nbuf, iov->base, iov->len, offset);
+	    offset += n;
+	    iov++;
+	}
+    }
     netbuf_delete(nbuf);
 
-    *buf_len = nbuf_len;
+    *buf_len = offset;
     return 0;
 }
 
+/**
+ * Largest UDP payload that fits in one frame on our interface
+ */
+uint16_t core_udp_max_payload(void)
+{
+    if (!netif_default || netif_default->mtu <= 28)
+	return 1500 - 28;
+
+    return netif_default->mtu - 28; /* IP and UDP headers */
+}
+
+/**
+ * Replies are delivered to whichever open socket they are addressed to,
+ * so several sockets can wait for answers at the same time
+ */
+bool core_udp_can_demux(void)
+{
+    return true;
+}
+
 /**
  * Send a UDP packet.
  *
@@ -298,6 +334,22 @@ void core_tcp_close_file(struct inode *inode)
     }
 }
 
+/*
+ * Returns true if all received data has been consumed, releasing the
+ * drained netbuf so the connection can be handed to another inode.
+ */
+bool core_tcp_idle(struct pxe_pvt_inode *socket)
+{
+    if (socket->net.lwip.buf) {
+	if (netbuf_next(socket->net.lwip.buf) >= 0)
+	    return false;
+	netbuf_delete(socket->net.lwip.buf);
+	socket->net.lwip.buf = NULL;
+    }
+
+    return true;
+}
+
 bool core_tcp_is_connected(struct pxe_pvt_inode *socket)
 {
     if (socket->net.lwip.conn)
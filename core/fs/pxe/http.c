@@ -1,5 +1,6 @@
 #include <syslinux/sysappend.h>
 #include <ctype.h>
+#include <minmax.h>
 #include <lwip/api.h>
 #include "pxe.h"
 #include "version.h"
@@ -51,6 +52,7 @@ static size_t cookie_len, header_len;
 static char *cookie_buf, *header_buf;
 
 __export uint32_t SendCookies = UINT_MAX; /* Send all cookies */
+__export unsigned int HttpConnections = 1; /* No parallel ranges */
 
 static size_t http_do_bake_cookies(char *q)
 {
@@ -146,20 +148,282 @@ __export void http_bake_cookies(void)
     http_do_bake_cookies(cookie_buf);
 }
 
+/*
+ * Idle keep-alive connections, so that loading a kernel, an initrd
+ * and a pile of modules from the same server costs one TCP handshake
+ * instead of one per file.
+ *
+ * Requests are HTTP/1.1, where connections persist unless either side
+ * says "Connection: close"; the explicit "Connection: keep-alive" is
+ * only for HTTP/1.0 servers and proxies.  Requests are not pipelined:
+ * files are opened one at a time, so the next URL isn't known until
+ * the current one is opened, and each connection carries at most one
+ * outstanding request.  A later file still waits a round trip for its
+ * response, it just doesn't wait for a new handshake as well.
+ */
+#define HTTP_POOL_SIZE	4
+
+static struct http_idle_conn {
+    uint32_t ip;		/* 0 = slot free */
+    uint16_t port;
+    union net_private net;
+} http_pool[HTTP_POOL_SIZE];
+
+static bool http_pool_get(struct pxe_pvt_inode *socket,
+			  uint32_t ip, uint16_t port)
+{
+    struct http_idle_conn *ic;
+
+    for (ic = http_pool; ic < &http_pool[HTTP_POOL_SIZE]; ic++) {
+	if (ic->ip == ip && ic->port == port) {
+	    socket->net = ic->net;
+	    ic->ip = 0;
+	    return true;
+	}
+    }
+    return false;
+}
+
+static bool http_pool_put(struct pxe_pvt_inode *socket)
+{
+    struct http_idle_conn *ic;
+
+    for (ic = http_pool; ic < &http_pool[HTTP_POOL_SIZE]; ic++) {
+	if (!ic->ip) {
+	    ic->ip   = socket->tftp_remoteip;
+	    ic->port = socket->tftp_remoteport;
+	    ic->net  = socket->net;
+	    memset(&socket->net, 0, sizeof socket->net);
+	    return true;
+	}
+    }
+    return false;		/* Pool full, just close it */
+}
+
+/*
+ * Hand the connection back to the pool if the server agreed to keep it
+ * open and the body was read exactly to its end; otherwise close it.
+ */
+static void http_close_file(struct inode *inode)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+
+    if (socket->tftp_keepalive && !socket->tftp_goteof &&
+	inode->size != (uint32_t)-1 &&
+	socket->tftp_filepos == inode->size &&
+	!socket->tftp_bytesleft && !socket->tftp_rawleft &&
+	core_tcp_idle(socket) &&
+	http_pool_put(socket))
+	return;
+
+    core_tcp_close_file(inode);
+}
+
+static uint32_t http_read_bulk(struct inode *inode, char *buf, uint32_t len);
+
 static const struct pxe_conn_ops http_conn_ops = {
     .fill_buffer	= core_tcp_fill_buffer,
-    .close		= core_tcp_close_file,
+    .close		= http_close_file,
     .readdir		= http_readdir,
+    .read_bulk		= http_read_bulk,
 };
 
-void http_open(struct url_info *url, int flags, struct inode *inode,
-	       const char **redir)
+/*
+ * Chunked transfer-coding.  The data of each chunk is handed out in
+ * place from the TCP buffer; tftp_rawleft counts the bytes after it
+ * which haven't been decoded yet, and tftp_filepos only counts data.
+ */
+static int http_raw_getc(struct inode *inode)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+
+    if (!socket->tftp_rawleft) {
+	if (socket->tftp_goteof)
+	    return -1;
+	core_tcp_fill_buffer(inode);
+	socket->tftp_rawleft = socket->tftp_bytesleft;
+	socket->tftp_bytesleft = 0;
+	if (!socket->tftp_rawleft)
+	    return -1;
+    }
+
+    socket->tftp_rawleft--;
+    socket->tftp_filepos--;	/* Framing, not data */
+    return (unsigned char)*socket->tftp_dataptr++;
+}
+
+/*
+ * Read a chunk-size line, skipping the CRLF which ends the previous
+ * chunk and any chunk extensions.  Returns the size, or -1 on EOF.
+ */
+static int64_t http_chunk_size(struct inode *inode)
+{
+    uint32_t size = 0;
+    int ch, digit;
+
+    do {
+	ch = http_raw_getc(inode);
+    } while (ch == '\r' || ch == '\n');
+
+    for (;;) {
+	if (ch >= '0' && ch <= '9')
+	    digit = ch - '0';
+	else if (ch >= 'a' && ch <= 'f')
+	    digit = ch - 'a' + 10;
+	else if (ch >= 'A' && ch <= 'F')
+	    digit = ch - 'A' + 10;
+	else
+	    break;
+	if (size >> 28)
+	    return -1;		/* Absurdly large */
+	size = (size << 4) + digit;
+	ch = http_raw_getc(inode);
+    }
+
+    while (ch != '\n') {
+	if (ch == -1)
+	    return -1;
+	ch = http_raw_getc(inode);
+    }
+
+    return size;
+}
+
+static void http_chunked_fill_buffer(struct inode *inode)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    int64_t size;
+    int ch, linelen;
+
+    if (!socket->tftp_chunkleft) {
+	size = http_chunk_size(inode);
+	if (size < 0)
+	    goto eof;
+
+	if (!size) {
+	    /* Last chunk: skip any trailer fields up to the empty line */
+	    linelen = 0;
+	    while ((ch = http_raw_getc(inode)) != -1) {
+		if (ch == '\n') {
+		    if (!linelen)
+			break;
+		    linelen = 0;
+		} else if (ch != '\r') {
+		    linelen++;
+		}
+	    }
+	    if (ch == -1)
+		goto eof;
+
+	    /* The connection stays open, but this is the end of the file */
+	    inode->size = socket->tftp_filepos - socket->tftp_rawleft;
+	    socket->tftp_sizedone = 1;
+	    return;
+	}
+
+	socket->tftp_chunkleft = size;
+    }
+
+    if (!socket->tftp_rawleft) {
+	if (socket->tftp_goteof)
+	    goto eof;
+	core_tcp_fill_buffer(inode);
+	socket->tftp_rawleft = socket->tftp_bytesleft;
+	socket->tftp_bytesleft = 0;
+	if (!socket->tftp_rawleft)
+	    goto eof;
+    }
+
+    socket->tftp_bytesleft = min(socket->tftp_rawleft, socket->tftp_chunkleft);
+    socket->tftp_rawleft  -= socket->tftp_bytesleft;
+    socket->tftp_chunkleft -= socket->tftp_bytesleft;
+    return;
+
+eof:
+    /* Truncated, there is no telling how much was meant to come */
+    socket->tftp_bytesleft = 0;
+    socket->tftp_rawleft = 0;
+    if (!socket->tftp_goteof) {
+	socket->tftp_goteof = 1;
+	socket->ops->close(inode);
+    }
+    inode->size = socket->tftp_filepos;
+}
+
+static const struct pxe_conn_ops http_chunked_conn_ops = {
+    .fill_buffer	= http_chunked_fill_buffer,
+    .close		= http_close_file,
+    .readdir		= http_readdir,
+};
+
+static char location[FILENAME_MAX];
+
+struct http_response {
+    int status;
+    uint32_t content_length;	/* -1 if not known */
+    bool keepalive;		/* Server will keep the connection open */
+    bool ranges;		/* Server accepts byte ranges */
+    bool chunked;		/* Chunked transfer-coding */
+};
+
+/*
+ * Apply a header field once its (possibly continued) value is complete.
+ */
+static void http_header_field(const char *name, const char *value,
+			      struct http_response *resp)
+{
+    const char *next = value;
+
+    /* Skip leading whitespace */
+    while (isspace(*next))
+	next++;
+
+    if (strcasecmp(name, "Content-Length") == 0) {
+	uint32_t len = 0;
+
+	for (;(*next >= '0' && *next <= '9'); next++) {
+	    if ((len * 10) < len)
+		break;
+	    len = (len * 10) + (*next - '0');
+	}
+	/* In the case of overflow or other error ignore
+	 * Content-Length.
+	 */
+	resp->content_length = *next ? (uint32_t)-1 : len;
+    }
+    else if (strcasecmp(name, "Location") == 0) {
+	strlcpy(location, next, sizeof location);
+    }
+    else if (strcasecmp(name, "Connection") == 0) {
+	if (strcasecmp(next, "close") == 0)
+	    resp->keepalive = false;
+	else if (strcasecmp(next, "keep-alive") == 0)
+	    resp->keepalive = true;
+    }
+    else if (strcasecmp(name, "Accept-Ranges") == 0) {
+	resp->ranges = strcasecmp(next, "bytes") == 0;
+    }
+    else if (strcasecmp(name, "Transfer-Encoding") == 0) {
+	/* Only "chunked" itself; we can't undo any other coding */
+	resp->chunked = strcasecmp(next, "chunked") == 0;
+    }
+}
+
+/*
+ * Send a request on a connection to ip:port, reusing an idle one if
+ * the pool has it, and parse the response header.  On return the
+ * header has been consumed and the socket is positioned at the start
+ * of the body.  Returns 0 if a response was received, or -1; in either
+ * case the caller is responsible for closing the connection.
+ */
+static int http_request(struct inode *inode, uint32_t ip, uint16_t port,
+			const char *req, size_t req_len,
+			struct http_response *resp)
 {
     struct pxe_pvt_inode *socket = PVT(inode);
-    int header_bytes;
-    const char *next;
     char field_name[20];
     char field_value[1024];
+    char httpver[4];
     size_t field_name_len, field_value_len;
     enum state {
 	st_httpver,
@@ -172,70 +436,46 @@ void http_open(struct url_info *url, int flags, struct inode *inode,
 	st_skip_fieldvalue,
 	st_eoh,
     } state;
-    static char location[FILENAME_MAX];
-    uint32_t content_length; /* same as inode->size */
     size_t response_size;
+    bool reused;
     int status;
     int pos;
     int err;
 
-    (void)flags;
+    socket->tftp_remoteip   = ip;
+    socket->tftp_remoteport = port;
 
-    if (!header_buf)
-	return;			/* http is broken... */
-
-    /* This is a straightforward TCP connection after headers */
-    socket->ops = &http_conn_ops;
+    /* Try an idle connection to this server first */
+    reused = http_pool_get(socket, ip, port);
 
+retry:
     /* Reset all of the variables */
-    inode->size = content_length = -1;
-
-    /* Start the http connection */
-    err = core_tcp_open(socket);
-    if (err)
-        return;
-
-    if (!url->port)
-	url->port = HTTP_PORT;
-
-    err = core_tcp_connect(socket, url->ip, url->port);
-    if (err)
-	goto fail;
-
-    strcpy(header_buf, "GET /");
-    header_bytes = 5;
-    header_bytes += url_escape_unsafe(header_buf+5, url->path,
-				      header_len - 5);
-    if (header_bytes >= header_len)
-	goto fail;		/* Buffer overflow */
-    header_bytes += snprintf(header_buf + header_bytes,
-			     header_len - header_bytes,
-			     " HTTP/1.0\r\n"
-			     "Host: %s",
-			     url->host);
-    if (header_bytes >= header_len)
-	goto fail;		/* Buffer overflow */
-    if (url->port != HTTP_PORT) {
-	header_bytes += snprintf(header_buf + header_bytes,
-			     header_len - header_bytes,
-			     ":%d", url->port);
-	if (header_bytes >= header_len)
-	    goto fail;		/* Buffer overflow */
+    inode->size = resp->content_length = -1;
+    resp->keepalive = false;
+    resp->ranges = false;
+    resp->chunked = false;
+    location[0] = '\0';
+    socket->tftp_filepos   = 0;
+    socket->tftp_bytesleft = 0;
+    socket->tftp_rawleft   = 0;
+    socket->tftp_chunkleft = 0;
+    socket->tftp_goteof    = 0;
+    socket->tftp_keepalive = 0;
+
+    if (!reused) {
+	/* Start the http connection */
+	err = core_tcp_open(socket);
+	if (err)
+	    return -1;
+
+	err = core_tcp_connect(socket, ip, port);
+	if (err)
+	    return -1;
     }
-    header_bytes += snprintf(header_buf + header_bytes,
-			     header_len - header_bytes,
-			     "\r\n"
-			     "User-Agent: Syslinux/" VERSION_STR "\r\n"
-			     "Connection: close\r\n"
-			     "%s"
-			     "\r\n",
-			     cookie_buf ? cookie_buf : "");
-    if (header_bytes >= header_len)
-	goto fail;		/* Buffer overflow */
 
-    err = core_tcp_write(socket, header_buf, header_bytes, false);
+    err = core_tcp_write(socket, req, req_len, false);
     if (err)
-	goto fail;
+	goto stale;
 
     /* Parse the HTTP header */
     state = st_httpver;
@@ -244,12 +484,18 @@ void http_open(struct url_info *url, int flags, struct inode *inode,
     response_size = 0;
     field_value_len = 0;
     field_name_len = 0;
+    field_name[0] = '\0';
+    field_value[0] = '\0';
+    httpver[0] = '\0';
 
     while (state != st_eoh) {
 	int ch = pxe_getc(inode);
 	/* Eof before I finish paring the header */
-	if (ch == -1)
-	    goto fail;
+	if (ch == -1) {
+	    if (!response_size)
+		goto stale;
+	    return -1;
+	}
 #if 0
         printf("%c", ch);
 #endif
@@ -259,14 +505,21 @@ void http_open(struct url_info *url, int flags, struct inode *inode,
 	switch (state) {
 	case st_httpver:
 	    if (ch == ' ') {
+		/* HTTP/1.1 and later default to persistent connections */
+		resp->keepalive = strcmp(httpver, "1.0") > 0;
 		state = st_stcode;
 		pos = 0;
+	    } else if (pos < (int)sizeof httpver - 1 &&
+		       ((ch >= '0' && ch <= '9') || ch == '.')) {
+		/* Keep the "1.x" part of "HTTP/1.x" */
+		httpver[pos++] = ch;
+		httpver[pos] = '\0';
 	    }
 	    break;
 
 	case st_stcode:
 	    if (ch < '0' || ch > '9')
-	       goto fail;
+	       return -1;
 	    status = (status*10) + (ch - '0');
 	    if (++pos == 3)
 		state = st_skipline;
@@ -278,8 +531,11 @@ void http_open(struct url_info *url, int flags, struct inode *inode,
 	    break;
 
 	case st_fieldfirst:
-	    if (ch == '\n')
+	    if (ch == '\n') {
+		/* Process the last field */
+		http_header_field(field_name, field_value, resp);
 		state = st_eoh;
+	    }
 	    else if (isspace(ch)) {
 		/* A continuation line */
 		state = st_fieldvalue;
@@ -287,30 +543,7 @@ void http_open(struct url_info *url, int flags, struct inode *inode,
 	    }
 	    else if (is_token(ch)) {
 		/* Process the previous field before starting on the next one */
-		if (strcasecmp(field_name, "Content-Length") == 0) {
-		    next = field_value;
-		    /* Skip leading whitespace */
-		    while (isspace(*next))
-			next++;
-		    content_length = 0;
-		    for (;(*next >= '0' && *next <= '9'); next++) {
-			if ((content_length * 10) < content_length)
-			    break;
-			content_length = (content_length * 10) + (*next - '0');
-		    }
-		    /* In the case of overflow or other error ignore
-		     * Content-Length.
-		     */
-		    if (*next)
-			content_length = -1;
-		}
-		else if (strcasecmp(field_name, "Location") == 0) {
-		    next = field_value;
-		    /* Skip leading whitespace */
-		    while (isspace(*next))
-			next++;
-		    strlcpy(location, next, sizeof location);
-		}
+		http_header_field(field_name, field_value, resp);
 		/* Start the field name and field value afress */
 		field_name_len = 1;
 		field_name[0] = ch;
@@ -372,17 +605,121 @@ void http_open(struct url_info *url, int flags, struct inode *inode,
 	}
     }
 
-    if (state != st_eoh)
-	status = 0;
+    resp->status = status;
+
+    /* Treat the remainder of the bytes as data */
+    socket->tftp_filepos -= response_size;
+
+    if (resp->chunked) {
+	/* The length is in the chunks; Content-Length must be ignored */
+	resp->content_length = -1;
+	socket->ops = &http_chunked_conn_ops;
+	socket->tftp_rawleft = socket->tftp_bytesleft;
+	socket->tftp_bytesleft = 0;
+    }
+
+    /* Reuse is only safe if we know where this response ends */
+    inode->size = resp->content_length;
+    socket->tftp_keepalive = resp->keepalive &&
+	(resp->chunked || resp->content_length != (uint32_t)-1);
+    return 0;
+
+stale:
+    /*
+     * A pooled connection may have been closed by the server while it
+     * sat idle; that shows up as a failed write or an immediate EOF.
+     * Try once more on a fresh connection.
+     */
+    if (reused) {
+	if (core_tcp_is_connected(socket))
+	    core_tcp_close_file(inode);
+	reused = false;
+	goto retry;
+    }
+    return -1;
+}
+
+/*
+ * Close a connection http_request() left open, whatever state it is in.
+ */
+static void http_abort(struct inode *inode)
+{
+    inode->size = 0;
+    if (core_tcp_is_connected(PVT(inode)))
+	core_tcp_close_file(inode);
+}
 
-    switch (status) {
+void http_open(struct url_info *url, int flags, struct inode *inode,
+	       const char **redir)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    struct http_response resp;
+    int header_bytes;
+    int err;
+
+    (void)flags;
+
+    if (!header_buf)
+	return;			/* http is broken... */
+
+    /* This is a straightforward TCP connection after headers */
+    socket->ops = &http_conn_ops;
+
+    if (!url->port)
+	url->port = HTTP_PORT;
+
+    strcpy(header_buf, "GET /");
+    header_bytes = 5;
+    header_bytes += url_escape_unsafe(header_buf+5, url->path,
+				      header_len - 5);
+    if (header_bytes >= header_len)
+	goto fail;		/* Buffer overflow */
+    header_bytes += snprintf(header_buf + header_bytes,
+			     header_len - header_bytes,
+			     " HTTP/1.1\r\n"
+			     "Host: %s",
+			     url->host);
+    if (header_bytes >= header_len)
+	goto fail;		/* Buffer overflow */
+    if (url->port != HTTP_PORT) {
+	header_bytes += snprintf(header_buf + header_bytes,
+			     header_len - header_bytes,
+			     ":%d", url->port);
+	if (header_bytes >= header_len)
+	    goto fail;		/* Buffer overflow */
+    }
+    header_bytes += snprintf(header_buf + header_bytes,
+			     header_len - header_bytes,
+			     "\r\n"
+			     "User-Agent: Syslinux/" VERSION_STR "\r\n"
+			     "Connection: keep-alive\r\n"
+			     "%s"
+			     "\r\n",
+			     cookie_buf ? cookie_buf : "");
+    if (header_bytes >= header_len)
+	goto fail;		/* Buffer overflow */
+
+    err = http_request(inode, url->ip, url->port,
+		       header_buf, header_bytes, &resp);
+    if (err)
+	goto fail;
+
+    switch (resp.status) {
     case 200:
 	/*
 	 * All OK, need to mark header data consumed and set up a file
 	 * structure...
 	 */
-	/* Treat the remainder of the bytes as data */
-	socket->tftp_filepos -= response_size;
+	/*
+	 * Keep the request around if the rest of the file could be
+	 * fetched in parallel ranges later on.
+	 */
+	if (resp.ranges && HttpConnections > 1 &&
+	    resp.content_length != (uint32_t)-1) {
+	    socket->tftp_pktbuf = malloc(header_bytes + 1);
+	    if (socket->tftp_pktbuf)
+		memcpy(socket->tftp_pktbuf, header_buf, header_bytes + 1);
+	}
 	break;
     case 301:
     case 302:
@@ -399,7 +736,193 @@ void http_open(struct url_info *url, int flags, struct inode *inode,
     }
     return;
 fail:
-    inode->size = 0;
-    core_tcp_close_file(inode);
+    http_abort(inode);
     return;
 }
+
+/*
+ * Parallel range downloads.  A large read is split into slices: the
+ * first comes from the open connection and each of the others from
+ * its own connection with a Range request, so that the server is
+ * filling several TCP windows at once.  The last range is left open
+ * ended, and afterwards that connection simply takes over as the
+ * file's connection.
+ */
+#define HTTP_RANGE_MAX	8		/* Most connections per file */
+#define HTTP_RANGE_MIN	(1 << 20)	/* Smallest slice worth a connection */
+
+struct http_slice {
+    struct inode *inode;
+    char *buf;
+    uint32_t left;
+};
+
+/*
+ * Open another connection for bytes start..end of the file, or start
+ * to the end of the file if end is -1.
+ */
+static struct inode *http_range_open(struct inode *inode,
+				     uint32_t start, uint32_t end)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    struct http_response resp;
+    struct inode *range;
+    uint32_t len;
+    int bytes;
+
+    range = allocate_socket(inode->fs);
+    if (!range)
+	return NULL;
+    PVT(range)->ops = &http_conn_ops;
+
+    /* The saved request, with a Range field before the final CRLF */
+    bytes = strlen(socket->tftp_pktbuf) - 2;
+    memcpy(header_buf, socket->tftp_pktbuf, bytes);
+    if (end == (uint32_t)-1) {
+	bytes += snprintf(header_buf + bytes, header_len - bytes,
+			  "Range: bytes=%u-\r\n\r\n", start);
+	len = inode->size - start;
+    } else {
+	bytes += snprintf(header_buf + bytes, header_len - bytes,
+			  "Range: bytes=%u-%u\r\n\r\n", start, end);
+	len = end - start + 1;
+    }
+    if (bytes >= header_len)
+	goto fail;		/* Buffer overflow */
+
+    if (http_request(range, socket->tftp_remoteip, socket->tftp_remoteport,
+		     header_buf, bytes, &resp))
+	goto fail;
+
+    /* Anything but exactly the range we asked for is no use */
+    if (resp.status != 206 || resp.content_length != len)
+	goto fail;
+
+    return range;
+
+fail:
+    http_abort(range);
+    free_socket(range);
+    return NULL;
+}
+
+static void http_range_close(struct inode *range)
+{
+    struct pxe_pvt_inode *socket = PVT(range);
+
+    if (!socket->tftp_goteof)
+	socket->ops->close(range);
+    free_socket(range);
+}
+
+static uint32_t http_read_bulk(struct inode *inode, char *buf, uint32_t len)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    struct pxe_pvt_inode *last;
+    struct http_slice slice[HTTP_RANGE_MAX];
+    struct http_slice *sl;
+    uint32_t start = socket->tftp_filepos;
+    uint32_t per, chunk;
+    unsigned int n, i;
+    bool active, failed = false;
+
+    if (!socket->tftp_pktbuf || socket->tftp_goteof)
+	return 0;		/* Server doesn't do ranges */
+
+    if (len > inode->size - start)
+	len = inode->size - start;
+
+    n = len / HTTP_RANGE_MIN;
+    if (n > HttpConnections)
+	n = HttpConnections;
+    if (n > HTTP_RANGE_MAX)
+	n = HTTP_RANGE_MAX;
+    if (n < 2)
+	return 0;
+
+    per = len / n;
+    for (i = 0; i < n; i++) {
+	sl = &slice[i];
+	sl->buf  = buf + i * per;
+	sl->left = (i == n-1) ? len - i * per : per;
+	if (!i) {
+	    sl->inode = inode;
+	    continue;
+	}
+
+	sl->inode = http_range_open(inode, start + i * per,
+				    (i == n-1) ? (uint32_t)-1
+				    : start + (i + 1) * per - 1);
+	if (!sl->inode)
+	    goto fail;
+    }
+
+    /*
+     * Take a buffer from each connection in turn; while we wait on one,
+     * the network stack keeps receiving on all the others.
+     */
+    do {
+	active = false;
+	for (i = 0; i < n && !failed; i++) {
+	    struct pxe_pvt_inode *s;
+
+	    sl = &slice[i];
+	    if (!sl->left)
+		continue;
+
+	    s = PVT(sl->inode);
+	    if (!s->tftp_bytesleft && !s->tftp_goteof)
+		s->ops->fill_buffer(sl->inode);
+	    if (!s->tftp_bytesleft) {
+		failed = true;	/* Connection ended early */
+		break;
+	    }
+
+	    chunk = sl->left;
+	    if (chunk > s->tftp_bytesleft)
+		chunk = s->tftp_bytesleft;
+	    memcpy(sl->buf, s->tftp_dataptr, chunk);
+	    s->tftp_dataptr   += chunk;
+	    s->tftp_bytesleft -= chunk;
+	    sl->buf  += chunk;
+	    sl->left -= chunk;
+	    if (sl->left)
+		active = true;
+	}
+    } while (active && !failed);
+
+    if (failed) {
+	/*
+	 * The file's own connection is still in step with what it has
+	 * delivered, so hand back that much and carry on without ranges.
+	 */
+	len = slice[0].buf - buf;
+	i = n;
+	goto fail;
+    }
+
+    /* The last connection continues where this read ends */
+    last = PVT(slice[n-1].inode);
+    if (!socket->tftp_goteof)
+	core_tcp_close_file(inode);
+    socket->net            = last->net;
+    socket->tftp_dataptr   = last->tftp_dataptr;
+    socket->tftp_bytesleft = last->tftp_bytesleft;
+    socket->tftp_goteof    = last->tftp_goteof;
+    socket->tftp_keepalive = last->tftp_keepalive;
+    socket->tftp_filepos   = start + (n-1) * per + last->tftp_filepos;
+    memset(&last->net, 0, sizeof last->net);
+    last->tftp_goteof = 1;	/* Nothing left to close */
+
+    for (i = 1; i < n; i++)
+	http_range_close(slice[i].inode);
+
+    return len;
+
+fail:
+    while (--i > 0)
+	http_range_close(slice[i].inode);
+    free(socket->tftp_pktbuf);
+    socket->tftp_pktbuf = NULL;
+    return failed ? len : 0;
+}
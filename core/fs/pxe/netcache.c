@@ -0,0 +1,261 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * netcache.c
+ *
+ * Keep the contents of recently loaded network files in memory, so
+ * that opening them again (modules, menu backgrounds, configuration
+ * files re-read on returning to the menu) doesn't go to the server.
+ *
+ * A file is recorded while it is read through pxe_getfssec(), and
+ * enters the cache once it has been read to the end: all of the size
+ * announced when it was opened or, if none was, up to an end the
+ * protocol marks explicitly (TFTP's short block, HTTP's last chunk).
+ * A connection that merely closes could have been cut off.  Files are
+ * keyed by their full URL; the least recently used ones are dropped
+ * to stay within NetCacheSize bytes, and no file may take more than
+ * half of that.  Entries are refcounted, so a file that is open can
+ * be evicted without pulling the data out from under its reader.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <dprintf.h>
+#include <minmax.h>
+#include <linux/list.h>
+#include "pxe.h"
+
+struct netcache_entry {
+    struct list_head list;	/* LRU list, most recent first */
+    char *data;
+    uint32_t size;		/* Bytes of data */
+    uint32_t alloc;		/* Bytes allocated for data */
+    bool sized;			/* Size was known when the file opened */
+    int refcnt;			/* The cache plus one per open file */
+    char url[];
+};
+
+/* Memory budget, from the NETCACHESIZE option; 0, the default, is off */
+__export uint32_t NetCacheSize = 0;
+
+static LIST_HEAD(netcache_lru);
+static uint32_t netcache_used;
+
+static void netcache_put(struct netcache_entry *e)
+{
+    if (--e->refcnt)
+	return;
+
+    free(e->data);
+    free(e);
+}
+
+static void netcache_drop(struct netcache_entry *e)
+{
+    dprintf("netcache: dropping %s\n", e->url);
+    list_del(&e->list);
+    netcache_used -= e->size;
+    netcache_put(e);
+}
+
+static struct netcache_entry *netcache_find(const char *url)
+{
+    struct netcache_entry *e;
+
+    list_for_each_entry(e, &netcache_lru, list) {
+	if (!strcmp(e->url, url))
+	    return e;
+    }
+    return NULL;
+}
+
+/*
+ * Drop the least recently used files until WANT more bytes fit.
+ */
+static void netcache_trim(uint32_t want)
+{
+    while (!list_empty(&netcache_lru) && netcache_used + want > NetCacheSize)
+	netcache_drop(list_entry(netcache_lru.prev, struct netcache_entry,
+				 list));
+}
+
+/*
+ * Serving a cached file: all of it is "downloaded" already, and
+ * read_bulk copies straight out of the cached data.
+ */
+static uint32_t netcache_read_bulk(struct inode *inode, char *buf,
+				   uint32_t len)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    struct netcache_entry *e = socket->cache;
+    uint32_t left = e->data + e->size - socket->tftp_dataptr;
+
+    len = min(len, left);
+    memcpy(buf, socket->tftp_dataptr, len);
+    socket->tftp_dataptr += len;
+
+    return len;
+}
+
+static void netcache_nop(struct inode *inode)
+{
+    (void)inode;
+}
+
+static const struct pxe_conn_ops netcache_conn_ops = {
+    .fill_buffer	= netcache_nop,
+    .close		= netcache_nop,
+    .read_bulk		= netcache_read_bulk,
+};
+
+/*
+ * Open URL from the cache.  Returns a new socket inode reading the
+ * cached copy, or NULL if we don't have it.
+ */
+struct inode *netcache_open(struct fs_info *fs, const char *url)
+{
+    struct netcache_entry *e;
+    struct pxe_pvt_inode *socket;
+    struct inode *inode;
+
+    netcache_trim(0);		/* In case the budget was lowered */
+
+    e = netcache_find(url);
+    if (!e)
+	return NULL;
+
+    inode = allocate_socket(fs);
+    if (!inode)
+	return NULL;
+
+    dprintf("netcache: hit %s\n", url);
+    list_move(&e->list, &netcache_lru);
+    e->refcnt++;
+
+    socket = PVT(inode);
+    socket->ops = &netcache_conn_ops;
+    socket->cache = e;
+    socket->tftp_dataptr = e->data;
+    socket->tftp_filepos = e->size;
+    socket->tftp_goteof = 1;
+    inode->size = e->size;
+
+    return inode;
+}
+
+/*
+ * Start recording a file just opened from the network.
+ */
+void netcache_start(struct inode *inode, const char *url)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    struct netcache_entry *e;
+    bool known = !pxe_size_unknown(inode);
+
+    if (!NetCacheSize || (known && inode->size > NetCacheSize / 2))
+	return;
+
+    e = malloc(sizeof *e + strlen(url) + 1);
+    if (!e)
+	return;
+
+    e->size = 0;
+    e->sized = known;
+    e->alloc = known ? inode->size : min(65536, NetCacheSize / 2);
+    e->data = malloc(e->alloc);
+    if (!e->data) {
+	free(e);
+	return;
+    }
+    e->refcnt = 1;
+    strcpy(e->url, url);
+
+    socket->cache = e;
+}
+
+/*
+ * Record LEN more bytes of a file being read; EOF is set once the
+ * reader has everything.
+ */
+void netcache_record(struct inode *inode, const char *buf, uint32_t len,
+		     bool eof)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    struct netcache_entry *e = socket->cache, *old;
+    uint32_t need, alloc;
+    char *data;
+
+    if (!e || socket->ops == &netcache_conn_ops)
+	return;
+
+    need = e->size + len;
+    if (need > e->alloc) {
+	/* Only files of unknown size should need to grow */
+	alloc = max(need, e->alloc * 2);
+	if (need > NetCacheSize / 2)
+	    goto abandon;
+	alloc = min(alloc, NetCacheSize / 2);
+	data = realloc(e->data, alloc);
+	if (!data)
+	    goto abandon;
+	e->data = data;
+	e->alloc = alloc;
+    }
+    memcpy(e->data + e->size, buf, len);
+    e->size = need;
+
+    if (!eof && (pxe_size_unknown(inode) || e->size < inode->size))
+	return;
+
+    /* Only a file we know we have all of may be served again */
+    if (!e->size || e->size > NetCacheSize / 2)
+	goto abandon;
+    if (e->sized ? e->size != inode->size : !socket->tftp_sizedone)
+	goto abandon;
+
+    /* Complete: the recording becomes the cache's reference */
+    socket->cache = NULL;
+
+    if (e->alloc > e->size) {
+	data = realloc(e->data, e->size);
+	if (data)
+	    e->data = data;
+    }
+
+    /* Someone else may have loaded the same file meanwhile */
+    old = netcache_find(e->url);
+    if (old)
+	netcache_drop(old);
+
+    netcache_trim(e->size);
+    list_add(&e->list, &netcache_lru);
+    netcache_used += e->size;
+    dprintf("netcache: added %s, %u bytes\n", e->url, e->size);
+    return;
+
+abandon:
+    socket->cache = NULL;
+    netcache_put(e);
+}
+
+/*
+ * The socket is going away; drop its reference to a cached file, or
+ * abandon a recording which never got to the end.
+ */
+void netcache_release(struct inode *inode)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+
+    if (socket->cache) {
+	netcache_put(socket->cache);
+	socket->cache = NULL;
+    }
+}
@@ -27,7 +27,7 @@ bool have_uuid = false;
  * Allocate a local UDP port structure and assign it a local port number.
  * Return the inode pointer if success, or null if failure
  */
-static struct inode *allocate_socket(struct fs_info *fs)
+struct inode *allocate_socket(struct fs_info *fs)
 {
     struct inode *inode = alloc_inode(fs, 0, sizeof(struct pxe_pvt_inode));
 
@@ -44,6 +44,7 @@ void free_socket(struct inode *inode)
 {
     struct pxe_pvt_inode *socket = PVT(inode);
 
+    netcache_release(inode);
     free(socket->tftp_pktbuf);	/* If we allocated a buffer, free it now */
     free_inode(inode);
 }
@@ -201,9 +202,20 @@ static uint32_t pxe_getfssec(struct file *file, char *buf,
     int count = blocks;
     int chunk;
     int bytes_read = 0;
+    char *start = buf;
 
     count <<= TFTP_BLOCKSIZE_LG2;
     while (count) {
+	/* Let the protocol take large reads in one go if it can */
+	if (!socket->tftp_bytesleft && socket->ops->read_bulk) {
+	    chunk = socket->ops->read_bulk(inode, buf, count);
+	    buf += chunk;
+	    bytes_read += chunk;
+	    count -= chunk;
+	    if (chunk)
+		continue;
+	}
+
         fill_buffer(inode); /* If we have no 'fresh' buffer, get it */
         if (!socket->tftp_bytesleft)
             break;
@@ -223,14 +235,19 @@ static uint32_t pxe_getfssec(struct file *file, char *buf,
     if (socket->tftp_bytesleft || (socket->tftp_filepos < inode->size)) {
 	fill_buffer(inode);
         *have_more = 1;
-    } else if (socket->tftp_goteof) {
+    } else {
         /*
-         * The socket is closed and the buffer drained; the caller will
-	 * call close_file and therefore free the socket.
+         * The buffer is drained and either the socket is closed or
+	 * the whole file has arrived on a connection that stays open
+	 * (HTTP keep-alive); the caller will call close_file and
+	 * therefore free the socket.
          */
         *have_more = 0;
     }
 
+    if (socket->cache)
+	netcache_record(inode, start, bytes_read, !*have_more);
+
     return bytes_read;
 }
 
@@ -270,15 +287,40 @@ __export int url_set_ip(struct url_info *url)
 static void __pxe_searchdir(const char *filename, int flags, struct file *file);
 extern uint16_t PXERetry;
 
+/* A config file already opened by pxe_probe_config() */
+static struct inode *probed_inode;
+static char probed_name[FILENAME_MAX];
+
 static void pxe_searchdir(const char *filename, int flags, struct file *file)
 {
+    char url[2*FILENAME_MAX];
     int i = PXERetry;
 
-    do {
-	dprintf("PXE: file = %p, retries left = %d: ", file, i);
-	__pxe_searchdir(filename, flags, file);
-	dprintf("%s\n", file->inode ? "ok" : "failed");
-    } while (!file->inode && i--);
+    snprintf(url, sizeof url, "%s%s",
+	     url_type(filename) == URL_SUFFIX ? file->fs->cwd_name : "",
+	     filename);
+
+    if (probed_inode && !strcmp(filename, probed_name)) {
+	/* Already opened while looking for the config file */
+	file->inode = probed_inode;
+	probed_inode = NULL;
+    } else {
+	/* Loaded before, and still in memory? */
+	if (!(flags & O_DIRECTORY)) {
+	    file->inode = netcache_open(file->fs, url);
+	    if (file->inode)
+		return;
+	}
+
+	do {
+	    dprintf("PXE: file = %p, retries left = %d: ", file, i);
+	    __pxe_searchdir(filename, flags, file);
+	    dprintf("%s\n", file->inode ? "ok" : "failed");
+	} while (!file->inode && i--);
+    }
+
+    if (file->inode && !(flags & O_DIRECTORY))
+	netcache_start(file->inode, url);
 }
 static void __pxe_searchdir(const char *filename, int flags, struct file *file)
 {
@@ -439,14 +481,75 @@ static int pxe_chdir_start(void)
 	return 0;
 }
 
+/*
+ * The candidate config file names, most preferred first: UUID, MAC
+ * address, the hexadecimal IP address and its seven prefixes, and
+ * finally "default".
+ */
+#define MAX_CONFIG_NAMES	11
+
+/*
+ * Look for all the candidate config files at once.  Returns the index
+ * of the best one that exists, which pxe_searchdir() will hand out
+ * without asking the server again; -1 if none of them exists; or -2 if
+ * they couldn't be probed together, e.g. because the prefix isn't a
+ * TFTP path or the network stack can only wait on one socket.
+ */
+static int pxe_probe_config(char (*names)[FILENAME_MAX], int n)
+{
+    struct url_info url[MAX_CONFIG_NAMES];
+    struct inode *inodes[MAX_CONFIG_NAMES];
+    char (*fullpath)[2*FILENAME_MAX];
+    int i, allocated = 0, found = -2;
+
+    fullpath = malloc(n * sizeof *fullpath);
+    if (!fullpath)
+	return -2;
+
+    for (i = 0; i < n; i++) {
+	strlcpy(fullpath[i], names[i], sizeof fullpath[i]);
+	parse_url(&url[i], fullpath[i]);
+	if (url[i].type == URL_SUFFIX) {
+	    snprintf(fullpath[i], sizeof fullpath[i], "%s%s",
+		     this_fs->cwd_name, names[i]);
+	    parse_url(&url[i], fullpath[i]);
+	}
+	if (strcmp(url[i].scheme, "tftp"))
+	    goto out;
+	url_set_ip(&url[i]);
+    }
+
+    for (allocated = 0; allocated < n; allocated++) {
+	inodes[allocated] = allocate_socket(this_fs);
+	if (!inodes[allocated])
+	    goto out;
+    }
+
+    found = tftp_probe(url, inodes, n);
+    if (found >= 0) {
+	probed_inode = inodes[found];
+	strlcpy(probed_name, names[found], sizeof probed_name);
+    }
+
+out:
+    for (i = 0; i < allocated; i++) {
+	if (i != found)
+	    free_socket(inodes[i]);
+    }
+    free(fullpath);
+    return found;
+}
+
 /* Load the config file, return -1 if failed, or 0 */
 static int pxe_open_config(struct com32_filedata *filedata)
 {
     const char *cfgprefix = "pxelinux.cfg/";
     const char *default_str = "default";
+    char (*names)[FILENAME_MAX];
     char *config_file;
-    char *last;
+    char ip_str[9];
     int tries = 8;
+    int i, n = 0;
 
     chdir(path_prefix);
     if (DHCPMagic & 0x02) {
@@ -458,35 +561,52 @@ static int pxe_open_config(struct com32_filedata *filedata)
     /*
      * Have to guess config file name ...
      */
-    config_file = stpcpy(ConfigName, cfgprefix);
+    names = malloc(MAX_CONFIG_NAMES * sizeof *names);
+    if (!names)
+	malloc_error("config file names");
 
     /* Try loading by UUID */
     if (sysappend_strings[SYSAPPEND_SYSUUID]) {
+	config_file = stpcpy(names[n++], cfgprefix);
 	strcpy(config_file, sysappend_strings[SYSAPPEND_SYSUUID]+8);
-	if (open_file(ConfigName, O_RDONLY, filedata) >= 0)
-            return 0;
     }
 
     /* Try loading by MAC address */
+    config_file = stpcpy(names[n++], cfgprefix);
     strcpy(config_file, sysappend_strings[SYSAPPEND_BOOTIF]+7);
-    if (open_file(ConfigName, O_RDONLY, filedata) >= 0)
-        return 0;
 
     /* Nope, try hexadecimal IP prefixes... */
-    sprintf(config_file, "%08X", ntohl(IPInfo.myip));
-    last = &config_file[8];
+    sprintf(ip_str, "%08X", ntohl(IPInfo.myip));
     while (tries) {
-        *last = '\0';        /* Zero-terminate string */
-	if (open_file(ConfigName, O_RDONLY, filedata) >= 0)
-            return 0;
-        last--;           /* Drop one character */
-        tries--;
-    };
+	config_file = stpcpy(names[n++], cfgprefix);
+	memcpy(config_file, ip_str, tries);
+	config_file[tries] = '\0';	/* Drop one more character each time */
+	tries--;
+    }
 
     /* Final attempt: "default" string */
+    config_file = stpcpy(names[n++], cfgprefix);
     strcpy(config_file, default_str);
-    if (open_file(ConfigName, O_RDONLY, filedata) >= 0)
-        return 0;
+
+    /* Ask for all of them at once if we can, else one by one */
+    i = pxe_probe_config(names, n);
+    if (i == -2) {
+	for (i = 0; i < n; i++) {
+	    strcpy(ConfigName, names[i]);
+	    if (open_file(ConfigName, O_RDONLY, filedata) >= 0)
+		break;
+	}
+	if (i == n)
+	    i = -1;
+    } else if (i >= 0) {
+	strcpy(ConfigName, names[i]);
+	if (open_file(ConfigName, O_RDONLY, filedata) < 0)
+	    i = -1;
+    }
+
+    free(names);
+    if (i >= 0)
+	return 0;
 
     ddprintf("%-68s\n", "Unable to locate configuration file");
     kaboom();
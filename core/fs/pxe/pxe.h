@@ -107,6 +107,7 @@ struct bootp_t {
 
 struct netconn;
 struct netbuf;
+struct netcache_entry;
 struct efi_binding;
 
 /*
@@ -116,6 +117,7 @@ struct pxe_conn_ops {
     void (*fill_buffer)(struct inode *inode);
     void (*close)(struct inode *inode);
     int (*readdir)(struct inode *inode, struct dirent *dirent);
+    uint32_t (*read_bulk)(struct inode *inode, char *buf, uint32_t len);
 };    
 
 union net_private {
@@ -130,21 +132,30 @@ union net_private {
     struct net_private_efi {
 	struct efi_binding *binding; /* EFI binding for protocol */
 	uint16_t localport;          /* Local port number (0=not in use) */
+	char *rxbuf;                 /* TCP receive buffer */
     } efi;
 };
 
 struct pxe_pvt_inode {
     union net_private net;	  /* Network stack private data */
     uint16_t tftp_remoteport;     /* Remote port number */
+    uint32_t tftp_remoteip;       /* Remote IP address (HTTP keep-alive) */
+    uint32_t tftp_chunkleft;      /* Bytes left in this HTTP chunk */
+    uint16_t tftp_rawleft;        /* Undecoded bytes after the data */
     uint32_t tftp_filepos;        /* bytes downloaded (including buffer) */
     uint32_t tftp_blksize;        /* Block size for this connection(*) */
     uint16_t tftp_bytesleft;      /* Unclaimed data bytes */
     uint16_t tftp_lastpkt;        /* Sequence number of last packet (HBO) */
     char    *tftp_dataptr;        /* Pointer to available data */
     uint8_t  tftp_goteof;         /* 1 if the EOF packet received */
-    uint8_t  tftp_unused[3];      /* Currently unused */
+    uint8_t  tftp_windowsize;     /* Packets per ACK (RFC 7440) */
+    uint8_t  tftp_unacked;        /* Packets received since last ACK */
+    uint8_t  tftp_keepalive;      /* 1 if the server allows reuse (HTTP) */
+    uint8_t  tftp_sizedone;       /* 1 if the protocol marked the end */
+    uint8_t  tftp_unused[2];      /* Currently unused */
     char    *tftp_pktbuf;         /* Packet buffer */
     struct inode *ctl;	          /* Control connection (for FTP) */
+    struct netcache_entry *cache; /* Cached copy being read or recorded */
     const struct pxe_conn_ops *ops;
 };
 
@@ -205,6 +216,15 @@ static inline uint32_t gateway(uint32_t ip)
 	return 0;
 }
 
+/*
+ * TFTP marks a file of unknown size with a 64-bit -1, HTTP with its
+ * 32-bit content length of -1.
+ */
+static inline bool pxe_size_unknown(const struct inode *inode)
+{
+    return inode->size == (uint64_t)-1 || inode->size == (uint32_t)-1;
+}
+
 /*
  * functions
  */
@@ -224,6 +244,7 @@ int reset_pxe(void);
 struct url_info;
 bool ip_ok(uint32_t);
 int pxe_getc(struct inode *inode);
+struct inode *allocate_socket(struct fs_info *fs);
 void free_socket(struct inode *inode);
 
 /* undiif.c */
@@ -238,9 +259,17 @@ void parse_dhcp(const void *, size_t, int);
 void pxe_idle_init(void);
 void pxe_idle_cleanup(void);
 
+/* netcache.c */
+struct inode *netcache_open(struct fs_info *fs, const char *url);
+void netcache_start(struct inode *inode, const char *url);
+void netcache_record(struct inode *inode, const char *buf, uint32_t len,
+		     bool eof);
+void netcache_release(struct inode *inode);
+
 /* tftp.c */
 void tftp_open(struct url_info *url, int flags, struct inode *inode,
 	       const char **redir);
+int tftp_probe(struct url_info *urls, struct inode **inodes, int n);
 
 /* gpxeurl.c */
 void gpxe_open(struct inode *inode, const char *url);
@@ -14,6 +14,14 @@ struct tftp_packet {
     char data[];
 };
 
+/*
+ * Block size and window size to ask the server for; set from the
+ * TFTPBLKSIZE and TFTPWINDOWSIZE configuration commands.  A block
+ * size of 0 means as large as fits in one frame on our interface.
+ */
+__export uint16_t TftpBlkSize = 1408;
+__export uint16_t TftpWindowSize = 1;
+
 static void tftp_error(struct inode *file, uint16_t errnum,
 		       const char *errstr);
 
@@ -72,10 +80,10 @@ static void ack_packet(struct inode *inode, uint16_t ack_num)
 }
 
 /*
- * Get a fresh packet if the buffer is drained, and we haven't hit
- * EOF yet.  The buffer should be filled immediately after draining!
+ * Get the next DATA packet, into tftp_pktbuf or with the payload
+ * straight into dest; returns the payload size.
  */
-static void tftp_get_packet(struct inode *inode)
+static uint16_t tftp_recv_data(struct inode *inode, char *dest)
 {
     uint16_t last_pkt;
     const uint8_t *timeout_ptr;
@@ -84,27 +92,57 @@ static void tftp_get_packet(struct inode *inode)
     uint16_t serial;
     jiffies_t oldtime;
     struct tftp_packet *pkt = NULL;
+    struct tftp_packet hdr;
+    struct net_iovec iov[2];
+    int niov;
     uint16_t buf_len;
     struct pxe_pvt_inode *socket = PVT(inode);
     uint16_t src_port;
     uint32_t src_ip;
     int err;
 
+    /*
+     * Without a destination the packet goes into tftp_pktbuf as usual;
+     * with one, the header is split off and the payload lands directly
+     * where the caller wants it.  A packet we end up rejecting may
+     * scribble on dest, but that space is only valid once the right
+     * packet has arrived anyway.
+     */
+    if (dest) {
+	iov[0].base = &hdr;
+	iov[0].len  = 4;
+	iov[1].base = dest;
+	iov[1].len  = socket->tftp_blksize;
+	niov = 2;
+	pkt = &hdr;
+    } else {
+	iov[0].base = socket->tftp_pktbuf;
+	iov[0].len  = socket->tftp_blksize + 4;
+	niov = 1;
+	pkt = (struct tftp_packet *)(socket->tftp_pktbuf);
+    }
+
     /*
      * Start by ACKing the previous packet; this should cause
-     * the next packet to be sent.
+     * the next packet to be sent.  If we negotiated a window
+     * (RFC 7440), the server keeps sending until the window is
+     * full, so only the last packet of each window is ACKed.
      */
     timeout_ptr = TimeoutTable;
     timeout = *timeout_ptr++;
     oldtime = jiffies();
 
+    if (socket->tftp_unacked < socket->tftp_windowsize)
+	goto wait_pkt;
+
  ack_again:
     ack_packet(inode, socket->tftp_lastpkt);
+    socket->tftp_unacked = 0;
 
+ wait_pkt:
     while (timeout) {
-	buf_len = socket->tftp_blksize + 4;
-	err = core_udp_recv(socket, socket->tftp_pktbuf, &buf_len,
-			    &src_ip, &src_port);
+	err = core_udp_recvv(socket, iov, niov, &buf_len,
+			     &src_ip, &src_port);
 	if (err) {
 	    jiffies_t now = jiffies();
 
@@ -121,7 +159,6 @@ static void tftp_get_packet(struct inode *inode)
 	if (buf_len < 4)	/* Bad size for a DATA packet */
 	    continue;
 
-        pkt = (struct tftp_packet *)(socket->tftp_pktbuf);
         if (pkt->opcode != TFTP_DATA)    /* Not a data packet */
             continue;
 
@@ -141,20 +178,30 @@ static void tftp_get_packet(struct inode *inode)
          * Wrong packet, ACK the packet and try again.
          * This is presumably because the ACK got lost,
          * so the server just resent the previous packet.
+         *
+         * Within a window, an old packet is just the server
+         * resending the window; ACKing each of them would only
+         * make it start over again and again.  A packet from
+         * the future means we lost one, so ACK what we have.
          */
 #if 0
 	printf("Wrong packet, wanted %04x, got %04x\n", \
                htons(last_pkt), htons(*(uint16_t *)(data+2)));
 #endif
+	if (socket->tftp_windowsize > 1 && (int16_t)(serial - last_pkt) < 0)
+	    goto wait_pkt;
         goto ack_again;
     }
 
     /* It's the packet we want.  We're also EOF if the size < blocksize */
     socket->tftp_lastpkt = last_pkt;    /* Update last packet number */
+    socket->tftp_unacked++;
     buffersize = buf_len - 4;		/* Skip TFTP header */
-    socket->tftp_dataptr = socket->tftp_pktbuf + 4;
     socket->tftp_filepos += buffersize;
-    socket->tftp_bytesleft = buffersize;
+    if (!dest) {
+	socket->tftp_dataptr = socket->tftp_pktbuf + 4;
+	socket->tftp_bytesleft = buffersize;
+    }
     if (buffersize < socket->tftp_blksize) {
         /* it's the last block, ACK packet immediately */
         ack_packet(inode, serial);
@@ -162,52 +209,55 @@ static void tftp_get_packet(struct inode *inode)
         /* Make sure we know we are at end of file */
         inode->size 		= socket->tftp_filepos;
         socket->tftp_goteof	= 1;
+        socket->tftp_sizedone	= 1;
         tftp_close_file(inode);
     }
+
+    return buffersize;
+}
+
+/*
+ * Get a fresh packet if the buffer is drained, and we haven't hit
+ * EOF yet.  The buffer should be filled immediately after draining!
+ */
+static void tftp_get_packet(struct inode *inode)
+{
+    tftp_recv_data(inode, NULL);
+}
+
+/*
+ * Receive whole blocks straight into the caller's buffer, which saves
+ * copying every byte through tftp_pktbuf.
+ */
+static uint32_t tftp_read_bulk(struct inode *inode, char *buf, uint32_t len)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    uint32_t bytes = 0;
+
+    while (!socket->tftp_goteof && len - bytes >= socket->tftp_blksize)
+	bytes += tftp_recv_data(inode, buf + bytes);
+
+    return bytes;
 }
 
 const struct pxe_conn_ops tftp_conn_ops = {
     .fill_buffer	= tftp_get_packet,
     .close		= tftp_close_file,
+    .read_bulk		= tftp_read_bulk,
 };
 
-/**
- * Open a TFTP connection to the server
- *
- * @param:inode, the inode to store our state in
- * @param:ip, the ip to contact to get the file
- * @param:filename, the file we wanna open
- *
- * @out: open_file_t structure, stores in file->open_file
- * @out: the lenght of this file, stores in file->file_len
- *
+#define TFTP_RRQ_MAX	(2+2*FILENAME_MAX+32+32)
+
+/*
+ * Build a read request for url->path into rrq, asking for the options
+ * we want.  Returns the packet length.
  */
-void tftp_open(struct url_info *url, int flags, struct inode *inode,
-	       const char **redir)
+static int tftp_make_rrq(struct url_info *url, char *rrq,
+			 unsigned int *blksizep, unsigned int *windowsizep)
 {
-    struct pxe_pvt_inode *socket = PVT(inode);
+    static const char rrq_tail[] = "octet\0""tsize\0""0\0""blksize";
+    unsigned int blksize, windowsize;
     char *buf;
-    uint16_t buf_len;
-    char *p;
-    char *options;
-    char *data;
-    static const char rrq_tail[] = "octet\0""tsize\0""0\0""blksize\0""1408";
-    char rrq_packet_buf[2+2*FILENAME_MAX+sizeof rrq_tail];
-    char reply_packet_buf[PKTBUF_SIZE];
-    int err;
-    int buffersize;
-    int rrq_len;
-    const uint8_t  *timeout_ptr;
-    jiffies_t timeout;
-    jiffies_t oldtime;
-    uint16_t opcode;
-    uint16_t blk_num;
-    uint64_t opdata;
-    uint16_t src_port;
-    uint32_t src_ip;
-
-    (void)redir;		/* TFTP does not redirect */
-    (void)flags;
 
     if (url->type != URL_OLD_TFTP) {
 	/*
@@ -220,11 +270,7 @@ void tftp_open(struct url_info *url, int flags, struct inode *inode,
     if (!url->port)
 	url->port = TFTP_PORT;
 
-    socket->ops = &tftp_conn_ops;
-    if (core_udp_open(socket))
-	return;
-
-    buf = rrq_packet_buf;
+    buf = rrq;
     *(uint16_t *)buf = TFTP_RRQ;  /* TFTP opcode */
     buf += 2;
 
@@ -234,52 +280,47 @@ void tftp_open(struct url_info *url, int flags, struct inode *inode,
     memcpy(buf, rrq_tail, sizeof rrq_tail);
     buf += sizeof rrq_tail;
 
-    rrq_len = buf - rrq_packet_buf;
-
-    timeout_ptr = TimeoutTable;   /* Reset timeout */
-sendreq:
-    timeout = *timeout_ptr++;
-    if (!timeout)
-	return;			/* No file available... */
-    oldtime = jiffies();
-
-    core_udp_sendto(socket, rrq_packet_buf, rrq_len, url->ip, url->port);
-
-    /* If the WRITE call fails, we let the timeout take care of it... */
-wait_pkt:
-    for (;;) {
-	buf_len = sizeof(reply_packet_buf);
-
-	err = core_udp_recv(socket, reply_packet_buf, &buf_len,
-			    &src_ip, &src_port);
-	if (err) {
-	    jiffies_t now = jiffies();
-	    if (now - oldtime >= timeout)
-		 goto sendreq;
-	} else {
-	    /* Make sure the packet actually came from the server and
-	       is long enough for a TFTP opcode */
-	    dprintf("tftp_open: got packet buflen=%d from server %u.%u.%u.%u(%u.%u.%u.%u)\n",
-			buf_len,
-			((uint8_t *)&src_ip)[0],
-			((uint8_t *)&src_ip)[1],
-			((uint8_t *)&src_ip)[2],
-			((uint8_t *)&src_ip)[3],
-			((uint8_t *)&url->ip)[0],
-			((uint8_t *)&url->ip)[1],
-			((uint8_t *)&url->ip)[2],
-			((uint8_t *)&url->ip)[3]);
-	    if ((src_ip == url->ip) && (buf_len >= 2))
-		break;
-	}
+    /* Ask for as much as we can receive in one go */
+    blksize = core_udp_max_payload() - 4;
+    if (TftpBlkSize && TftpBlkSize < blksize)
+	blksize = TftpBlkSize;
+    blksize = min(blksize, TFTP_MAX_BLKSIZE);
+    buf += sprintf(buf, "%u", blksize) + 1;
+
+    windowsize = min(TftpWindowSize, TFTP_MAX_WINDOWSIZE);
+    if (windowsize > 1) {
+	buf = stpcpy(buf, "windowsize") + 1;
+	buf += sprintf(buf, "%u", windowsize) + 1;
     }
 
-    core_udp_disconnect(socket);
-    core_udp_connect(socket, src_ip, src_port);
+    *blksizep = blksize;
+    *windowsizep = windowsize;
+    return buf - rrq;
+}
+
+/*
+ * Act on the server's first reply to a read request; the socket must
+ * already be connected to the server's port.  Returns false if the
+ * packet is to be ignored and we should keep waiting.  Otherwise the
+ * file is open, or inode->size is 0 and the socket is closed.
+ */
+static bool tftp_first_reply(struct inode *inode, char *reply_packet_buf,
+			     uint16_t buf_len, unsigned int blksize,
+			     unsigned int windowsize)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    char *p;
+    char *options;
+    char *data;
+    int buffersize;
+    uint16_t opcode;
+    uint16_t blk_num;
+    uint64_t opdata;
 
     /* filesize <- -1 == unknown */
     inode->size = -1;
     socket->tftp_blksize = TFTP_BLOCKSIZE;
+    socket->tftp_windowsize = 1;
     buffersize = buf_len - 2;	  /* bytes after opcode */
 
     /*
@@ -304,13 +345,14 @@ wait_pkt:
          */
         buffersize -= 2;
         if (buffersize < 0)
-            goto wait_pkt;
+            return false;
         data = reply_packet_buf + 2;
         blk_num = ntohs(*(uint16_t *)data);
         data += 2;
         if (blk_num != 1)
-            goto wait_pkt;
+            return false;
         socket->tftp_lastpkt = blk_num;
+        socket->tftp_unacked = 1;
         if (buffersize > TFTP_BLOCKSIZE)
             goto err_reply;	/* Corrupt */
 
@@ -326,6 +368,7 @@ wait_pkt:
              */
             inode->size = buffersize;
             socket->tftp_goteof = 1;
+            socket->tftp_sizedone = 1;
             ack_packet(inode, blk_num);
         }
 
@@ -390,6 +433,9 @@ wait_pkt:
 		inode->size = opdata;
 	    else if (!strcmp(opt, "blksize"))
 		socket->tftp_blksize = opdata;
+	    else if (!strcmp(opt, "windowsize") && windowsize > 1 &&
+		     opdata >= 1 && opdata <= windowsize)
+		socket->tftp_windowsize = opdata;
 	    else
 		goto err_reply; /* Non-negotitated option returned,
 				   no idea what it means ...*/
@@ -397,9 +443,12 @@ wait_pkt:
 
 	}
 
-	if (socket->tftp_blksize < 64 || socket->tftp_blksize > PKTBUF_SIZE)
+	if (socket->tftp_blksize < 64 || socket->tftp_blksize > blksize)
 	    goto err_reply;
 
+	/* We still have to ACK the OACK to get the first window going */
+	socket->tftp_unacked = socket->tftp_windowsize;
+
 	/* Parsing successful, allocate buffer */
 	socket->tftp_pktbuf = malloc(socket->tftp_blksize + 4);
 	if (!socket->tftp_pktbuf)
@@ -421,9 +470,235 @@ done:
     if (!inode->size)
 	core_udp_close(socket);
 
-    return;
+    return true;
+}
+
+/**
+ * Open a TFTP connection to the server
+ *
+ * @param:inode, the inode to store our state in
+ * @param:ip, the ip to contact to get the file
+ * @param:filename, the file we wanna open
+ *
+ * @out: open_file_t structure, stores in file->open_file
+ * @out: the lenght of this file, stores in file->file_len
+ *
+ */
+void tftp_open(struct url_info *url, int flags, struct inode *inode,
+	       const char **redir)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    uint16_t buf_len;
+    char rrq_packet_buf[TFTP_RRQ_MAX];
+    char reply_packet_buf[PKTBUF_SIZE];
+    unsigned int blksize, windowsize;
+    int err;
+    int rrq_len;
+    const uint8_t  *timeout_ptr;
+    jiffies_t timeout;
+    jiffies_t oldtime;
+    uint16_t src_port;
+    uint32_t src_ip;
+
+    (void)redir;		/* TFTP does not redirect */
+    (void)flags;
+
+    socket->ops = &tftp_conn_ops;
+    if (core_udp_open(socket))
+	return;
+
+    rrq_len = tftp_make_rrq(url, rrq_packet_buf, &blksize, &windowsize);
+
+    timeout_ptr = TimeoutTable;   /* Reset timeout */
+sendreq:
+    timeout = *timeout_ptr++;
+    if (!timeout)
+	return;			/* No file available... */
+    oldtime = jiffies();
+
+    core_udp_sendto(socket, rrq_packet_buf, rrq_len, url->ip, url->port);
+
+    /* If the WRITE call fails, we let the timeout take care of it... */
+wait_pkt:
+    for (;;) {
+	buf_len = sizeof(reply_packet_buf);
+
+	err = core_udp_recv(socket, reply_packet_buf, &buf_len,
+			    &src_ip, &src_port);
+	if (err) {
+	    jiffies_t now = jiffies();
+	    if (now - oldtime >= timeout)
+		 goto sendreq;
+	} else {
+	    /* Make sure the packet actually came from the server and
+	       is long enough for a TFTP opcode */
+	    dprintf("tftp_open: got packet buflen=%d from server %u.%u.%u.%u(%u.%u.%u.%u)\n",
+			buf_len,
+			((uint8_t *)&src_ip)[0],
+			((uint8_t *)&src_ip)[1],
+			((uint8_t *)&src_ip)[2],
+			((uint8_t *)&src_ip)[3],
+			((uint8_t *)&url->ip)[0],
+			((uint8_t *)&url->ip)[1],
+			((uint8_t *)&url->ip)[2],
+			((uint8_t *)&url->ip)[3]);
+	    if ((src_ip == url->ip) && (buf_len >= 2))
+		break;
+	}
+    }
+
+    core_udp_disconnect(socket);
+    core_udp_connect(socket, src_ip, src_port);
+
+    if (!tftp_first_reply(inode, reply_packet_buf, buf_len,
+			  blksize, windowsize))
+	goto wait_pkt;
 }
 
+/**
+ * Look for several files at once, in order of preference
+ *
+ * Read requests for all N urls go out together, each from its own
+ * socket, so finding out which files exist takes about one round trip
+ * rather than one per file.  We stop as soon as the first existing
+ * file in the list is known, i.e. everything before it has been
+ * refused; files that never get an answer count as missing.
+ *
+ * @param:urls, the files to look for, most preferred first
+ * @param:inodes, one freshly allocated socket inode per url
+ * @param:n, the number of urls
+ *
+ * @out: the index of the file found, which is left open in its inode;
+ *	 -1 if none of them exists, or -2 if we couldn't probe at all,
+ *	 e.g. because the network stack can't wait on several sockets.
+ *	 All the other sockets are closed.
+ *
+ * The server is waiting for our ACK of the found file while we wait for
+ * answers about better ones.  So once something has been found, the
+ * better candidates only get one more retransmit interval, and the
+ * found file keeps the state of its first reply.
+ */
+int tftp_probe(struct url_info *urls, struct inode **inodes, int n)
+{
+    struct tftp_probe {
+	char rrq[TFTP_RRQ_MAX];
+	int rrq_len;
+	unsigned int blksize, windowsize;
+	enum { PROBE_WAIT, PROBE_FOUND, PROBE_MISSING } state;
+    } *probe;
+    struct pxe_pvt_inode *socket;
+    char reply_packet_buf[PKTBUF_SIZE];
+    const uint8_t *timeout_ptr;
+    jiffies_t timeout;
+    jiffies_t oldtime;
+    uint16_t buf_len;
+    uint16_t src_port;
+    uint32_t src_ip;
+    int i, opened, found = -1;
+    bool last_round = false;
+
+    if (!core_udp_can_demux())
+	return -2;
+
+    probe = malloc(n * sizeof *probe);
+    if (!probe)
+	return -2;
+
+    for (opened = 0; opened < n; opened++) {
+	socket = PVT(inodes[opened]);
+	socket->ops = &tftp_conn_ops;
+	if (core_udp_open(socket))
+	    break;
+	probe[opened].rrq_len = tftp_make_rrq(&urls[opened],
+					      probe[opened].rrq,
+					      &probe[opened].blksize,
+					      &probe[opened].windowsize);
+	probe[opened].state = PROBE_WAIT;
+    }
+    if (opened < n) {
+	found = -2;		/* Out of sockets; let the caller go serially */
+	goto out;
+    }
+
+    timeout_ptr = TimeoutTable;
+    while ((timeout = *timeout_ptr++)) {
+	for (i = 0; i < n; i++) {
+	    if (probe[i].state == PROBE_WAIT)
+		core_udp_sendto(PVT(inodes[i]), probe[i].rrq,
+				probe[i].rrq_len, urls[i].ip, urls[i].port);
+	}
+
+	oldtime = jiffies();
+	while (jiffies() - oldtime < timeout) {
+	    for (i = 0; i < n; i++) {
+		if (probe[i].state != PROBE_WAIT)
+		    continue;
+
+		socket = PVT(inodes[i]);
+		buf_len = sizeof reply_packet_buf;
+		if (core_udp_recv(socket, reply_packet_buf, &buf_len,
+				  &src_ip, &src_port))
+		    continue;
+		if (src_ip != urls[i].ip || buf_len < 2)
+		    continue;
+
+		core_udp_disconnect(socket);
+		core_udp_connect(socket, src_ip, src_port);
+
+		if (tftp_first_reply(inodes[i], reply_packet_buf, buf_len,
+				     probe[i].blksize, probe[i].windowsize)) {
+		    probe[i].state = inodes[i]->size ?
+			PROBE_FOUND : PROBE_MISSING;
+		}
+	    }
+
+	    /* Done once the best candidate still in the running is found */
+	    for (i = 0; i < n && probe[i].state == PROBE_MISSING; i++)
+		;
+	    if (i == n || probe[i].state == PROBE_FOUND) {
+		found = i < n ? i : -1;
+		goto out;
+	    }
+	}
+
+	/*
+	 * Whoever hasn't answered by the end of the round after the one
+	 * in which we found a file doesn't have theirs.  The extra round
+	 * covers a lost request or refusal without keeping the found
+	 * transfer waiting long enough for the server to give up.
+	 */
+	for (i = 0; i < n && probe[i].state != PROBE_FOUND; i++)
+	    ;
+	if (i < n) {
+	    if (last_round) {
+		found = i;
+		goto out;
+	    }
+	    last_round = true;
+	}
+    }
+
+    /* Out of time; whoever didn't answer doesn't have the file */
+    for (i = 0; i < n; i++) {
+	if (probe[i].state == PROBE_FOUND) {
+	    found = i;
+	    break;
+	}
+    }
+
+out:
+    for (i = 0; i < opened; i++) {
+	if (i == found)
+	    continue;
+	if (probe[i].state == PROBE_FOUND)
+	    tftp_close_file(inodes[i]);
+	else
+	    core_udp_close(PVT(inodes[i]));
+    }
+
+    free(probe);
+    return found;
+}
 
 /**
  * Send a file to a TFTP  server
@@ -28,6 +28,13 @@
 #define TFTP_BLOCKSIZE_LG2 9
 #define TFTP_BLOCKSIZE  (1 << TFTP_BLOCKSIZE_LG2)
 
+/*
+ * Largest block size allowed by RFC 2348, and largest window size
+ * (RFC 7440) we are willing to use
+ */
+#define TFTP_MAX_BLKSIZE	65464
+#define TFTP_MAX_WINDOWSIZE	64
+
 /*
  * TFTP operation codes
  */
@@ -272,8 +272,10 @@ ufs_iget(const char *dname, struct inode *parent)
     struct fs_info *fs = parent->fs;
 
     dir = ufs_find_entry(fs, parent, dname);
-    if (!dir)
+    if (!dir) {
+	errno = ENOENT;
 	return NULL;
+    }
 
     return UFS_SB(fs)->ufs_iget_by_inr(fs, dir->inode_value);
 }
@@ -26,6 +26,7 @@
 #include <ilog2.h>
 #include <klibc/compiler.h>
 #include <ctype.h>
+#include <minmax.h>
 
 #include "codepage.h"
 #include "xfs_types.h"
@@ -91,97 +92,150 @@ static uint32_t xfs_getfssec(struct file *file, char *buf, int sectors,
     return generic_getfssec(file, buf, sectors, have_more);
 }
 
-static int xfs_next_extent(struct inode *inode, uint32_t lstart)
+/*
+ * The data fork's extents are decoded the first time the file is read
+ * and kept sorted by file offset, so that finding the extent for any
+ * position is a binary search instead of a walk through the dinode or
+ * the bmbt.  Unwritten extents are left out; they read as zeroes, just
+ * like holes.
+ */
+static void xfs_add_extent(struct xfs_inode *xi, const xfs_bmbt_rec_t *r)
 {
-    struct fs_info *fs = inode->fs;
-    xfs_dinode_t *core = NULL;
     xfs_bmbt_irec_t rec;
-    block_t bno;
+    struct xfs_extent *ext;
+
+    bmbt_irec_get(&rec, r);
+    if (rec.br_state != XFS_EXT_NORM || !rec.br_blockcount)
+	return;
+
+    ext = &xi->i_extents[xi->i_nextents++];
+    ext->startoff = rec.br_startoff;
+    ext->startblock = rec.br_startblock;
+    ext->blockcount = rec.br_blockcount;
+}
+
+static int xfs_load_extents(struct inode *inode)
+{
+    struct fs_info *fs = inode->fs;
+    struct xfs_inode *xi = XFS_PVT(inode);
+    xfs_dinode_t *core;
     xfs_bmdr_block_t *rblock;
-    int fsize;
     xfs_bmbt_ptr_t *pp;
     xfs_btree_block_t *blk;
-    uint16_t nextents;
-    block_t nextbno;
-    uint32_t index;
-
-    (void)lstart;
-
-    xfs_debug("inode %p lstart %lu", inode, lstart);
+    uint32_t nextents, i, n;
+    block_t bno;
+    int fsize;
 
     core = xfs_dinode_get_core(fs, inode->ino);
     if (!core) {
 	xfs_error("Failed to get dinode from disk (ino %llx)", inode->ino);
-	goto out;
+	return -1;
     }
 
-    /* The data fork contains the file's data extents */
-    if (XFS_PVT(inode)->i_cur_extent == be32_to_cpu(core->di_nextents))
-        goto out;
+    nextents = be32_to_cpu(core->di_nextents);
+    xi->i_extents = malloc((nextents ? nextents : 1) * sizeof *xi->i_extents);
+    if (!xi->i_extents) {
+	malloc_error("xfs extent map");
+	return -1;
+    }
+    xi->i_nextents = 0;
 
     if (core->di_format == XFS_DINODE_FMT_EXTENTS) {
-	bmbt_irec_get(&rec, (xfs_bmbt_rec_t *)XFS_DFORK_PTR(core,
-							    XFS_DATA_FORK) +
-						XFS_PVT(inode)->i_cur_extent);
-	XFS_PVT(inode)->i_cur_extent++;
+	for (i = 0; i < nextents; i++)
+	    xfs_add_extent(xi, (xfs_bmbt_rec_t *)XFS_DFORK_PTR(core,
+						XFS_DATA_FORK) + i);
+    } else if (core->di_format == XFS_DINODE_FMT_BTREE) {
+	rblock = XFS_DFORK_PTR(core, XFS_DATA_FORK);
+	fsize = XFS_DFORK_SIZE(core, fs, XFS_DATA_FORK);
+	pp = XFS_BMDR_PTR_ADDR(rblock, 1, xfs_bmdr_maxrecs(fsize, 0));
+	bno = fsblock_to_bytes(fs, be64_to_cpu(pp[0])) >> BLOCK_SHIFT(fs);
+
+	/* Find the leftmost leaf */
+	for (;;) {
+	    blk = (xfs_btree_block_t *)get_cache(fs->fs_dev, bno);
+	    if (be16_to_cpu(blk->bb_level) == 0)
+		break;
+
+	    pp = XFS_BMBT_PTR_ADDR(fs, blk, 1,
+		    xfs_bmdr_maxrecs(XFS_INFO(fs)->blocksize, 0));
+	    bno = fsblock_to_bytes(fs, be64_to_cpu(pp[0])) >> BLOCK_SHIFT(fs);
+	}
+
+	/* ... and collect the records of all the threaded leaves */
+	for (n = 0; n < nextents; ) {
+	    for (i = 1; i <= be16_to_cpu(blk->bb_numrecs) && n < nextents;
+		 i++, n++)
+		xfs_add_extent(xi, XFS_BMBT_REC_ADDR(fs, blk, i));
+
+	    if (be64_to_cpu(blk->bb_u.l.bb_rightsib) == NULLFSBLOCK)
+		break;
+
+	    bno = fsblock_to_bytes(fs, be64_to_cpu(blk->bb_u.l.bb_rightsib))
+		>> BLOCK_SHIFT(fs);
+	    blk = (xfs_btree_block_t *)get_cache(fs->fs_dev, bno);
+	}
+    }
 
-	bno = fsblock_to_bytes(fs, rec.br_startblock) >> BLOCK_SHIFT(fs);
+    xfs_debug("inode %p: %u extents", inode, xi->i_nextents);
 
-	XFS_PVT(inode)->i_offset = rec.br_startoff;
+    return 0;
+}
 
-	inode->next_extent.pstart = bno << BLOCK_SHIFT(fs) >> SECTOR_SHIFT(fs);
-	inode->next_extent.len = ((rec.br_blockcount << BLOCK_SHIFT(fs)) +
-				  SECTOR_SIZE(fs) - 1) >> SECTOR_SHIFT(fs);
-    } else if (core->di_format == XFS_DINODE_FMT_BTREE) {
-        xfs_debug("XFS_DINODE_FMT_BTREE");
-        index = XFS_PVT(inode)->i_cur_extent++;
-        rblock = XFS_DFORK_PTR(core, XFS_DATA_FORK);
-        fsize = XFS_DFORK_SIZE(core, fs, XFS_DATA_FORK);
-        pp = XFS_BMDR_PTR_ADDR(rblock, 1, xfs_bmdr_maxrecs(fsize, 0));
-        bno = fsblock_to_bytes(fs, be64_to_cpu(pp[0])) >> BLOCK_SHIFT(fs);
-
-        /* Find the leaf */
-        for (;;) {
-            blk = (xfs_btree_block_t *)get_cache(fs->fs_dev, bno);
-            if (be16_to_cpu(blk->bb_level) == 0)
-                break;
-
-            pp = XFS_BMBT_PTR_ADDR(fs, blk, 1,
-                    xfs_bmdr_maxrecs(XFS_INFO(fs)->blocksize, 0));
-            bno = fsblock_to_bytes(fs, be64_to_cpu(pp[0])) >> BLOCK_SHIFT(fs);
-        }
-
-        /* Find the right extent among threaded leaves */
-        for (;;) {
-            nextbno = be64_to_cpu(blk->bb_u.l.bb_rightsib);
-            nextents = be16_to_cpu(blk->bb_numrecs);
-            if (nextents - index > 0) {
-                bmbt_irec_get(&rec, XFS_BMDR_REC_ADDR(blk, index + 1));
-
-                bno = fsblock_to_bytes(fs, rec.br_startblock)
-						>> BLOCK_SHIFT(fs);
-
-                XFS_PVT(inode)->i_offset = rec.br_startoff;
-
-                inode->next_extent.pstart = bno << BLOCK_SHIFT(fs)
-                                                >> SECTOR_SHIFT(fs);
-                inode->next_extent.len = ((rec.br_blockcount
-                                            << BLOCK_SHIFT(fs))
-                                            + SECTOR_SIZE(fs) - 1)
-                                            >> SECTOR_SHIFT(fs);
-                break;
-            }
-
-            index -= nextents;
-            bno = fsblock_to_bytes(fs, nextbno) >> BLOCK_SHIFT(fs);
-            blk = (xfs_btree_block_t *)get_cache(fs->fs_dev, bno);
-        }
+static int xfs_next_extent(struct inode *inode, uint32_t lstart)
+{
+    struct fs_info *fs = inode->fs;
+    struct xfs_inode *xi = XFS_PVT(inode);
+    const struct xfs_extent *ext;
+    int blk_sec_shift = BLOCK_SHIFT(fs) - SECTOR_SHIFT(fs);
+    xfs_fileoff_t lblock = lstart >> blk_sec_shift;
+    uint64_t eof, end;
+    uint32_t lo, hi, mid;
+    block_t bno;
+
+    xfs_debug("inode %p lstart %lu", inode, lstart);
+
+    if (!xi->i_extents && xfs_load_extents(inode))
+	return -1;
+
+    /* Find the first extent which ends beyond lblock */
+    lo = 0;
+    hi = xi->i_nextents;
+    while (lo < hi) {
+	mid = (lo + hi) >> 1;
+	ext = &xi->i_extents[mid];
+	if (ext->startoff + ext->blockcount <= lblock)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    if (lo < xi->i_nextents && xi->i_extents[lo].startoff <= lblock) {
+	ext = &xi->i_extents[lo];
+	bno = fsblock_to_bytes(fs, ext->startblock) >> BLOCK_SHIFT(fs);
+	inode->next_extent.pstart =
+	    ((bno + lblock - ext->startoff) << blk_sec_shift) +
+	    (lstart & ((1 << blk_sec_shift) - 1));
+	end = (ext->startoff + ext->blockcount) << blk_sec_shift;
+    } else {
+	/* A hole, up to the next extent or the end of the file */
+	eof = (inode->size + SECTOR_SIZE(fs) - 1) >> SECTOR_SHIFT(fs);
+	if (lo < xi->i_nextents)
+	    end = xi->i_extents[lo].startoff << blk_sec_shift;
+	else
+	    end = eof;
+	if (end <= lstart)
+	    return -1;
+	inode->next_extent.pstart = EXTENT_ZERO;
     }
 
+    inode->next_extent.len = min(end - lstart, (uint64_t)0xffffffff);
+
     return 0;
+}
 
-out:
-    return -1;
+static void xfs_release_inode(struct inode *inode)
+{
+    free(XFS_PVT(inode)->i_extents);
 }
 
 static inline struct inode *xfs_fmt_local_find_entry(const char *dname,
@@ -241,10 +295,7 @@ static struct inode *xfs_iget(const char *dname, struct inode *parent)
 	goto out;
     }
 
-    if (inode->mode == DT_REG) {
-	XFS_PVT(inode)->i_offset = 0;
-	XFS_PVT(inode)->i_cur_extent = 0;
-    } else if (inode->mode == DT_DIR) {
+    if (inode->mode == DT_DIR) {
 	XFS_PVT(inode)->i_btree_offset = 0;
 	XFS_PVT(inode)->i_leaf_ent_offset = 0;
     }
@@ -429,6 +480,7 @@ const struct fs_ops xfs_fs_ops = {
     .readdir		= xfs_readdir,
     .iget		= xfs_iget,
     .next_extent	= xfs_next_extent,
+    .release_inode	= xfs_release_inode,
     .readlink		= xfs_readlink,
     .fs_uuid            = NULL,
 };
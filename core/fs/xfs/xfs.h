@@ -409,12 +409,18 @@ static inline unsigned int xfs_dinode_size(int version)
 #define XFS_DFORK_PTR(dip,w) \
     ((w) == XFS_DATA_FORK ? XFS_DFORK_DPTR(dip) : XFS_DFORK_APTR(dip))
 
+struct xfs_extent {
+    xfs_fileoff_t	startoff;	/* First file block */
+    xfs_fsblock_t	startblock;
+    uint32_t		blockcount;
+};
+
 struct xfs_inode {
     xfs_agblock_t 	i_agblock;
     block_t		i_ino_blk;
     uint64_t		i_block_offset;
-    uint64_t		i_offset;
-    uint32_t		i_cur_extent;
+    struct xfs_extent	*i_extents;	/* Data extents, sorted; NULL until read */
+    uint32_t		i_nextents;
     uint32_t		i_btree_offset;
     uint16_t		i_leaf_ent_offset;
 };
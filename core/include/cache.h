@@ -11,14 +11,28 @@ struct cache {
     block_t block;
     struct cache *prev;
     struct cache *next;
+    struct cache *hnext;	/* Next entry in the same hash bucket */
     void *data;
+    uint32_t flags;
 };
 
+/* struct cache flags */
+#define CACHE_PREFETCHED	1	/* Loaded by read-ahead, not yet used */
+
+/* Size of the read-ahead staging area carved out of the cache */
+#define CACHE_RA_SIZE	(64*1024)
+
+/* Bounds for the automatically sized cache, see cache_size_for_memory() */
+#define CACHE_MIN_SIZE	(128*1024)
+#define CACHE_MAX_SIZE	(8*1024*1024)
+
 /* functions defined in cache.c */
+uint32_t cache_size_for_memory(size_t);
 void cache_init(struct device *, int);
 const void *get_cache(struct device *, block_t);
 struct cache *_get_cache_block(struct device *, block_t);
 void cache_lock_block(struct cache *);
+void cache_set_readahead(struct device *, unsigned int);
 size_t cache_read(struct fs_info *, void *, uint64_t, size_t);
 
 #endif /* cache.h */
@@ -11,6 +11,15 @@ typedef uint64_t block_t;
 
 struct bios_disk_private {
 	com32sys_t *regs;
+
+	/* Adaptive maxtransfer, see diskio_bios.c */
+	unsigned int hard_maxtransfer;	/* Never go above this */
+	unsigned int xfer_safe;		/* Last good size while probing */
+	unsigned int xfer_good;		/* Good transfers since last change */
+	unsigned int xfer_backoff;	/* Good transfers needed to grow */
+	unsigned int adv_maxtransfer;	/* As in the ADV, 0 until it's read */
+	bool edd_flat;			/* EDD 3.0 64-bit flat addressing */
+	bool edd_flat_checked;		/* ... and edd_check_flat() agreed */
 };
 
 /*
@@ -29,8 +38,19 @@ struct disk {
     unsigned int _pad;
 
     sector_t part_start;   /* the start address of this partition(in sectors) */
+    sector_t sectors;	   /* Size of the whole disk, 0 if unknown */
 
+    /* Returns the number of sectors transferred; fewer is an error */
     int (*rdwr_sectors)(struct disk *, void *, sector_t, size_t, bool);
+
+    /*
+     * Optional asynchronous reads, NULL if unsupported.  read_start()
+     * returns 0 if the read was queued; read_wait() then returns the
+     * number of sectors read, or -1 on error.  At most one read may
+     * be outstanding.
+     */
+    int (*read_start)(struct disk *, void *, sector_t, size_t);
+    int (*read_wait)(struct disk *);
 };
 
 extern void read_sectors(char *, sector_t, int);
@@ -38,6 +58,7 @@ extern void getoneblk(struct disk *, char *, block_t, int);
 
 /* diskio.c */
 struct disk *bios_disk_init(void *);
+void bios_disk_adv_init(void);
 struct device *device_init(void *);
 
 #endif /* DISK_H */
@@ -71,6 +71,7 @@ struct fs_ops {
     int	     (*readdir)(struct file *, struct dirent *);
 
     int      (*next_extent)(struct inode *, uint32_t);
+    void     (*release_inode)(struct inode *);	/* Last reference gone */
 
     int      (*copy_super)(void *buf);
 
@@ -129,6 +130,14 @@ struct file {
  */
 struct cache;
 
+struct cache_stats {
+    uint32_t hits;		/* Lookups satisfied from the cache */
+    uint32_t misses;		/* Lookups that went to the disk */
+    uint32_t ra_reads;		/* Disk requests covering several blocks */
+    uint32_t ra_blocks;		/* Blocks loaded ahead of being asked for */
+    uint32_t ra_hits;		/* Read-ahead blocks that were later used */
+};
+
 struct device {
     struct disk *disk;
 
@@ -136,11 +145,30 @@ struct device {
     uint8_t cache_init; /* cache initialized state */
     char *cache_data;
     struct cache *cache_head;
+    struct cache **cache_hash;	/* Hash buckets indexed by block number */
     uint16_t cache_block_size;
     uint16_t cache_entries;
     uint32_t cache_size;
+    uint8_t cache_hash_shift;	/* log2 of the number of hash buckets */
+
+    /* read-ahead */
+    char *cache_ra_buf;		/* Staging area, NULL if disabled */
+    uint16_t cache_ra_max;	/* Max blocks loaded by one request */
+    uint16_t cache_ra_limit;	/* Blocks that fit in the staging area */
+    block_t cache_last_miss;
+    block_t cache_end;		/* First block past the end of the disk */
+    struct cache_stats cache_stats;
+};
+
+/* Path lookup (dentry) cache counters */
+struct dcache_stats {
+    uint32_t hits;		/* Directories found in the cache */
+    uint32_t neg_hits;		/* Names known not to exist */
+    uint32_t misses;		/* Lookups that called ->iget */
 };
 
+extern struct dcache_stats dcache_stats;
+
 /*
  * Our definition of "not whitespace"
  */
@@ -218,6 +246,11 @@ void pm_realpath(com32sys_t *regs);
 size_t realpath(char *dst, const char *src, size_t bufsize);
 int chdir(const char *src);
 
+/* dcache.c */
+bool dcache_lookup(struct inode *parent, const char *name, bool dir,
+		   struct inode **childp);
+void dcache_add(struct inode *parent, const char *name, struct inode *child);
+
 /* readdir.c */
 DIR *opendir(const char *pathname);
 struct dirent *readdir(DIR *dir);
@@ -248,6 +281,7 @@ void generic_close_file(struct file *file);
 /* getfssec.c */
 uint32_t generic_getfssec(struct file *file, char *buf,
 			  int sectors, bool *have_more);
+void getfssec_forget(struct inode *inode);
 
 /* nonextextent.c */
 int no_next_extent(struct inode *, uint32_t);
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
 
 void net_core_init(void);
 void net_parse_dhcp(void);
@@ -17,8 +18,48 @@ void core_udp_connect(struct pxe_pvt_inode *socket,
 		      uint32_t ip, uint16_t port);
 void core_udp_disconnect(struct pxe_pvt_inode *socket);
 
-int core_udp_recv(struct pxe_pvt_inode *socket, void *buf, uint16_t *buf_len,
-		  uint32_t *src_ip, uint16_t *src_port);
+/* One piece of a scatter-gather receive buffer */
+struct net_iovec {
+    void *base;
+    uint16_t len;
+};
+
+int core_udp_recvv(struct pxe_pvt_inode *socket,
+		   const struct net_iovec *iov, int niov, uint16_t *buf_len,
+		   uint32_t *src_ip, uint16_t *src_port);
+
+static inline int core_udp_recv(struct pxe_pvt_inode *socket, void *buf,
+				uint16_t *buf_len, uint32_t *src_ip,
+				uint16_t *src_port)
+{
+    struct net_iovec iov;
+
+    iov.base = buf;
+    iov.len  = *buf_len;
+    return core_udp_recvv(socket, &iov, 1, buf_len, src_ip, src_port);
+}
+
+/*
+ * Scatter a received packet over iov; returns the number of bytes
+ * stored, which is less than len if the packet doesn't fit.
+ */
+static inline uint16_t net_scatter(const struct net_iovec *iov, int niov,
+				   const void *data, uint16_t len)
+{
+    const char *p = data;
+    uint16_t n, copied = 0;
+
+    while (niov-- && len) {
+	n = iov->len < len ? iov->len : len;
+	memcpy(iov->base, p, n);
+	p += n;
+	len -= n;
+	copied += n;
+	iov++;
+    }
+
+    return copied;
+}
 
 void core_udp_send(struct pxe_pvt_inode *socket,
 		   const void *data, size_t len);
@@ -26,6 +67,9 @@ void core_udp_send(struct pxe_pvt_inode *socket,
 void core_udp_sendto(struct pxe_pvt_inode *socket, const void *data, size_t len,
 		     uint32_t ip, uint16_t port);
 
+uint16_t core_udp_max_payload(void);
+bool core_udp_can_demux(void);
+
 void probe_undi(void);
 void pxe_init_isr(void);
 
@@ -37,6 +81,7 @@ bool core_tcp_is_connected(struct pxe_pvt_inode *socket);
 int core_tcp_write(struct pxe_pvt_inode *socket, const void *data,
 		   size_t len, bool copy);
 void core_tcp_close_file(struct inode *inode);
+bool core_tcp_idle(struct pxe_pvt_inode *socket);
 void core_tcp_fill_buffer(struct inode *inode);
 
 #endif /* _NET_H */
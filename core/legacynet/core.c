@@ -82,8 +82,9 @@ void core_udp_disconnect(struct pxe_pvt_inode *socket __unused)
  * @out: src_ip, ip address of the data source
  * @out: src_port, port number of the data source, host-byte order
  */
-int core_udp_recv(struct pxe_pvt_inode *socket, void *buf, uint16_t *buf_len,
-		  uint32_t *src_ip, uint16_t *src_port)
+int core_udp_recvv(struct pxe_pvt_inode *socket,
+		   const struct net_iovec *iov, int niov, uint16_t *buf_len,
+		   uint32_t *src_ip, uint16_t *src_port)
 {
     static __lowmem struct s_PXENV_UDP_READ  udp_read;
     struct net_private_tftp *priv = &socket->net.tftp;
@@ -103,8 +104,8 @@ int core_udp_recv(struct pxe_pvt_inode *socket, void *buf, uint16_t *buf_len,
     if (udp_read.status)
 	return udp_read.status;
 
-    bytes = min(udp_read.buffer_size, *buf_len);
-    memcpy(buf, packet_buf, bytes);
+    /* PXE needs a real-mode buffer, so this always takes one copy */
+    bytes = net_scatter(iov, niov, packet_buf, udp_read.buffer_size);
 
     *src_ip = udp_read.src_ip;
     *src_port = ntohs(udp_read.s_port);
@@ -113,6 +114,24 @@ int core_udp_recv(struct pxe_pvt_inode *socket, void *buf, uint16_t *buf_len,
     return 0;
 }
 
+/**
+ * Largest UDP payload core_udp_recv() can return
+ */
+uint16_t core_udp_max_payload(void)
+{
+    return PKTBUF_SIZE;
+}
+
+/**
+ * PXENV_UDP_READ takes the next packet off the stack's queue even when
+ * its destination port doesn't match, and then throws it away, so only
+ * one socket at a time can be waiting for a reply
+ */
+bool core_udp_can_demux(void)
+{
+    return false;
+}
+
 /**
  * Send a UDP packet.
  *
@@ -11,7 +11,7 @@
 
 #include <stdio.h>
 
-static struct free_arena_header *
+struct free_arena_header *
 __free_block(struct free_arena_header *ah)
 {
     struct free_arena_header *pah, *nah;
@@ -70,6 +70,9 @@ __free_block(struct free_arena_header *ah)
 void bios_free(void *ptr)
 {
     struct free_arena_header *ah;
+    struct malloc_class *mc;
+    size_t size;
+    int c;
 
     ah = (struct free_arena_header *)
         ((struct arena_header *)ptr - 1);
@@ -82,6 +85,23 @@ void bios_free(void *ptr)
 	dprintf("invalid arena type: %d\n", ARENA_TYPE_GET(ah->a.attrs));
 #endif
 
+    /*
+     * Small blocks go back on their size-class list, as long as that
+     * holds no more than a slab's worth; the rest is coalesced as usual.
+     */
+    if (ARENA_HEAP_GET(ah->a.attrs) == HEAP_MAIN) {
+	size = ARENA_SIZE_GET(ah->a.attrs);
+	c = __malloc_size_class(size, true);
+	mc = c >= 0 ? &__malloc_classes[c] : NULL;
+	if (mc && (mc->count + 1) * size <= MALLOC_CLASS_BYTES) {
+	    ah->a.tag = MALLOC_FREE;
+	    ah->next_free = mc->list;
+	    mc->list = ah;
+	    mc->count++;
+	    return;
+	}
+    }
+
     __free_block(ah);
 }
 
@@ -1,7 +1,8 @@
 /*
  * malloc.c
  *
- * Very simple linked-list based malloc()/free().
+ * Very simple linked-list based malloc()/free(), with per-size-class
+ * free lists in front for small blocks.
  */
 
 #include <syslinux/firmware.h>
@@ -67,28 +68,310 @@ static void *__malloc_from_block(struct free_arena_header *fp,
     return (void *)(&fp->a + 1);
 }
 
+static void *__malloc_first_fit(size_t size, enum heap heap,
+				malloc_tag_t tag)
+{
+    struct free_arena_header *fp;
+    struct free_arena_header *head = &__core_malloc_head[heap];
+
+    for ( fp = head->next_free ; fp != head ; fp = fp->next_free ) {
+	if ( ARENA_SIZE_GET(fp->a.attrs) >= size ) {
+	    /* Found fit -- allocate out of this block */
+	    return __malloc_from_block(fp, size, tag);
+	}
+    }
+
+    return NULL;
+}
+
+/*
+ * Like __malloc_first_fit(), but take the free block at the lowest
+ * address.  Slabs come from here, so that the small blocks they are
+ * cut into stay packed together at the bottom of the heap instead of
+ * breaking up large free blocks all over it.
+ */
+static void *__malloc_lowest_fit(size_t size, enum heap heap,
+				 malloc_tag_t tag)
+{
+    struct free_arena_header *fp;
+    struct free_arena_header *head = &__core_malloc_head[heap];
+
+    for (fp = head->a.next; fp != head; fp = fp->a.next) {
+	if (ARENA_TYPE_GET(fp->a.attrs) == ARENA_TYPE_FREE &&
+	    ARENA_SIZE_GET(fp->a.attrs) >= size)
+	    return __malloc_from_block(fp, size, tag);
+    }
+
+    return NULL;
+}
+
+struct malloc_class __malloc_classes[MALLOC_NCLASSES];
+
+/* Block sizes of the classes, in units of struct arena_header */
+static const uint8_t class_units[MALLOC_NCLASSES] = {
+    2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64
+};
+
+#define CLASS_SIZE(c)	(class_units[c] * sizeof(struct arena_header))
+
+static uint32_t fast_allocs[NHEAP], slow_allocs[NHEAP];
+
+/*
+ * Find the size class for a block of _size_ bytes, arena header
+ * included: the smallest class it fits in or, if _exact_ is set, only
+ * one of exactly that size.  Returns -1 if there is none.
+ */
+int __malloc_size_class(size_t size, bool exact)
+{
+    size_t units = size / sizeof(struct arena_header);
+    int c;
+
+    for (c = 0; c < MALLOC_NCLASSES; c++) {
+	if (class_units[c] >= units)
+	    return (!exact || class_units[c] == units) ? c : -1;
+    }
+
+    return -1;
+}
+
+/*
+ * Refill the empty list of class _c_ with a slab: one block from the
+ * heap, cut up into as many blocks of the class as fit.  If memory is
+ * tight, settle for a smaller slab.
+ */
+static void __malloc_refill(int c)
+{
+    struct malloc_class *mc = &__malloc_classes[c];
+    size_t csize = CLASS_SIZE(c);
+    size_t n = MALLOC_SLAB_SIZE / csize;
+    struct free_arena_header *fp = NULL, *nfp, *prev, *next;
+    struct arena_header *ah;
+    size_t size, i;
+
+    for (; n; n >>= 1) {
+	ah = __malloc_lowest_fit(n * csize, HEAP_MAIN, MALLOC_FREE);
+	if (ah) {
+	    fp = (struct free_arena_header *)(ah - 1);
+	    break;
+	}
+    }
+    if (!fp)
+	return;
+
+    /* The last block takes any slack the split left us with */
+    size = ARENA_SIZE_GET(fp->a.attrs);
+    next = fp->a.next;
+    prev = fp;
+    for (i = 1; i < n; i++) {
+	nfp = (struct free_arena_header *)((char *)fp + i * csize);
+	nfp->a.attrs = ARENA_TYPE_USED | (HEAP_MAIN << ARENA_HEAP_POS);
+	ARENA_SIZE_SET(nfp->a.attrs, csize);
+	nfp->a.tag = MALLOC_FREE;
+#ifdef DEBUG_MALLOC
+	nfp->a.magic = ARENA_MAGIC;
+#endif
+	nfp->a.prev = prev;
+	prev->a.next = nfp;
+	prev = nfp;
+    }
+    prev->a.next = next;
+    next->a.prev = prev;
+    ARENA_SIZE_SET(fp->a.attrs, csize);
+    ARENA_SIZE_SET(prev->a.attrs, size - (n - 1) * csize);
+
+    /* Lowest address first */
+    for (i = n; i--; ) {
+	nfp = (struct free_arena_header *)((char *)fp + i * csize);
+	nfp->next_free = mc->list;
+	mc->list = nfp;
+    }
+    mc->count += n;
+}
+
+/*
+ * Give all the blocks on the size-class lists back to the heap.
+ * Returns true if there were any.
+ */
+static bool __malloc_flush_classes(void)
+{
+    struct malloc_class *mc;
+    struct free_arena_header *fp;
+    bool flushed = false;
+    int c;
+
+    for (c = 0; c < MALLOC_NCLASSES; c++) {
+	mc = &__malloc_classes[c];
+	while ((fp = mc->list)) {
+	    mc->list = fp->next_free;
+	    __free_block(fp);
+	    flushed = true;
+	}
+	mc->count = 0;
+    }
+
+    return flushed;
+}
+
 void *bios_malloc(size_t size, enum heap heap, malloc_tag_t tag)
 {
     struct free_arena_header *fp;
+    struct malloc_class *mc;
+    void *p;
+    int c;
+
+    if (!size)
+	return NULL;
+
+    /* Add the obligatory arena header, and round up */
+    size = (size + 2 * sizeof(struct arena_header) - 1) & ARENA_SIZE_MASK;
+
+    if (heap == HEAP_MAIN && (c = __malloc_size_class(size, false)) >= 0) {
+	mc = &__malloc_classes[c];
+	if (!mc->list)
+	    __malloc_refill(c);
+
+	fp = mc->list;
+	if (fp) {
+	    mc->list = fp->next_free;
+	    mc->count--;
+	    fp->a.tag = tag;
+	    fast_allocs[heap]++;
+	    return (void *)(&fp->a + 1);
+	}
+    }
+
+    slow_allocs[heap]++;
+    p = __malloc_first_fit(size, heap, tag);
+
+    /* Out of memory?  Try again with the size-class lists emptied */
+    if (!p && heap == HEAP_MAIN && __malloc_flush_classes())
+	p = __malloc_first_fit(size, heap, tag);
+
+    return p;
+}
+
+/*
+ * Allocate out of the free block which contains all of the arena
+ * header and data of an allocation at _ptr_; the free space in front
+ * of the header becomes a free block of its own.
+ */
+static void *__malloc_at(void *ptr, size_t size, enum heap heap,
+			 malloc_tag_t tag)
+{
+    struct free_arena_header *fp, *nfp;
     struct free_arena_header *head = &__core_malloc_head[heap];
-    void *p = NULL;
+    char *start = (char *)ptr - sizeof(struct arena_header);
+    size_t fsize, hsize;
+
+    for (fp = head->next_free; fp != head; fp = fp->next_free) {
+	fsize = ARENA_SIZE_GET(fp->a.attrs);
+	if ((char *)fp > start || (char *)fp + fsize < start + size)
+	    continue;
+
+	hsize = start - (char *)fp;
+	if (hsize) {
+	    /* The block in front must be big enough to stay free */
+	    if (hsize < 2 * sizeof(struct arena_header))
+		return NULL;
+
+	    nfp = (struct free_arena_header *)start;
+	    ARENA_TYPE_SET(nfp->a.attrs, ARENA_TYPE_FREE);
+	    ARENA_HEAP_SET(nfp->a.attrs, heap);
+	    ARENA_SIZE_SET(nfp->a.attrs, fsize - hsize);
+	    nfp->a.tag = MALLOC_FREE;
+#ifdef DEBUG_MALLOC
+	    nfp->a.magic = ARENA_MAGIC;
+#endif
+	    ARENA_SIZE_SET(fp->a.attrs, hsize);
 
-    if (size) {
-	/* Add the obligatory arena header, and round up */
-	size = (size + 2 * sizeof(struct arena_header) - 1) & ARENA_SIZE_MASK;
+	    /* Insert into all-block chain */
+	    nfp->a.prev = fp;
+	    nfp->a.next = fp->a.next;
+	    nfp->a.next->a.prev = nfp;
+	    fp->a.next = nfp;
 
-	for ( fp = head->next_free ; fp != head ; fp = fp->next_free ) {
-	    if ( ARENA_SIZE_GET(fp->a.attrs) >= size ) {
-		/* Found fit -- allocate out of this block */
-		p = __malloc_from_block(fp, size, tag);
-		break;
-	    }
-        }
+	    /* Insert into free chain, right after the front part */
+	    nfp->prev_free = fp;
+	    nfp->next_free = fp->next_free;
+	    nfp->next_free->prev_free = nfp;
+	    fp->next_free = nfp;
+
+	    fp = nfp;
+	}
+
+	return __malloc_from_block(fp, size, tag);
     }
 
+    return NULL;
+}
+
+/*
+ * Allocate _size_ bytes at exactly _ptr_, which has to be aligned to
+ * the arena header size.  Returns NULL if that memory is not free.
+ */
+void *bios_malloc_at(void *ptr, size_t size, enum heap heap,
+		     malloc_tag_t tag)
+{
+    void *p;
+
+    if (!size || ((uintptr_t)ptr & ~ARENA_SIZE_MASK))
+	return NULL;
+
+    /* Add the obligatory arena header, and round up */
+    size = (size + 2 * sizeof(struct arena_header) - 1) & ARENA_SIZE_MASK;
+
+    slow_allocs[heap]++;
+    p = __malloc_at(ptr, size, heap, tag);
+
+    /* Small blocks sitting on the class lists may be in the way */
+    if (!p && heap == HEAP_MAIN && __malloc_flush_classes())
+	p = __malloc_at(ptr, size, heap, tag);
+
     return p;
 }
 
+/*
+ * Collect statistics about a heap; blocks in use are also counted
+ * separately for those that carry _tag_.
+ */
+__export void get_heap_stats(enum heap heap, malloc_tag_t tag,
+			     struct heap_stats *st)
+{
+    struct free_arena_header *fp;
+    struct free_arena_header *head = &__core_malloc_head[heap];
+    size_t size;
+
+    memset(st, 0, sizeof *st);
+
+    sem_down(&__malloc_semaphore, 0);
+
+    for (fp = head->a.next; fp != head; fp = fp->a.next) {
+	size = ARENA_SIZE_GET(fp->a.attrs);
+
+	if (ARENA_TYPE_GET(fp->a.attrs) == ARENA_TYPE_FREE) {
+	    st->free_bytes += size;
+	    st->free_blocks++;
+	    if (size > st->largest_free)
+		st->largest_free = size;
+	} else if (fp->a.tag == MALLOC_FREE) {
+	    st->cached_bytes += size;
+	    st->cached_blocks++;
+	} else {
+	    st->used_bytes += size;
+	    st->used_blocks++;
+	    if (fp->a.tag == tag) {
+		st->tag_bytes += size;
+		st->tag_blocks++;
+	    }
+	}
+    }
+
+    st->fast_allocs = fast_allocs[heap];
+    st->slow_allocs = slow_allocs[heap];
+
+    sem_up(&__malloc_semaphore);
+}
+
 static void *_malloc(size_t size, enum heap heap, malloc_tag_t tag)
 {
     void *p;
@@ -128,6 +411,18 @@ void *pmapi_lmalloc(size_t size)
     return _malloc(size, HEAP_LOWMEM, MALLOC_MODULE);
 }
 
+__export void *malloc_at(void *ptr, size_t size)
+{
+    void *p = NULL;
+
+    sem_down(&__malloc_semaphore, 0);
+    if (firmware->mem->malloc_at)
+	p = firmware->mem->malloc_at(ptr, size, HEAP_MAIN, MALLOC_CORE);
+    sem_up(&__malloc_semaphore);
+
+    return p;
+}
+
 void *bios_realloc(void *ptr, size_t size)
 {
     struct free_arena_header *ah, *nah;
@@ -4,36 +4,24 @@
  * Internals for the memory allocator
  */
 
+#ifndef CORE_MEM_MALLOC_H
+#define CORE_MEM_MALLOC_H
+
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
+#include <syslinux/heap.h>
 #include "core.h"
 #include "thread.h"
 
 extern struct semaphore __malloc_semaphore;
 
-/*
- * This is a temporary hack.  In Syslinux 5 this will be a pointer to
- * the owner module.
- */
-typedef size_t malloc_tag_t;
-enum malloc_owner {
-    MALLOC_FREE,
-    MALLOC_HEAD,
-    MALLOC_CORE,
-    MALLOC_MODULE,
-};
-
 enum arena_type {
     ARENA_TYPE_USED = 0,
     ARENA_TYPE_FREE = 1,
     ARENA_TYPE_HEAD = 2,
     ARENA_TYPE_DEAD = 3,
 };
-enum heap {
-    HEAP_MAIN,
-    HEAP_LOWMEM,
-    NHEAP
-};
 
 #define ARENA_MAGIC 0x20130117
 
@@ -96,3 +84,27 @@ struct free_arena_header {
 
 extern struct free_arena_header __core_malloc_head[NHEAP];
 void __inject_free_block(struct free_arena_header *ah);
+struct free_arena_header *__free_block(struct free_arena_header *ah);
+
+/*
+ * Size classes.  Small blocks of the main heap are not coalesced when
+ * freed but kept on a free list per block size, from which malloc()
+ * hands them out again without searching the heap.  An empty list is
+ * refilled with a whole slab of blocks carved out of the heap at once;
+ * a full one (MALLOC_CLASS_BYTES) lets freed blocks coalesce as usual.
+ * Blocks on these lists stay ARENA_TYPE_USED, so nothing merges with
+ * them, and carry the tag MALLOC_FREE.
+ */
+#define MALLOC_NCLASSES		11
+#define MALLOC_SLAB_SIZE	4096	/* Bytes carved out per refill */
+#define MALLOC_CLASS_BYTES	(4 * MALLOC_SLAB_SIZE)	/* Max kept on one list */
+
+struct malloc_class {
+    struct free_arena_header *list;	/* Linked through next_free */
+    unsigned int count;
+};
+
+extern struct malloc_class __malloc_classes[MALLOC_NCLASSES];
+int __malloc_size_class(size_t size, bool exact);
+
+#endif /* CORE_MEM_MALLOC_H */
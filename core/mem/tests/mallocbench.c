@@ -0,0 +1,306 @@
+#include "unittest/unittest.h"
+#include </usr/include/string.h>
+#include <com32.h>
+
+/*
+ * Fake dependencies of malloc.c and free.c: no threads, and the
+ * firmware memory operations are the BIOS ones under test.  The
+ * allocator's entry points are renamed so that they don't replace the
+ * host's own malloc().
+ */
+struct semaphore {
+    int count;
+};
+#define DECLARE_INIT_SEMAPHORE(s, v)	struct semaphore s = { v }
+#define sem_down(s, t)			((void)(s), 0)
+#define sem_up(s)			((void)(s))
+
+#define malloc		core_malloc
+#define lmalloc		core_lmalloc
+#define pmapi_lmalloc	core_pmapi_lmalloc
+#define realloc		core_realloc
+#define zalloc		core_zalloc
+#define free		core_free
+#define malloc_at	core_malloc_at
+
+void free(void *);
+
+#include "../malloc.c"
+#include "../free.c"
+
+/* struct mem_ops was declared after the renames above */
+static struct mem_ops test_mem_ops = {
+    .malloc = bios_malloc,
+    .realloc = bios_realloc,
+    .free = bios_free,
+    .malloc_at = bios_malloc_at,
+};
+static struct firmware test_fw = {
+    .mem = &test_mem_ops,
+};
+struct firmware *firmware = &test_fw;
+
+struct free_arena_header __core_malloc_head[NHEAP];
+
+#define HEAP_SIZE	(16 << 20)
+static char *heap_mem;
+
+/*
+ * Start from an empty main heap consisting of one HEAP_SIZE block.
+ */
+static void heap_reset(void)
+{
+    struct free_arena_header *fp;
+    int i;
+
+    memset(__malloc_classes, 0, sizeof __malloc_classes);
+
+    fp = &__core_malloc_head[0];
+    for (i = 0; i < NHEAP; i++) {
+	fp->a.next = fp->a.prev = fp->next_free = fp->prev_free = fp;
+	fp->a.attrs = ARENA_TYPE_HEAD | (i << ARENA_HEAP_POS);
+	fp->a.tag = MALLOC_HEAD;
+	fp++;
+    }
+
+    if (!heap_mem)
+	heap_mem = aligned_alloc(4096, HEAP_SIZE);
+
+    fp = (struct free_arena_header *)heap_mem;
+    fp->a.attrs = ARENA_TYPE_USED | (HEAP_MAIN << ARENA_HEAP_POS);
+    ARENA_SIZE_SET(fp->a.attrs, HEAP_SIZE);
+    __inject_free_block(fp);
+}
+
+/* Mostly small objects, like refstrs, inodes and dirents, some large */
+static size_t rnd_size(void)
+{
+    unsigned int r = rnd();
+
+    if (r % 16 == 0)
+	return 1024 + r % (64 << 10);
+    return 1 + r % 256;
+}
+
+/*
+ * Every block handed out must be intact and not overlap any other.
+ */
+static int test_integrity(void)
+{
+    enum { NPTR = 2000, ROUNDS = 200000 };
+    static unsigned char *ptr[NPTR];
+    static size_t len[NPTR];
+    struct heap_stats st;
+    int i, j, bad = 0;
+
+    heap_reset();
+
+    for (i = 0; i < ROUNDS; i++) {
+	j = rnd() % NPTR;
+	if (ptr[j]) {
+	    size_t k;
+
+	    for (k = 0; k < len[j]; k++) {
+		if (ptr[j][k] != (unsigned char)j) {
+		    bad++;
+		    break;
+		}
+	    }
+	    core_free(ptr[j]);
+	    ptr[j] = NULL;
+	} else {
+	    len[j] = rnd_size();
+	    ptr[j] = core_malloc(len[j]);
+	    if (ptr[j])
+		memset(ptr[j], j, len[j]);
+	}
+    }
+
+    syslinux_assert_str(!bad, "%d blocks were corrupted", bad);
+
+    get_heap_stats(HEAP_MAIN, MALLOC_CORE, &st);
+    syslinux_assert_str(st.used_bytes + st.free_bytes + st.cached_bytes ==
+			HEAP_SIZE, "Heap accounting is off");
+    syslinux_assert_str(st.fast_allocs > st.slow_allocs,
+			"Small allocations didn't use the size classes");
+
+    for (j = 0; j < NPTR; j++) {
+	core_free(ptr[j]);
+	ptr[j] = NULL;
+    }
+
+    get_heap_stats(HEAP_MAIN, MALLOC_CORE, &st);
+    syslinux_assert_str(!st.used_blocks, "Blocks still in use after free");
+    syslinux_assert_str(st.cached_blocks, "Nothing kept on the class lists");
+    syslinux_assert_str(st.cached_bytes <= MALLOC_NCLASSES * MALLOC_CLASS_BYTES,
+			"The class lists hold %zu bytes", st.cached_bytes);
+
+    return 0;
+}
+
+/*
+ * Memory held on the size-class lists must not make a large
+ * allocation fail.
+ */
+static int test_flush(void)
+{
+    enum { NPTR = 20000 };
+    static void *ptr[NPTR];
+    struct heap_stats st;
+    void *big;
+    int i;
+
+    heap_reset();
+
+    for (i = 0; i < NPTR; i++)
+	ptr[i] = core_malloc(1 + i % 200);
+    for (i = 0; i < NPTR; i++)
+	core_free(ptr[i]);
+
+    big = core_malloc(HEAP_SIZE - 4096);
+    syslinux_assert_str(big, "Cached blocks weren't given back");
+    core_free(big);
+
+    get_heap_stats(HEAP_MAIN, MALLOC_CORE, &st);
+    syslinux_assert_str(st.free_blocks == 1 && st.free_bytes == HEAP_SIZE,
+			"Heap didn't coalesce back into one block");
+
+    return 0;
+}
+
+/*
+ * Usage is reported per tag.
+ */
+static int test_tags(void)
+{
+    struct heap_stats st;
+    void *a, *b;
+
+    heap_reset();
+
+    a = bios_malloc(100, HEAP_MAIN, MALLOC_MODULE);
+    b = bios_malloc(10000, HEAP_MAIN, MALLOC_CORE);
+
+    get_heap_stats(HEAP_MAIN, MALLOC_MODULE, &st);
+    syslinux_assert_str(st.tag_blocks == 1 && st.used_blocks == 2,
+			"Wrong tag accounting");
+    syslinux_assert_str(st.tag_bytes >= 100 && st.tag_bytes < 10000,
+			"Wrong tag byte count");
+
+    bios_free(a);
+    bios_free(b);
+    return 0;
+}
+
+/*
+ * Placed allocations get exactly the address asked for, and only if
+ * that memory is free.
+ */
+static int test_malloc_at(void)
+{
+    struct heap_stats st;
+    char *want = heap_mem + HEAP_SIZE / 2;
+    void *a, *b, *small;
+
+    heap_reset();
+
+    /* Small blocks cached on the class lists must not get in the way */
+    small = core_malloc(16);
+    core_free(small);
+
+    a = core_malloc_at(want, 1 << 20);
+    syslinux_assert_str(a == want, "Placed allocation at %p, not %p", a, want);
+
+    b = core_malloc_at(want + 4096, 100);
+    syslinux_assert_str(!b, "Memory was handed out twice");
+
+    b = core_malloc_at(heap_mem + 4096, 100);
+    syslinux_assert_str(b == heap_mem + 4096, "Allocation at the front failed");
+
+    b = core_malloc_at(want + 1, 100);
+    syslinux_assert_str(!b, "Misaligned address was accepted");
+
+    core_free(a);
+    core_free(heap_mem + 4096);
+
+    get_heap_stats(HEAP_MAIN, MALLOC_CORE, &st);
+    syslinux_assert_str(!st.used_blocks, "Blocks still in use after free");
+    syslinux_assert_str(st.free_blocks == 1 && st.free_bytes == HEAP_SIZE,
+			"Heap didn't coalesce back into one block");
+
+    return 0;
+}
+
+/*
+ * Benchmarks: the same random workload, through the size classes and
+ * through the plain first-fit allocator underneath them.  The workload
+ * is run a few times and the fastest run counts, which keeps the
+ * timings reasonably stable on a busy host.
+ */
+static void *ff_malloc(size_t size)
+{
+    size = (size + 2 * sizeof(struct arena_header) - 1) & ARENA_SIZE_MASK;
+    return __malloc_first_fit(size, HEAP_MAIN, MALLOC_CORE);
+}
+
+static void ff_free(void *ptr)
+{
+    if (ptr)
+	__free_block((struct free_arena_header *)
+		     ((struct arena_header *)ptr - 1));
+}
+
+static void bench(const char *name, void *(*alloc)(size_t),
+		  void (*release)(void *))
+{
+    enum { NPTR = 4000, ROUNDS = 1000000, RUNS = 5 };
+    static void *ptr[NPTR];
+    struct heap_stats st;
+    double t, best = 0;
+    int i, j, run;
+
+    for (run = 0; run < RUNS; run++) {
+	heap_reset();
+	rnd_state = 1;
+
+	t = now();
+	for (i = 0; i < ROUNDS; i++) {
+	    j = rnd() % NPTR;
+	    if (ptr[j]) {
+		release(ptr[j]);
+		ptr[j] = NULL;
+	    } else {
+		ptr[j] = alloc(rnd_size());
+	    }
+	}
+	t = now() - t;
+	if (!run || t < best)
+	    best = t;
+
+	/* The workload is the same every time, and so is the heap */
+	if (run == RUNS - 1)
+	    get_heap_stats(HEAP_MAIN, MALLOC_CORE, &st);
+
+	for (j = 0; j < NPTR; j++) {
+	    release(ptr[j]);
+	    ptr[j] = NULL;
+	}
+    }
+
+    printf("\t%-10s %6.1f ns/op, %zu free blocks, largest %zu KB of %zu KB free\n",
+	   name, best * 1e9 / ROUNDS, st.free_blocks,
+	   st.largest_free >> 10, (st.free_bytes + st.cached_bytes) >> 10);
+}
+
+int main(int argc, char **argv)
+{
+    test_integrity();
+    test_flush();
+    test_tags();
+    test_malloc_at();
+
+    bench("first-fit", ff_malloc, ff_free);
+    bench("classes", core_malloc, core_free);
+
+    return 0;
+}
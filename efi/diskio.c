@@ -20,6 +20,71 @@ static inline EFI_STATUS write_blocks(EFI_BLOCK_IO *bio, uint32_t id,
 	return uefi_call_wrapper(bio->WriteBlocks, 5, bio, id, lba, bytes, buf);
 }
 
+/*
+ * Block I/O 2 (UEFI 2.3.1) lets us queue a read and collect it later.
+ * Older gnu-efi releases don't know about it, so carry our own
+ * definitions.
+ */
+static EFI_GUID BlockIo2Protocol = { 0xa77b2472, 0xe282, 0x4e9f,
+	{ 0xa2, 0x45, 0xc2, 0xc0, 0xe2, 0x7b, 0xbc, 0xc1 } };
+
+struct efi_block_io2_token {
+	EFI_EVENT Event;
+	EFI_STATUS TransactionStatus;
+};
+
+struct efi_block_io2 {
+	EFI_BLOCK_IO_MEDIA *Media;
+	EFI_STATUS (EFIAPI *Reset)(struct efi_block_io2 *, BOOLEAN);
+	EFI_STATUS (EFIAPI *ReadBlocksEx)(struct efi_block_io2 *, UINT32,
+					  EFI_LBA, struct efi_block_io2_token *,
+					  UINTN, VOID *);
+	EFI_STATUS (EFIAPI *WriteBlocksEx)(struct efi_block_io2 *, UINT32,
+					   EFI_LBA,
+					   struct efi_block_io2_token *,
+					   UINTN, VOID *);
+	EFI_STATUS (EFIAPI *FlushBlocksEx)(struct efi_block_io2 *,
+					   struct efi_block_io2_token *);
+};
+
+static struct efi_block_io2 *bio2;
+static struct efi_block_io2_token bio2_token;
+static size_t bio2_count;
+
+static int efi_read_start(struct disk *disk, void *buf,
+			  sector_t lba, size_t count)
+{
+	EFI_STATUS status;
+
+	status = uefi_call_wrapper(bio2->ReadBlocksEx, 6, bio2,
+				   disk->disk_number, lba, &bio2_token,
+				   count << disk->sector_shift, buf);
+	if (status != EFI_SUCCESS)
+		return -1;
+
+	bio2_count = count;
+	return 0;
+}
+
+static int efi_read_wait(struct disk *disk)
+{
+	EFI_STATUS status;
+	UINTN index;
+
+	(void)disk;
+
+	status = uefi_call_wrapper(BS->WaitForEvent, 3, 1,
+				   &bio2_token.Event, &index);
+	if (status != EFI_SUCCESS ||
+	    bio2_token.TransactionStatus != EFI_SUCCESS) {
+		dprintf("BlockIo2 read failed: 0x%x\n",
+			bio2_token.TransactionStatus);
+		return -1;
+	}
+
+	return bio2_count;
+}
+
 static int efi_rdwr_sectors(struct disk *disk, void *buf,
 			    sector_t lba, size_t count, bool is_write)
 {
@@ -33,12 +98,14 @@ static int efi_rdwr_sectors(struct disk *disk, void *buf,
 	else
 		status = read_blocks(bio, disk->disk_number, lba, bytes, buf);
 
-	if (status != EFI_SUCCESS)
+	if (status != EFI_SUCCESS) {
 		Print(L"Failed to %s blocks: 0x%x\n",
 			is_write ? L"write" : L"read",
 			status);
+		return 0;
+	}
 
-	return count << disk->sector_shift;
+	return count;
 }
 
 struct disk *efi_disk_init(void *private)
@@ -68,6 +135,7 @@ struct disk *efi_disk_init(void *private)
     disk.sector_size   = bio->Media->BlockSize;
     disk.rdwr_sectors  = efi_rdwr_sectors;
     disk.sector_shift  = ilog2(disk.sector_size);
+    disk.sectors       = bio->Media->LastBlock + 1;
 
     dprintf("sector_size=%d, disk_number=%d\n", disk.sector_size,
 	    disk.disk_number);
@@ -75,6 +143,18 @@ struct disk *efi_disk_init(void *private)
     priv->bio = bio;
     priv->dio = dio;
     disk.private = private;
+
+    /* Use Block I/O 2 for background reads if the firmware has it */
+    status = uefi_call_wrapper(BS->HandleProtocol, 3, handle,
+			       &BlockIo2Protocol, (void **)&bio2);
+    if (status == EFI_SUCCESS) {
+	status = uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL, NULL,
+				   &bio2_token.Event);
+	if (status == EFI_SUCCESS) {
+	    disk.read_start = efi_read_start;
+	    disk.read_wait  = efi_read_wait;
+	}
+    }
 #if 0
 
     disk.part_start    = part_start;
@@ -12,15 +12,31 @@ extern EFI_GUID Tcp4Protocol;
 
 extern struct efi_binding *efi_create_binding(EFI_GUID *, EFI_GUID *);
 extern void efi_destroy_binding(struct efi_binding *, EFI_GUID *);
+
+/*
+ * Each connection gets its own receive buffer, since HTTP may be
+ * reading several connections in turn and hold on to the unconsumed
+ * tail of each.
+ */
+#define TCP_RXBUF_SIZE	8192
+
 int core_tcp_open(struct pxe_pvt_inode *socket)
 {
     struct efi_binding *b;
+    char *rxbuf;
+
+    rxbuf = malloc(TCP_RXBUF_SIZE);
+    if (!rxbuf)
+	return -1;
 
     b = efi_create_binding(&Tcp4ServiceBindingProtocol, &Tcp4Protocol);
-    if (!b)
+    if (!b) {
+	free(rxbuf);
 	return -1;
+    }
 
     socket->net.efi.binding = b;
+    socket->net.efi.rxbuf = rxbuf;
 
     return 0;
 }
@@ -197,9 +213,19 @@ void core_tcp_close_file(struct inode *inode)
 
     efi_destroy_binding(b, &Tcp4ServiceBindingProtocol);
     socket->net.efi.binding = NULL;
+    free(socket->net.efi.rxbuf);
+    socket->net.efi.rxbuf = NULL;
 }
 
-static char databuf[8192];
+/*
+ * Received data is copied into the receive buffer and fully described
+ * by tftp_bytesleft, so there is never anything else held back here.
+ */
+bool core_tcp_idle(struct pxe_pvt_inode *socket)
+{
+    (void)socket;
+    return true;
+}
 
 void core_tcp_fill_buffer(struct inode *inode)
 {
@@ -210,6 +236,7 @@ void core_tcp_fill_buffer(struct inode *inode)
     EFI_TCP4_FRAGMENT_DATA *frag;
     EFI_STATUS status;
     EFI_TCP4 *tcp = (EFI_TCP4 *)b->this;
+    char *databuf = socket->net.efi.rxbuf;
     void *data;
     size_t len;
 
@@ -223,10 +250,10 @@ void core_tcp_fill_buffer(struct inode *inode)
 
     iotoken.Packet.RxData = &rxdata;
     rxdata.FragmentCount = 1;
-    rxdata.DataLength = sizeof(databuf);
+    rxdata.DataLength = TCP_RXBUF_SIZE;
     frag = &rxdata.FragmentTable[0];
     frag->FragmentBuffer = databuf;
-    frag->FragmentLength = sizeof(databuf);
+    frag->FragmentLength = TCP_RXBUF_SIZE;
 
     status = uefi_call_wrapper(tcp->Receive, 2, tcp, &iotoken);
     if (status == EFI_CONNECTION_FIN) {
@@ -204,8 +204,9 @@ static EFIAPI void udp4_cb(EFI_EVENT event, void *context)
  * @out: src_ip, ip address of the data source
  * @out: src_port, port number of the data source, host-byte order
  */
-int core_udp_recv(struct pxe_pvt_inode *socket, void *buf, uint16_t *buf_len,
-		  uint32_t *src_ip, uint16_t *src_port)
+int core_udp_recvv(struct pxe_pvt_inode *socket,
+		   const struct net_iovec *iov, int niov, uint16_t *buf_len,
+		   uint32_t *src_ip, uint16_t *src_port)
 {
     EFI_UDP4_COMPLETION_TOKEN token;
     EFI_UDP4_FRAGMENT_DATA *frag;
@@ -265,8 +266,8 @@ int core_udp_recv(struct pxe_pvt_inode *socket, void *buf, uint16_t *buf_len,
     rxdata = token.Packet.RxData;
     frag = &rxdata->FragmentTable[0];
 
-    size = min(frag->FragmentLength, *buf_len);
-    memcpy(buf, frag->FragmentBuffer, size);
+    size = net_scatter(iov, niov, frag->FragmentBuffer,
+		       frag->FragmentLength);
     *buf_len = size;
 
     memcpy(src_port, &rxdata->UdpSession.SourcePort, sizeof(*src_port));
@@ -279,6 +280,24 @@ bail:
     return rv;
 }
 
+/**
+ * Largest UDP payload core_udp_recv() can return.  We only look at
+ * the first fragment, so assume a standard Ethernet frame.
+ */
+uint16_t core_udp_max_payload(void)
+{
+    return 1500 - 28;
+}
+
+/**
+ * Each socket has its own UDP4 child instance, which only receives what
+ * is addressed to it, so several sockets can wait for answers at once.
+ */
+bool core_udp_can_demux(void)
+{
+    return true;
+}
+
 /**
  * Send a UDP packet.
  *
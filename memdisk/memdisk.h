@@ -136,5 +136,9 @@ extern int check_zip(void *indata, uint32_t size, uint32_t * zbytes_p,
 		     uint32_t * offset_p);
 extern void *unzip(void *indata, uint32_t zbytes, uint32_t dbytes,
 		   uint32_t orig_crc, void *target);
+extern int check_zstd(void *indata, uint32_t size, uint32_t * zbytes_p,
+		      uint32_t * dbytes_p, uint32_t * offset_p);
+extern void *unzstd(void *indata, uint32_t zbytes, uint32_t dbytes,
+		    void *target);
 
 #endif
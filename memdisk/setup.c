@@ -117,10 +117,18 @@ static const char *getcmditem(const char *what)
 }
 
 /*
- * Check to see if this is a gzip image
+ * Check to see if this is a compressed (gzip, zip or zstd) image
  */
 #define UNZIP_ALIGN 512
 
+/*
+ * How far the end of the output has to stay below the end of the
+ * input when decompressing in place, so that the output never catches
+ * up with input which has not been read yet: room for the overhead of
+ * incompressible data, and for one whole zstd block.
+ */
+#define UNZIP_SLACK(dbytes)	(((dbytes) >> 8) + (192 << 10))
+
 extern const char _end[];		/* Symbol signalling end of data */
 
 void unzip_if_needed(uint32_t * where_p, uint32_t * size_p)
@@ -132,11 +140,22 @@ void unzip_if_needed(uint32_t * where_p, uint32_t * size_p)
     uint32_t gzdatasize, gzwhere;
     uint32_t orig_crc, offset;
     uint32_t target = 0;
-    int i, okmem;
+    uint64_t inplace;
+    const char *format;
+    int i, okmem, zstd = 0;
 
-    /* Is it a gzip image? */
+    /* Is it a compressed image? */
     if (check_zip((void *)where, size, &zbytes, &gzdatasize,
-		  &orig_crc, &offset) == 0) {
+		  &orig_crc, &offset) == 0)
+	format = "gzip";
+    else if (check_zstd((void *)where, size, &zbytes, &gzdatasize,
+			&offset) == 0) {
+	format = "zstd";
+	zstd = 1;
+    } else
+	format = NULL;
+
+    if (format) {
 
 	if (offset + zbytes > size) {
 	    /*
@@ -177,8 +196,7 @@ void unzip_if_needed(uint32_t * where_p, uint32_t * size_p)
 		startrange = (uint32_t) _end;
 
 	    /* Allow for alignment */
-	    startrange =
-		(ranges[i].start + (UNZIP_ALIGN - 1)) & ~(UNZIP_ALIGN - 1);
+	    startrange = (startrange + (UNZIP_ALIGN - 1)) & ~(UNZIP_ALIGN - 1);
 
 	    /* In case we just killed the whole range... */
 	    if (startrange >= endrange)
@@ -201,10 +219,22 @@ void unzip_if_needed(uint32_t * where_p, uint32_t * size_p)
 	    if ((uint64_t) where + size >= gzwhere && where < endrange) {
 		/*
 		 * Need to move source data to avoid compressed/uncompressed
-		 * overlap
+		 * overlap, unless we can decompress in place: the output
+		 * then ends just below the end of the input, and only ever
+		 * overwrites input which has already been consumed.
 		 */
 		uint32_t newwhere;
 
+		inplace = (uint64_t) where + offset + zbytes;
+		if ((uint64_t) where + size <= endrange &&
+		    inplace >= (uint64_t) startrange + gzdatasize +
+		    UNZIP_SLACK(gzdatasize)) {
+		    inplace -= gzdatasize + UNZIP_SLACK(gzdatasize);
+		    target = inplace & ~(UNZIP_ALIGN - 1);
+		    okmem = 1;
+		    break;
+		}
+
 		if (gzwhere - startrange < size)
 		    continue;	/* Can't fit both old and new */
 
@@ -225,12 +255,16 @@ void unzip_if_needed(uint32_t * where_p, uint32_t * size_p)
 	    die("Not enough memory to decompress image (need 0x%08x bytes)\n",
 		gzdatasize);
 
-	printf("gzip image: decompressed addr 0x%08x, len 0x%08x: ",
-	       target, gzdatasize);
+	printf("%s image: decompressed addr 0x%08x, len 0x%08x: ",
+	       format, target, gzdatasize);
 
 	*size_p = gzdatasize;
-	*where_p = (uint32_t) unzip((void *)(where + offset), zbytes,
-				    gzdatasize, orig_crc, (void *)target);
+	if (zstd)
+	    *where_p = (uint32_t) unzstd((void *)(where + offset), zbytes,
+					 gzdatasize, (void *)target);
+	else
+	    *where_p = (uint32_t) unzip((void *)(where + offset), zbytes,
+					gzdatasize, orig_crc, (void *)target);
     }
 }
 
@@ -0,0 +1,101 @@
+/*
+ * unzstd.c
+ *
+ * Zstandard support for MEMDISK, using the decoder from the btrfs
+ * driver.  Its two allocations, the decoder state and the literals
+ * buffer, come out of a fixed scratch area.
+ */
+
+#include <stdint.h>
+#include "memdisk.h"
+#include "conio.h"
+
+#define malloc	zstd_malloc
+#define free	zstd_free
+
+#include "../core/fs/btrfs/zstd.c"
+
+static char zstd_scratch[sizeof(struct zstd_ctx) + ZSTD_BLOCK_MAX + 16];
+static size_t zstd_scratch_used;
+
+void *zstd_malloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~15;
+    if (size > sizeof zstd_scratch - zstd_scratch_used)
+	return NULL;
+
+    p = zstd_scratch + zstd_scratch_used;
+    zstd_scratch_used += size;
+    return p;
+}
+
+void zstd_free(void *where)
+{
+    /* Everything goes at once, when decompression is done */
+    (void)where;
+}
+
+/*
+ * Return 0 if (indata, size) is a zstd image, and fill in the
+ * compressed and uncompressed sizes and the offset of the data.  Only
+ * images which record their uncompressed size can be used, since we
+ * have to know where to put them before we start.
+ *
+ * If indata is not a zstd image, return -1.
+ */
+int check_zstd(void *indata, uint32_t size, uint32_t * zbytes_p,
+	       uint32_t * dbytes_p, uint32_t * offset_p)
+{
+    static const uint8_t did_size[4] = { 0, 1, 2, 4 };
+    const uint8_t *p = indata;
+    uint64_t dbytes;
+    unsigned int fhd, pos;
+
+    if (size < 8 || get_le32(p) != ZSTD_MAGIC)
+	return -1;
+
+    fhd = p[4];
+    pos = 5 + !(fhd & 0x20) + did_size[fhd & 3];
+    if (pos + 8 > size)
+	die("zstd image corrupt\n");
+
+    switch (fhd >> 6) {
+    case 0:
+	if (!(fhd & 0x20))
+	    die("zstd image doesn't record its uncompressed size\n");
+	dbytes = p[pos];
+	break;
+    case 1:
+	dbytes = get_le16(p + pos) + 256;
+	break;
+    case 2:
+	dbytes = get_le32(p + pos);
+	break;
+    default:
+	dbytes = get_le32(p + pos) | (uint64_t)get_le32(p + pos + 4) << 32;
+	break;
+    }
+
+    if (dbytes > 0xffffffff)
+	die("zstd image too large\n");
+
+    *zbytes_p = size;
+    *dbytes_p = dbytes;
+    *offset_p = 0;
+    return 0;
+}
+
+void *unzstd(void *indata, uint32_t zbytes, uint32_t dbytes, void *target)
+{
+    zstd_scratch_used = 0;
+
+    /* The return value wraps for images over 2 GB, but never to -1 */
+    if ((uint32_t)zstd_decompress(target, dbytes, indata, zbytes) != dbytes)
+	die("failed\nDecompression error\n");
+
+    puts("ok\n");
+
+    return target;
+}
@@ -63,7 +63,7 @@ endif
 VPATH = $(SRC)
 LIBOTHER_OBJS = \
 	atoi.o atol.o atoll.o calloc.o creat.o		\
-	fgets.o fprintf.o fputc.o	\
+	fgets.o getdelim.o fprintf.o fputc.o	\
 	putchar.o				\
 	getopt.o getopt_long.o						\
 	lrand48.o stack.o memccpy.o memchr.o 		\
@@ -81,7 +81,7 @@ LIBOTHER_OBJS = \
 	vsscanf.o							\
 	skipspace.o							\
 	chrreplace.o							\
-	bufprintf.o							\
+	bufprintf.o arena.o refstr.o					\
 	inet.o dhcppack.o dhcpunpack.o					\
 	strreplace.o							\
 	lstrdup.o						\
@@ -118,7 +118,7 @@ LIBENTRY_OBJS = \
 	sys/argv.o sys/sleep.o						\
 	sys/fileinfo.o sys/opendev.o sys/read.o sys/write.o sys/ftell.o \
 	sys/close.o sys/open.o sys/fileread.o sys/fileclose.o		\
-	sys/openmem.o					\
+	sys/openmem.o sys/stdiobuf.o				\
 	sys/isatty.o sys/fstat.o					\
 	\
 	dprintf.o vdprintf.o						\
@@ -205,6 +205,13 @@ CORELIBOBJS = \
 	$(LIBENTRY_OBJS) \
 	$(LIBMODULE_OBJS)
 
+# Unlike the above, these are only linked into core images that use
+# them: zlib inflate is about 24K, and only btrfs needs it
+CORELIBOPTOBJS = \
+	calloc.o							\
+	zlib/inflate.o zlib/inftrees.o zlib/inffast.o zlib/zutil.o	\
+	zlib/adler32.o zlib/crc32.o
+
 LDFLAGS	= -m elf_$(ARCH) --hash-style=gnu -T $(com32)/lib/$(ARCH)/elf.ld
 
 .SUFFIXES: .c .o .a .so .lo .i .S .s .ls .ss .lss
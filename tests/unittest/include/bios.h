@@ -0,0 +1,16 @@
+#ifndef _BIOS_H
+#define _BIOS_H
+
+#include </usr/include/stdint.h>
+
+/* No BIOS here: nothing to wait for, and no table of serial ports */
+static inline void io_delay(void)
+{
+}
+
+static inline uint16_t get_serial_port(uint16_t port)
+{
+    return port;
+}
+
+#endif /* _BIOS_H */
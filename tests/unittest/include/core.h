@@ -1,8 +1,14 @@
 #ifndef _CORE_H_
 #define _CORE_H_
 
+#include </usr/include/stdint.h>
 #include <klibc/compiler.h>
 
 #define __lowmem
 
+extern char config_cwd[];
+extern char KernelName[];
+extern uint16_t DisplayCon;
+extern uint32_t SysAppends;
+
 #endif /* _CORE_H_ */
@@ -0,0 +1,15 @@
+#ifndef _FS_H
+#define _FS_H
+
+#include <stdbool.h>
+
+struct path_entry;
+extern struct path_entry *path_add(const char *str);
+extern int open_config(void);
+
+static inline bool not_whitespace(char c)
+{
+    return (unsigned char)c > ' ';
+}
+
+#endif /* _FS_H */
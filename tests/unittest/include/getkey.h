@@ -0,0 +1 @@
+#include <../../../com32/libutil/include/getkey.h>
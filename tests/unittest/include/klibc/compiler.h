@@ -6,6 +6,13 @@
 /* Packed structures */
 #define __packed	__attribute__((packed))
 
+/* Never allocated as a common symbol */
+#define __nocommon
+
+/* Module constructors and destructors */
+#define __constructor	__attribute__((constructor))
+#define __destructor	__attribute__((destructor))
+
 /* Weak symbols */
 #define __weak
 
@@ -0,0 +1 @@
+#include <../../../com32/include/klibc/extern.h>
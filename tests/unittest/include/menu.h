@@ -0,0 +1 @@
+#include <../../../com32/include/menu.h>
@@ -0,0 +1 @@
+#include <../../../com32/include/syslinux/pxe_api.h>
@@ -7,6 +7,7 @@
 #include </usr/include/stdlib.h>
 #include </usr/include/stdio.h>
 #include </usr/include/stdint.h>
+#include </usr/include/time.h>
 
 /*
  * Provide a version of assert() that prints helpful error messages when
@@ -26,4 +27,25 @@
 	fprintf(stderr, "\", expr \"%s\"\n", __STRING(condition)); \
     }
 
+/*
+ * For benchmarks: a monotonic clock in seconds, and a small
+ * pseudo-random generator, so that a workload is the same on every
+ * host and can be replayed by resetting rnd_state.
+ */
+static inline double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned int rnd_state __attribute__((unused)) = 1;
+
+static inline unsigned int rnd(void)
+{
+    rnd_state = rnd_state * 1103515245 + 12345;
+    return rnd_state >> 8;
+}
+
 #endif /* _UNITTEST_H_ */